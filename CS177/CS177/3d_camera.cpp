@@ -1,454 +1,366 @@
 
-#include <GL/glew.h>
-#include <GL/glfw.h>
-#include <cstdio>
-#include <cmath>
-#include <iostream>
-#include <vector>
-#include <algorithm>
+#include "Utility.hpp"
+#include "FlatScene.hpp"
+#include "InstancedRenderer.hpp"
+#include "DrawQueue.hpp"
+#include "RenderBatches.hpp"
+#include "UniformBlocks.hpp"
+#include "BVH.hpp"
+#include "FrameStats.hpp"
+#include "Profiler.hpp"
+#include "Arena.hpp"
+#include "AllocationCounter.hpp"
+#include "Animation.hpp"
+#include "FramePipeline.hpp"
+#include "SceneFile.hpp"
+#include "SceneStreamer.hpp"
+#include "StaticBatches.hpp"
+#ifdef CS177_HEADLESS
+#include "HeadlessContext.hpp"
+#endif
 
-using namespace std;
 
-static const double MY_PI = 3.14159265358979323846264338327;
-
-struct Vtx {
-	GLfloat x, y, z;
-	GLuint color;
-};
-
-enum { ATTRIB_POS, ATTRIB_COLOR };
-
-GLuint UNIFORM_transfromationMatrix;
-
-
-/********************
+/****************************************
  *
- * 3x3 OpenGL Matrix class
+ * The real meat of the program.
  *
- ********************/
-struct GLMatrix4 {
-	GLfloat mat[16];
-
-	void create_rotation_matrix_4x4Y(GLfloat x, GLfloat y, GLfloat z, GLfloat theta, GLfloat *mat){
-		const GLfloat c = cos(theta), s = sin(theta);
-		mat[0] = c, mat[4] = 0, mat[8] = s,	mat[12] = (x*(1-c))-(z*s);
-		mat[1] = 0, mat[5] = 1, mat[9] = 0,	mat[13] = 0;
-		mat[2] = -1*s, mat[6] = 0, mat[10] = c, mat[14] = (x*s )+ (z*(1-c));
-		mat[3] = 0, mat[7] = 0, mat[11] =0, mat[15] = 1;
-	}
-
-	void create_rotation_matrix_4x4X(GLfloat x, GLfloat y, GLfloat z, GLfloat theta, GLfloat *mat) {
-		const GLfloat c = cos(theta), s = sin(theta);
-		mat[0] = 1, mat[4] = 0, mat[8] = 0,	mat[12] = 0;
-		mat[1] = 0, mat[5] = c, mat[9] = -1*s,	mat[13] = (s*z)+(y*(1-c));
-		mat[2] = 0, mat[6] = s, mat[10] = c, mat[14] = (-1*y*s)+(z*(1-c));
-		mat[3] = 0, mat[7] = 0, mat[11] =0, mat[16] = 1;
-	}
-
-	void create_rotation_matrix_4x4Z(GLfloat x, GLfloat y, GLfloat z, GLfloat theta, GLfloat *mat) {
-		const GLfloat c = cos(theta), s = sin(theta);
-		mat[0] = c, mat[4] = -s, mat[8] = 0,	mat[12] = (x*(1-c))+(y*s);
-		mat[1] = s, mat[5] = c, mat[9] = 0,	mat[13] = (y*(1-c))-(-1*s*x);
-		mat[2] = 0, mat[6] = 0, mat[10] = 1, mat[14] = 0;
-		mat[3] = 0, mat[7] = 0, mat[11] =0, mat[15] = 1;
-	}
-
-	void setIdentity() {
-		mat[0] = 1, mat[4] = 0, mat[8] = 0, mat[12] = 0;
-		mat[1] = 0, mat[5] = 1, mat[9] = 0, mat[13] = 0;
-		mat[2] = 0, mat[6] = 0, mat[10] = 1, mat[14] = 0;
-		mat[3] = 0, mat[7] = 0, mat[11] = 0, mat[15] = 1;
-	}
+ * The nodes are created in the arena, which destroys them all at once when we clean up.
+ * The cleaning up is not really necessary since we're gonna exit anyway.
+ ****************************************/
+void createScene(SceneNode &root, NodeArena &arena) {
+	static const GLuint xColor = 0xFF0000FF, yColor = 0xFFFF0000;
+	SceneNode *nodes[6];
 	
-	void setRotationX(GLfloat x, GLfloat y, GLfloat z, GLfloat theta) {
-		create_rotation_matrix_4x4X(x, y, z, theta, mat);
-	}
+	root.children.push_back(nodes[0] = arena.create<CoordinateFrameNode>(0xFF00FFFF, 0xFFFFFF00));
 	
-	void setRotationY(GLfloat x, GLfloat y, GLfloat z, GLfloat theta) {
-		create_rotation_matrix_4x4Y(x, y, z, theta, mat);
-	}
-
-	void setRotationZ(GLfloat x, GLfloat y, GLfloat z, GLfloat theta) {
-		create_rotation_matrix_4x4Z(x, y, z, theta, mat);
-	}
-
-	void setTranslation(GLfloat x, GLfloat y, GLfloat z) {
-		mat[0] = 1, mat[4] = 0, mat[8] = 0, mat[12] = x;
-		mat[1] = 0, mat[5] = 1, mat[9] = 0, mat[13] = y;
-		mat[2] = 0, mat[6] = 0, mat[10] = 1, mat[14] = z;
-		mat[3] = 0, mat[7] = 0, mat[11] = 0, mat[15] = 1;
-	}
-
-	void translate(GLfloat x, GLfloat y, GLfloat z) {
-		mat[12] += x;
-		mat[13] += y;
-		mat[14] += z;
-	}
+	CoordinateFrameNode *coordinateFrame = arena.create<CoordinateFrameNode>(xColor, yColor);
+	nodes[1] = coordinateFrame;
 	
-	void scale(GLfloat sx, GLfloat sy, GLfloat sz) {
-		mat[0] *= sx;
-		mat[4] *= sx;
-		mat[8] *= sx;
-		mat[12] *= sx;
-		
-		mat[1] *= sy;
-		mat[5] *= sy;
-		mat[9] *= sy;
-		mat[13] *= sy;
-		
-		mat[2] *= sz;
-		mat[6] *= sz;
-		mat[10] *= sz;
-		mat[14] *= sz;
-	}
+	coordinateFrame->transform.scale(0.5,0.5,0);
 	
-	void transpose() {
-		swap(mat[4],mat[1]);
-		swap(mat[8],mat[2]);
-		swap(mat[12],mat[3]);
-		swap(mat[9],mat[6]);
-		swap(mat[13],mat[7]);
-		swap(mat[14], mat[11]);
-	}
+	root.children.push_back(nodes[2] = arena.create<RegularPolygonNode>(.3, 4, 0xFF00AAAA));
+	nodes[2]->transform.setRotationY(0.5, 0.5, 0,MY_PI/6);
+	nodes[2]->transform.translate(0, 0.5,0);
+	nodes[2]->children.push_back(coordinateFrame);
 	
-	GLMatrix4& operator=(const GLMatrix4 &rhs) {
-		memcpy(mat, rhs.mat, sizeof(mat));
-		return *this;
-	}
+	nodes[2]->children.push_back(nodes[3] = arena.create<RegularPolygonNode>(.05, 16, 0xFFFFFFFF));
+	nodes[3]->transform.translate(.2,.2,0);
+	nodes[3]->children.push_back(coordinateFrame);
 	
-	GLMatrix4 operator*(const GLMatrix4 &rhs) const {
-		GLMatrix4 ret;
-		for ( int i = 0; i < 16; ++i ) {
-			const int a = i % 4, b = (i / 4) * 4;
-			ret.mat[i] = mat[a]*rhs.mat[b] + mat[a+4]*rhs.mat[b+1] + mat[a+8]*rhs.mat[b+2] + mat[a+12]*rhs.mat[b+3];
-		}
-		return ret;
-	}
+	nodes[2]->children.push_back(nodes[4] = arena.create<RegularPolygonNode>(.05, 16, 0xFFAAFAFA));
+	nodes[4]->transform.translate(-.2,.2,0);
+	nodes[4]->children.push_back(coordinateFrame);
 	
-	GLMatrix4& operator*=(const GLMatrix4 &rhs) {
-		GLMatrix4 tmp;
-		for ( int i = 0; i < 9; ++i ) {
-			const int a = i % 3, b = (i / 3) * 3;
-			tmp.mat[i] = mat[a]*rhs.mat[b] + mat[a+4]*rhs.mat[b+1] + mat[a+8]*rhs.mat[b+2] + mat[a+12]*rhs.mat[b+3];
+	//the corner frame, and the circles with the frames they carry, are baked; the circles are drawn between
+	//the square and the pentagon, and their pulse in the animation re-bakes a few dozen vertices a frame
+	nodes[0]->staticSubtree = true;
+	nodes[3]->staticSubtree = true;
+	nodes[4]->staticSubtree = true;
+	
+	root.children.push_back(nodes[5] = arena.create<RegularPolygonNode>(.2, 5, 0xFFAAFF00));
+	nodes[5]->transform.translate(-.4, .1,0);
+	nodes[5]->children.push_back(coordinateFrame);
+	
+}
+//a looping 4 second clip for createScene's nodes: the pentagon spins around its place and the two
+//small circles on the square pulse, out of phase
+void createAnimation(KeyframeAnimation &animation, SceneNode &root) {
+	SceneNode *square = root.children[1];
+	SceneNode *targets[3] = { root.children[2], square->children[1], square->children[2] };
+	for ( size_t i = 0; i < animation.tracks(); ++i )
+		animation.setTarget(i, targets[i]);
+	const size_t keyCount = 65;
+	for ( size_t k = 0; k < keyCount; ++k ) {
+		const float phase = (float) (2 * MY_PI * k / (keyCount - 1));
+		TrackKey pentagon = { { -.4f, .1f + .05f * sin(phase), 0 }, Quaternion::fromAxisAngle(0, 0, 1, phase), { 1, 1, 1 } };
+		animation.setKey(0, k, pentagon);
+		for ( int j = 0; j < 2; ++j ) {
+			const float pulse = 1 + .5f * sin(phase + (float) MY_PI * j);
+			TrackKey circle = { { j ? -.2f : .2f, .2f, 0 }, Quaternion(), { pulse, pulse, 1 } };
+			animation.setKey(1 + j, k, circle);
 		}
-		memcpy(mat, tmp.mat, sizeof(mat));
-		return *this;
 	}
-};
+}
 
-/********************
- *
- * Scene Node class used to implement a transformation hierarchy.
- *
- ********************/
-class SceneNode {
-public:
-	GLMatrix4 transform;
-	vector<SceneNode*> children;
-	SceneNode() {
-		transform.setIdentity();
+//the ways drawScene can submit the flattened scene
+enum RenderPath { RENDER_INSTANCED, RENDER_QUEUE, RENDER_BATCHES, RENDER_UNIFORM_BLOCKS };
+
+//draws the visible entries [begin, end) of the scene along the chosen path; returns the draw calls issued
+size_t drawRange(const FlatScene &flatScene, RenderPath path, JobSystem &jobs, InstancedRenderer &instanced, DrawQueue &queue, RenderBatches &batches, UniformBlockRenderer &blocks, GLuint program, const GLMatrix4 &viewTransform, const char *visible, size_t begin, size_t end) {
+	if ( begin == end )
+		return 0;
+	if ( path == RENDER_INSTANCED ) {
+		instanced.upload(flatScene, visible, begin, end);
+		instanced.draw(viewTransform);
+		return instanced.lastDrawCalls();
 	}
-	virtual void draw(const GLMatrix4 &parentTransform) {
-		drawChildren(parentTransform * transform);
+	if ( path == RENDER_BATCHES ) {
+		glUseProgram(program);
+		batches.draw(flatScene, viewTransform, visible, begin, end);
+		return batches.lastDrawCalls();
 	}
-	
-	virtual void update(double t) {
-		for ( size_t i = 0; i < children.size(); ++i )
-			children[i]->update(t);
+	if ( path == RENDER_UNIFORM_BLOCKS ) {
+		blocks.draw(visible, begin, end);
+		return blocks.lastDrawCalls();
 	}
-	
-	void drawChildren(const GLMatrix4 &t) {
-		for ( size_t i = 0; i < children.size(); ++i )
-			children[i]->draw(t);
+	const size_t before = queue.stats.drawCalls;
+	queue.recordSceneParallel(jobs, 0, program, UNIFORM_transfromationMatrix, flatScene, viewTransform, visible, begin, end);
+	queue.submit();
+	return queue.stats.drawCalls - before;
+}
+
+//draws the scene for one viewport along the chosen path, with the baked static subtrees in their place unless
+//statics is null; subtrees outside the viewport's view volume are dropped before any GL call. Returns the draw calls issued
+size_t drawScene(const FlatScene &flatScene, RenderPath path, JobSystem &jobs, InstancedRenderer &instanced, DrawQueue &queue, RenderBatches &batches, UniformBlockRenderer &blocks, StaticBatches *statics, GLuint program, const GLMatrix4 &viewTransform, FrameScratch &scratch, CullStats &cullStats) {
+	char *visible = scratch.allocArray<char>(flatScene.size());
+	flatScene.cull(viewTransform, visible, cullStats);
+	if ( path == RENDER_UNIFORM_BLOCKS ) {
+		//the model matrices were uploaded once for the frame; only the camera changes per viewport
+		GLMatrix4 projection;
+		projection.setIdentity();
+		blocks.setCamera(viewTransform, projection);
 	}
-	
-	virtual ~SceneNode() {
+	if ( !statics )
+		return drawRange(flatScene, path, jobs, instanced, queue, batches, blocks, program, viewTransform, visible, 0, flatScene.size());
+
+	//the regular path draws what comes between the stops, so the batches end up where their subtrees are in the scene
+	size_t drawCalls = 0, begin = 0;
+	statics->hide(flatScene, visible);
+	for ( size_t s = 0; s < statics->stopCount(); ++s ) {
+		const size_t end = statics->stopEntry(s);
+		drawCalls += drawRange(flatScene, path, jobs, instanced, queue, batches, blocks, program, viewTransform, visible, begin, end);
+		glUseProgram(program);
+		statics->drawStop(s, flatScene, viewTransform, visible);
+		begin = end;
 	}
-};
-
+	drawCalls += drawRange(flatScene, path, jobs, instanced, queue, batches, blocks, program, viewTransform, visible, begin, flatScene.size());
+	return drawCalls + statics->lastDrawCalls();
+}
 
-class RegularPolygonNode : public SceneNode {
-	vector<Vtx> vertices;
-public:
-	RegularPolygonNode(GLfloat radius, GLuint sides, GLuint color) : vertices(2 + max(sides,3u)) {
-		sides = max(sides,3u);
-		vertices.front().x = vertices.front().y = 0;
-		vertices.front().color = color;
-		
-		for ( size_t i = 0; i < sides; ++i ) {
-			const double angle = 2.0 * i * MY_PI/(double)sides;
-			vertices[i + 1].x = radius * cos(angle);
-			vertices[i + 1].y = radius * sin(angle);
-			vertices[i + 1].color = color;
-		}
-		vertices.back().x = radius;
-		vertices.back().y = 0;
-		vertices.back().color = color;
+//draws the scene loaded with --scene or streamed with --stream through the plain program; returns the draw calls issued
+size_t drawSceneFile(SceneFile &sceneFile, SceneStreamer &streamer, GLuint program, const GLMatrix4 &viewTransform) {
+	size_t drawCalls = 0;
+	if ( sceneFile.isOpen() ) {
+		glUseProgram(program);
+		sceneFile.draw(viewTransform);
+		drawCalls += sceneFile.lastDrawCalls();
 	}
-	
-	virtual void draw(const GLMatrix4 &parentTransform) {
-		const GLMatrix4 &t = parentTransform * transform;
-		glVertexAttribPointer(ATTRIB_POS, 2, GL_FLOAT, GL_FALSE, sizeof(Vtx), &vertices[0].x);
-		glVertexAttribPointer(ATTRIB_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vtx), &vertices[0].color);
-		glUniformMatrix4fv(UNIFORM_transfromationMatrix, 1, false, t.mat);
-		glDrawArrays(GL_TRIANGLE_FAN, 0, vertices.size());
-		
-		drawChildren(t);
+	if ( streamer.isOpen() ) {
+		glUseProgram(program);
+		streamer.draw(viewTransform);
+		drawCalls += streamer.lastDrawCalls();
 	}
-};
+	return drawCalls;
+}
 
+//the topmost entry whose bounds contain the world point, skipping the ignored node; -1 if none
+int pickEntry(const FlatScene &flatScene, const SceneBVH &bvh, const SceneNode *ignore, GLfloat x, GLfloat y) {
+	const GLfloat point[3] = { x, y, 0 };
+	static vector<size_t> hits;
+	bvh.queryPoint(point, hits);
+	int best = -1;
+	for ( size_t i = 0; i < hits.size(); ++i )
+		if ( flatScene.nodes[hits[i]] != ignore )
+			best = max(best, (int) hits[i]);
+	return best;
+}
 
-class CoordinateFrameNode : public SceneNode {
-	vector<Vtx> vertices;
-public:
-	CoordinateFrameNode(GLuint xColor, GLuint yColor) : vertices(9 * 2) {
-		const GLfloat lineWidth = 0.03f;
-		//Y-axis
-		//the arrowhead
-		vertices[0].x = 0;
-		vertices[0].y = 1.0f;
-		vertices[0].color = yColor;
-		vertices[1].x = -0.1f;
-		vertices[1].y = 0.9f;
-		vertices[1].color = yColor;
-		vertices[2].x = 0.1f;
-		vertices[2].y = 0.9f;
-		vertices[2].color = yColor;
-		
-		//the line itself (which is a Rect)
-		vertices[3].x = lineWidth;
-		vertices[3].y = 0.9f;
-		vertices[3].color = yColor;
-		vertices[4].x = -lineWidth;
-		vertices[4].y = 0.9f;
-		vertices[4].color = yColor;
-		vertices[5].x = -lineWidth;
-		vertices[5].y = 0;
-		vertices[5].color = yColor;
-		vertices[6].x = lineWidth;
-		vertices[6].y = 0.9f;
-		vertices[6].color = yColor;
-		vertices[7].x = -lineWidth;
-		vertices[7].y = 0;
-		vertices[7].color = yColor;
-		vertices[8].x = lineWidth;
-		vertices[8].y = 0;
-		vertices[8].color = yColor;
-		
-		//X-axis
-		//the arrowhead
-		vertices[9].y = 0;
-		vertices[9].x = 1.0f;
-		vertices[9].color = xColor;
-		vertices[10].y = 0.1f;
-		vertices[10].x = 0.9f;
-		vertices[10].color = xColor;
-		vertices[11].y = -0.1f;
-		vertices[11].x = 0.9f;
-		vertices[11].color = xColor;
-		
-		//the line itself (which is a Rect)
-		vertices[12].y = -lineWidth;
-		vertices[12].x = 0.9f;
-		vertices[12].color = xColor;
-		vertices[13].y = lineWidth;
-		vertices[13].x = 0.9f;
-		vertices[13].color = xColor;
-		vertices[14].y = lineWidth;
-		vertices[14].x = 0;
-		vertices[14].color = xColor;
-		vertices[15].y = -lineWidth;
-		vertices[15].x = 0.9f;
-		vertices[15].color = xColor;
-		vertices[16].y = lineWidth;
-		vertices[16].x = 0;
-		vertices[16].color = xColor;
-		vertices[17].y = -lineWidth;
-		vertices[17].x = 0;
-		vertices[17].color = xColor;
-	}
-	
-	virtual void draw(const GLMatrix4 &parentTransform) {
-		const GLMatrix4 &t = parentTransform * transform;
-		glVertexAttribPointer(ATTRIB_POS, 2, GL_FLOAT, GL_FALSE, sizeof(Vtx), &vertices[0].x);
-		glVertexAttribPointer(ATTRIB_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vtx), &vertices[0].color);
-		glUniformMatrix4fv(UNIFORM_transfromationMatrix, 1, false, t.mat);
-		glDrawArrays(GL_TRIANGLES, 0, vertices.size());
-		
-		drawChildren(t);
-	}
-		
-		
+//one frame's input for the update stage, and what the update hands back for drawing that frame
+struct DemoFrame {
+	double time;
+	GLfloat camX, camY, camRot, camS;
+	bool pick;                  //resolve a click against this frame's scene
+	bool pickThroughCamera;     //the click was in the viewport that looks through the camera
+	GLfloat pickX, pickY;       //the click in normalized device coordinates
+	GLMatrix4 baseTransform;    //set by the update: the view through the camera frame
+	double animationSampleMs, animationApplyMs;
 };
 
-class RectNode : public SceneNode {
-	Vtx vtx[4];
-	GLfloat lineWidth;
-public:
-	RectNode(GLfloat width, GLfloat height, GLuint color, GLfloat lineWidth) : lineWidth(lineWidth) {
-		vtx[0].x = -width/2;
-		vtx[0].y = height/2;
-		vtx[0].color = color;
+//what the update stage owns; runs on the pipeline's update thread unless the depth is 1
+struct DemoUpdate {
+	SceneNode &cameraNode;
+	KeyframeAnimation &animation;
+	AnimationWorker &animator;
+	JobSystem &jobs;
+	//picking index, refit as things move and rebuilt once that loosened it too much
+	SceneBVH bvh;
+	double bvhBuiltCost;
+	GLMatrix4 rotationMatrix;   //only rebuilt when the camera turned
+	GLfloat rotationAngle;
+
+	DemoUpdate(SceneNode &cameraNode, KeyframeAnimation &animation, AnimationWorker &animator, JobSystem &jobs)
+		: cameraNode(cameraNode), animation(animation), animator(animator), jobs(jobs), bvhBuiltCost(0), rotationAngle(0) {
+		rotationMatrix.setRotationY(0, 0, 0, rotationAngle);
+	}
 
-		vtx[1].x = -width/2;
-		vtx[1].y = -height/2;
-		vtx[1].color = color;
-		
-		vtx[2].x = width/2;
-		vtx[2].y = -height/2;
-		vtx[2].color = color;
-		
-		vtx[3].x = width/2;
-		vtx[3].y = height/2;
-		vtx[3].color = color;
+	static void run(void *context, DemoFrame &frame, FlatScene &flatScene) {
+		static_cast<DemoUpdate*>(context)->update(frame, flatScene);
 	}
-	
-	virtual void draw(const GLMatrix4 &parentTransform) {
-		const GLMatrix4 &t = parentTransform * transform;
-		glVertexAttribPointer(ATTRIB_POS, 2, GL_FLOAT, GL_FALSE, sizeof(Vtx), &vtx[0].x);
-		glVertexAttribPointer(ATTRIB_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vtx), &vtx[0].color);
-		glUniformMatrix4fv(UNIFORM_transfromationMatrix, 1, false, t.mat);
-		
-		glEnable(GL_LINE_SMOOTH);
-		glLineWidth(lineWidth);
-		glDrawArrays(GL_LINE_LOOP, 0, 4);
-		
-		drawChildren(t);
+
+	void update(DemoFrame &frame, FlatScene &flatScene) {
+		//The order for the camera is scale->rotate->translate
+		//so the order for the view is translate^-1 -> rotate^-1 -> scale^-1
+		cameraNode.transform.setIdentity();
+		cameraNode.transform.scale(frame.camS, frame.camS,0);
+		//only pay for the trig when the camera actually turned
+		if ( frame.camRot != rotationAngle ) {
+			rotationMatrix.setRotationY(0, 0, 0, frame.camRot);
+			rotationAngle = frame.camRot;
+		}
+		cameraNode.transform = rotationMatrix * cameraNode.transform;
+		cameraNode.transform.translate(frame.camX, frame.camY,0);
+
+		animator.wait();
+		frame.animationSampleMs = animation.lastSampleMs();
+		animation.apply();
+		frame.animationApplyMs = animation.lastApplyMs();
+		animator.request(frame.time + 0.02f);
+
+		GLMatrix4 ident;
+		ident.setIdentity();
+		flatScene.updateParallel(jobs, ident);
+		bool rebuild = !bvh.size();
+		if ( !rebuild && flatScene.stats.recomputed ) {
+			bvh.refit();
+			rebuild = bvh.cost() > 2 * bvhBuiltCost;
+		}
+		if ( rebuild ) {
+			bvh.build(flatScene);
+			bvhBuiltCost = bvh.cost();
+		}
+
+		if ( frame.pick ) {
+			//the viewport looking through the camera undoes baseTransform, i.e. applies the camera frame's transform
+			GLfloat wx = frame.pickX, wy = frame.pickY;
+			if ( frame.pickThroughCamera ) {
+				const GLfloat *m = cameraNode.transform.mat;
+				wx = m[0] * frame.pickX + m[4] * frame.pickY + m[12];
+				wy = m[1] * frame.pickX + m[5] * frame.pickY + m[13];
+			}
+			const int entry = pickEntry(flatScene, bvh, &cameraNode, wx, wy);
+			if ( entry >= 0 )
+				cout << "Picked " << flatScene.nodes[entry]->typeName() << " (entry " << entry << ") at " << wx << ", " << wy << "\n";
+			else
+				cout << "Nothing at " << wx << ", " << wy << "\n";
+		}
+
+		GLMatrix4 inverseRotation = rotationMatrix;
+		inverseRotation.transpose();
+		frame.baseTransform.setIdentity();
+		frame.baseTransform.translate(-frame.camX, -frame.camY,0);
+		frame.baseTransform = inverseRotation * frame.baseTransform;
+		frame.baseTransform.scale(1.0/frame.camS, 1.0/frame.camS,0);
 	}
 };
 
-
-/****************************************
- *
- * The real meat of the program.
- *
- * The nodeList array is there in order to keep track of nodes to delete when we clean up.
- * The cleaning up is not really necessary since we're gonna exit anyway.
- ****************************************/
-void createScene(SceneNode &root, vector<SceneNode*> &nodeList) {
-	static const GLuint xColor = 0xFF0000FF, yColor = 0xFFFF0000;
-	//a simple estimation
-	nodeList.resize(32, 0);
-	
-	root.children.push_back(nodeList[0] = new CoordinateFrameNode(0xFF00FFFF, 0xFFFFFF00));
-	
-	CoordinateFrameNode *coordinateFrame = new CoordinateFrameNode(xColor, yColor);
-	nodeList[1] = coordinateFrame;
-	
-	coordinateFrame->transform.scale(0.5,0.5,0);
-	
-	root.children.push_back(nodeList[2] = new RegularPolygonNode(.3, 4, 0xFF00AAAA));
-	nodeList[2]->transform.setRotationY(0.5, 0.5, 0,MY_PI/6);
-	nodeList[2]->transform.translate(0, 0.5,0);
-	nodeList[2]->children.push_back(coordinateFrame);
-	
-	nodeList[2]->children.push_back(nodeList[3] = new RegularPolygonNode(.05, 16, 0xFFFFFFFF));
-	nodeList[3]->transform.translate(.2,.2,0);
-	nodeList[3]->children.push_back(coordinateFrame);
-	
-	nodeList[2]->children.push_back(nodeList[4] = new RegularPolygonNode(.05, 16, 0xFFAAFAFA));
-	nodeList[4]->transform.translate(-.2,.2,0);
-	nodeList[4]->children.push_back(coordinateFrame);
-	
-	root.children.push_back(nodeList[5] = new RegularPolygonNode(.2, 5, 0xFFAAFF00));
-	nodeList[5]->transform.translate(-.4, .1,0);
-	nodeList[5]->children.push_back(coordinateFrame);
-	
-}
 /********************
  *
  * The usual main loop.
  *
+ * Built with CS177_HEADLESS, "3d_camera --headless [frames]" renders into an
+ * OSMesa buffer instead of a window: no vsync and no input, the camera orbits
+ * on its own, and after the given number of frames (300 by default) the frame
+ * timings are printed as one JSON line.
+ *
+ * "--depth N" sets the frame pipeline depth (see FramePipeline.hpp), 2 by
+ * default: the scene update for the next frame runs on its own thread while
+ * this one is submitted and swapped. 1 is the plain sequential loop. The
+ * window title and the headless JSON report the resulting input latency.
+ *
+ * "--export-scene FILE" writes the demo scene as a binary scene file, and
+ * "--scene FILE" maps one and draws it on top of the demo scene in both
+ * viewports (see SceneFile.hpp). "--stream FILE" draws one the same way but
+ * only keeps the pages near the camera in memory, "--budget MB" at most (64
+ * by default; see SceneStreamer.hpp).
+ *
+ * Saving one of the shader files while the demo runs rebuilds its program
+ * and swaps it in between frames (see ShaderReloader.hpp); if it doesn't
+ * compile, the log is printed and the old program stays.
+ *
+ * The subtrees createScene marks static are baked into shared meshes and
+ * drawn as batches in their place between the other nodes (see
+ * StaticBatches.hpp); hold S to draw them node by node instead.
+ *
+ * Built with CS177_PROFILE, the frame is split into profiler zones and the
+ * trace is written to frame_trace.json on exit (see Profiler.hpp). The
+ * profiler only records the GL thread, so the pipeline depth is forced to 1.
+ *
+ * Built with CS177_COUNT_ALLOCATIONS, the heap allocations made during each
+ * frame are counted (see AllocationCounter.hpp); once everything is warmed up
+ * the loop should not allocate at all.
+ *
  ********************/
 
-bool loadShaderSource(GLuint shader, const char *filePath) {
-	FILE *f = fopen(filePath, "r");
-	if ( !f ) {
-		cerr << "Cannot find file: " << filePath << '\n';
-		return false;
-	}
-	fseek(f, 0, SEEK_END);
-	const size_t sz = ftell(f) + 1;
-	fseek(f, 0, SEEK_SET);
-	
-	GLchar *buffer = new GLchar[sz];
-	fread(buffer, 1, sz, f);
-	fclose(f);
-	buffer[sz-1] = 0;
-	glShaderSource(shader, 1, (const GLchar**) &buffer, NULL);
-	
-	glCompileShader(shader);
-	delete [] buffer;
-	
-	GLint logLength;
-	glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logLength);
-	if ( logLength > 0 ) {
-		GLchar *log = new GLchar[logLength];
-		glGetShaderInfoLog(shader, logLength, &logLength, log);
-		cout << "Shader Compile Log:\n" << log << endl;
-		delete [] log;
-	}
-	
-	return true;
-}
+static bool headless = false;
 
+//keyboard state; nothing is ever pressed in headless mode
+static bool keyDown(int key) {
+	return !headless && glfwGetKey(key) == GLFW_PRESS;
+}
 
-int main() {
-	if ( !glfwInit() ) {
-		cerr << "Unable to initialize OpenGL!\n";
-		return -1;
+int main(int argc, char **argv) {
+	int headlessFrames = 300;
+	unsigned pipelineDepth = 2;
+	const char *scenePath = 0, *exportPath = 0, *streamPath = 0;
+	size_t streamBudget = 64;
+	for ( int i = 1; i + 1 < argc; ++i ) {
+		if ( strcmp(argv[i], "--depth") == 0 )
+			pipelineDepth = (unsigned) max(1, atoi(argv[i + 1]));
+		else if ( strcmp(argv[i], "--scene") == 0 )
+			scenePath = argv[i + 1];
+		else if ( strcmp(argv[i], "--export-scene") == 0 )
+			exportPath = argv[i + 1];
+		else if ( strcmp(argv[i], "--stream") == 0 )
+			streamPath = argv[i + 1];
+		else if ( strcmp(argv[i], "--budget") == 0 )
+			streamBudget = (size_t) max(1, atoi(argv[i + 1]));
 	}
-	if ( !glfwOpenWindow(640,640,
-				8,8,8,8,
-				0,0,
-				GLFW_WINDOW) ) {
-		cerr << "Unable to create OpenGL window.\n";
-		glfwTerminate();
-		return -1;
+#ifdef CS177_PROFILE
+	pipelineDepth = 1;
+#endif
+#ifdef CS177_HEADLESS
+	HeadlessContext context;
+	if ( argc > 1 && strcmp(argv[1], "--headless") == 0 ) {
+		headless = true;
+		if ( argc > 2 && argv[2][0] != '-' )
+			headlessFrames = max(1, atoi(argv[2]));
+		if ( !context.create(640, 640) )
+			return -1;
 	}
-	
-	if ( glewInit() != GLEW_OK ) {
-		cerr << "Unable to hook OpenGL extensions!\n";
+#endif
+	if ( !headless && !glfwInit() ) {
+		cerr << "Unable to initialize OpenGL!\n";
 		return -1;
 	}
-	glfwSetWindowTitle("2D Transformations");
-	
-	glfwEnable(GLFW_STICKY_KEYS);
-	glfwSwapInterval(1);
-
-	GLuint vtxShader = glCreateShader(GL_VERTEX_SHADER),
-	       fragShader = glCreateShader(GL_FRAGMENT_SHADER);
-	if ( !loadShaderSource(vtxShader, "2d.vsh") ) return -1;
-	if ( !loadShaderSource(fragShader, "2d.fsh") ) return -1;
-
-	GLuint program = glCreateProgram();
-	glAttachShader(program, vtxShader);
-	glAttachShader(program, fragShader);
-
-	glBindAttribLocation(program, ATTRIB_POS, "pos");
-	glBindAttribLocation(program, ATTRIB_COLOR, "color");
-
-	glLinkProgram(program);
-	
-
-	{
-		GLint logLength;
-		glGetProgramiv(program, GL_INFO_LOG_LENGTH, &logLength);
-		if ( logLength > 0 ) {
-			GLchar *log = new GLchar[logLength];
-			glGetProgramInfoLog(program, logLength, &logLength, log);
-			cout << "Program Compile Log:\n" << log << endl;
-			delete [] log;
+	if ( !headless ) {
+		if ( !glfwOpenWindow(640,640,
+					8,8,8,8,
+					0,0,
+					GLFW_WINDOW) ) {
+			cerr << "Unable to create OpenGL window.\n";
+			glfwTerminate();
+			return -1;
 		}
+		
+		if ( glewInit() != GLEW_OK ) {
+			cerr << "Unable to hook OpenGL extensions!\n";
+			return -1;
+		}
+		glfwSetWindowTitle("2D Transformations");
+		
+		glfwEnable(GLFW_STICKY_KEYS);
+		glfwSwapInterval(1);
 	}
-	glDeleteShader(fragShader);
-	glDeleteShader(vtxShader);
-	fragShader = 0;
-	vtxShader = 0;
-
-	UNIFORM_transfromationMatrix = glGetUniformLocation(program, "modelTransform");
-	glUseProgram(program);
 
+	//the driver compiles (or the binary cache loads) every program while the scene is built below
+	const chrono::high_resolution_clock::time_point shadersStart = chrono::high_resolution_clock::now();
+	ShaderManager &shaders = globalShaderManager();
+	shaders.request("2d.vsh", "2d.fsh");
+	if ( InstancedRenderer::supported() )
+		shaders.request("2d_instanced.vsh", "2d.fsh");
+	if ( UniformBlockRenderer::supported() )
+		shaders.request("2d_ubo.vsh", "2d.fsh");
+	shaders.start();
 	
 	SceneNode root;
 	RectNode cameraNode(2, 2, 0xFF00FF00, 4);
@@ -456,94 +368,342 @@ int main() {
 	RegularPolygonNode bg(sqrt(2.0f), 4, 0xFF000000);
 	bg.transform.setRotationY(0,0,0,MY_PI/4);
 	
-	vector<SceneNode*> nodeList;
+	NodeArena arena;
 	root.transform.setIdentity();
-	createScene(root, nodeList);
+	createScene(root, arena);
+	KeyframeAnimation animation(3, 65, 16);
+	createAnimation(animation, root);
 	root.children.push_back(&cameraNode);
+	
+	FlatScene flatScene;
+	flatScene.build(root);
+	if ( exportPath && !exportScene(root, exportPath) )
+		cerr << "Unable to write the scene to " << exportPath << '\n';
+	
+	GLuint program = linkProgram("2d.vsh", "2d.fsh");
+	if ( !program ) return -1;
+
+	UNIFORM_transfromationMatrix = glGetUniformLocation(program, "modelTransform");
+	glUseProgram(program);
+	
+	//repeated meshes go out as one instanced draw each when the driver allows it
+	InstancedRenderer instanced;
+	if ( instanced.init("2d_instanced.vsh", "2d.fsh") )
+		instanced.build(flatScene);
+	else
+		cout << "Instanced drawing unavailable, using the sorted draw queue.\n";
+	DrawQueue queue;
+	//the same scene grouped into typed batches, drawn without virtual calls
+	RenderBatches batches;
+	batches.build(flatScene);
+	//camera and model matrices in uniform buffers, the fallback when instancing is missing
+	UniformBlockRenderer blocks;
+	if ( blocks.init("2d_ubo.vsh", "2d.fsh") )
+		blocks.build(flatScene);
+	//the static subtrees pre-transformed into one mesh per material
+	StaticBatches statics;
+	statics.build(flatScene);
+	statics.upload();
+	//a scene file is mapped and drawn where it lies; it doesn't move, so its world matrices are computed once
+	SceneFile sceneFile;
+	if ( scenePath && sceneFile.open(scenePath) ) {
+		GLMatrix4 identity;
+		identity.setIdentity();
+		sceneFile.updateWorld(identity);
+		sceneFile.upload();
+	}
+	//or paged in around the camera as it moves
+	SceneStreamer streamer;
+	if ( streamPath )
+		streamer.open(streamPath, streamBudget << 20);
+	//edited shader files are rebuilt in the background and swapped in between frames
+	ShaderReloader reloader;
+	reloader.watchUniform(reloader.watch(program, "2d.vsh", "2d.fsh"), UNIFORM_transfromationMatrix, "modelTransform");
+	if ( instanced.ready() )
+		instanced.watchShaders(reloader, "2d_instanced.vsh", "2d.fsh");
+	if ( blocks.ready() )
+		blocks.watchShaders(reloader, "2d_ubo.vsh", "2d.fsh");
+	if ( !headless && !reloader.start() )
+		cout << "Unable to watch the shader files, no hot reload.\n";
+	if ( !headless )
+		cout << "Shaders ready after " << elapsedMs(shadersStart) << " ms (" << shaders.busyMs() << " ms blocked, "
+		     << shaders.cacheHits() << " from the cache, " << shaders.cacheMisses() << " compiled)\n";
+	bool mouseWasDown = false;
+	GpuTimer gpu;
+	gpu.init();
+	FrameSamples samples;
+	if ( headless )
+		samples.reserve(headlessFrames);
+	samples.pipelineDepth = pipelineDepth;
+	//per-frame temporaries such as the visibility masks
+	FrameScratch scratch;
+#ifdef CS177_COUNT_ALLOCATIONS
+	size_t frameAllocs = 0;
+#endif
 
 	glEnableVertexAttribArray(ATTRIB_POS);
 	glEnableVertexAttribArray(ATTRIB_COLOR);
 	double t = 0;
+	unsigned frame = 0;
 	
 	GLfloat camX = 0, camY = 0, camZ = 0, camRot = 0, camS = 1;
+	//scene update and command recording are spread over these; when they run at the same time
+	//each needs a system of its own, since only one thread may drive a system
+	const unsigned hardware = max(1u, thread::hardware_concurrency());
+	JobSystem jobs(pipelineDepth > 1 ? max(1u, hardware / 2) : hardware);
+	JobSystem updateJobs(pipelineDepth > 1 ? max(1u, hardware - hardware / 2) : 1);
+	//samples the next frame's pose while the current one is drawn
+	AnimationWorker animator(animation);
+	animator.request(t);
+	DemoUpdate updater(cameraNode, animation, animator, pipelineDepth > 1 ? updateJobs : jobs);
+	//the update of the next frames runs while the current one is submitted and swapped
+	FramePipeline<DemoFrame> pipeline(flatScene, pipelineDepth, DemoUpdate::run, &updater);
+	FramePipelineStats pipelineStats = pipeline.stats();
 	do {
+		PROFILE_FRAME_END();
+		PROFILE_ZONE("frame");
+		const chrono::high_resolution_clock::time_point frameStart = chrono::high_resolution_clock::now();
+#ifdef CS177_COUNT_ALLOCATIONS
+		const size_t allocsAtStart = heapAllocations();
+#endif
+		scratch.reset();
 		//update the camera
-		
-		bool alt = (glfwGetKey(GLFW_KEY_LSHIFT) == GLFW_PRESS)|| (glfwGetKey(GLFW_KEY_RSHIFT) == GLFW_PRESS);
-		//The order for the camera is scale->rotate->translate
-		//so the order for the view is translate^-1 -> rotate^-1 -> scale^-1
-		if ( glfwGetKey(GLFW_KEY_UP) == GLFW_PRESS ) {
-			if ( alt )
-				camS += 0.005;
-			else
-				camY += 0.01;
-		} else if ( glfwGetKey(GLFW_KEY_DOWN) == GLFW_PRESS ) {
-			if ( alt ) {
-				if ( camS > 0.0051 )
-					camS -= 0.005;
-			} else
-				camY -= 0.01;
-		} else if ( glfwGetKey(GLFW_KEY_LEFT) == GLFW_PRESS ) {
-			if ( alt )
+		{
+			PROFILE_ZONE("camera input");
+			bool alt = keyDown(GLFW_KEY_LSHIFT) || keyDown(GLFW_KEY_RSHIFT);
+			if ( keyDown(GLFW_KEY_UP) ) {
+				if ( alt )
+					camS += 0.005;
+				else
+					camY += 0.01;
+			} else if ( keyDown(GLFW_KEY_DOWN) ) {
+				if ( alt ) {
+					if ( camS > 0.0051 )
+						camS -= 0.005;
+				} else
+					camY -= 0.01;
+			} else if ( keyDown(GLFW_KEY_LEFT) ) {
+				if ( alt )
+					camRot += 0.01;
+				else
+					camX -= 0.01;
+			} else if ( keyDown(GLFW_KEY_RIGHT) ) {
+				if ( alt )
+					camRot -= 0.01;
+				else
+					camX += 0.01;
+			}
+			
+			if ( headless )
 				camRot += 0.01;
-			else
-				camX -= 0.01;
-		} else if ( glfwGetKey(GLFW_KEY_RIGHT) == GLFW_PRESS ) {
-			if ( alt )
-				camRot -= 0.01;
-			else
-				camX += 0.01;
+		}
+		if ( streamer.isOpen() ) {
+			PROFILE_ZONE("streaming");
+			//the camera frame spans camS around its center; load what is within twice that
+			streamer.update(camX, camY, 2 * camS);
 		}
 		
-		cameraNode.transform.setIdentity();
-		cameraNode.transform.scale(camS, camS,0);
-		GLMatrix4 rotationMatrix;
-		rotationMatrix.setRotationY(0, 0, 0, camRot);
-		cameraNode.transform = rotationMatrix * cameraNode.transform;
-		cameraNode.transform.translate(camX, camY,0);
+		//hold N to compare against the non-instanced queue, B for the typed batches, U for the uniform blocks
+		RenderPath path = instanced.ready() ? RENDER_INSTANCED : blocks.ready() ? RENDER_UNIFORM_BLOCKS : RENDER_QUEUE;
+		if ( keyDown('B') )
+			path = RENDER_BATCHES;
+		else if ( keyDown('N') )
+			path = RENDER_QUEUE;
+		else if ( keyDown('U') && blocks.ready() )
+			path = RENDER_UNIFORM_BLOCKS;
+
+		int windowWidth = 640, windowHeight = 640;
+		if ( !headless )
+			glfwGetWindowSize(&windowWidth, &windowHeight);
+
+		DemoFrame input;
+		input.time = t;
+		input.camX = camX;
+		input.camY = camY;
+		input.camRot = camRot;
+		input.camS = camS;
+		//click to print the topmost node under the cursor; the update resolves it against its frame
+		const bool mouseDown = !headless && glfwGetMouseButton(GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+		input.pick = mouseDown && !mouseWasDown;
+		if ( input.pick ) {
+			int mouseX, mouseY;
+			glfwGetMousePos(&mouseX, &mouseY);
+			const GLfloat px = (GLfloat) mouseX, py = (GLfloat) (windowHeight - mouseY);
+			const bool inset = px < windowWidth / 4 && py < windowHeight / 4;
+			const GLfloat zoom = inset ? 4.0f : 1.0f;
+			input.pickX = px * zoom / windowWidth * 2 - 1;
+			input.pickY = py * zoom / windowHeight * 2 - 1;
+			input.pickThroughCamera = inset == keyDown(GLFW_KEY_SPACE);
+		}
+		mouseWasDown = mouseDown;
+		t += 0.02f;
+
+		{
+			PROFILE_ZONE("shader reload");
+			reloader.update();
+		}
+		FramePipeline<DemoFrame>::Snapshot *snapshot;
+		{
+			PROFILE_ZONE("update world");
+			snapshot = pipeline.advance(input);
+		}
+		//nothing to draw yet while the pipeline fills
+		if ( !snapshot )
+			continue;
+		const FlatScene &scene = *snapshot->scene;
+		const GLMatrix4 &baseTransform = snapshot->frame.baseTransform;
+		GLMatrix4 ident;
+		ident.setIdentity();
+		queue.beginFrame();
+		if ( path == RENDER_UNIFORM_BLOCKS )
+			blocks.upload(scene);
+		StaticBatches *staticBatches = keyDown('S') ? 0 : &statics;
+		{
+			PROFILE_ZONE("static batches");
+			statics.refresh(scene);
+		}
 		
+		gpu.begin();
 		glClear(GL_COLOR_BUFFER_BIT);
 
-		int windowWidth, windowHeight;
-		glfwGetWindowSize(&windowWidth, &windowHeight);
-		
-	
-		GLMatrix4 baseTransform;
-		baseTransform.setIdentity();
-		baseTransform.translate(-camX, -camY,0);
-		rotationMatrix.transpose();
-		baseTransform = rotationMatrix * baseTransform;
-		baseTransform.scale(1.0/camS, 1.0/camS,0);
-		
-		
-		if ( glfwGetKey(GLFW_KEY_SPACE) == GLFW_PRESS ) {
-			glViewport(0,0,windowWidth, windowHeight);
-			GLMatrix4 ident;
-			ident.setIdentity();
-			root.draw(ident);
+		CullStats fullCull, insetCull;
+		//the background quad is one draw
+		size_t drawCalls = 1;
+		if ( keyDown(GLFW_KEY_SPACE) ) {
+			{
+				PROFILE_GPU_ZONE("viewport full");
+				glViewport(0,0,windowWidth, windowHeight);
+				drawCalls += drawScene(scene, path, jobs, instanced, queue, batches, blocks, staticBatches, program, ident, scratch, fullCull);
+				drawCalls += drawSceneFile(sceneFile, streamer, program, ident);
+			}
 			
-			glViewport(0,0,windowWidth/4, windowHeight/4);
-			bg.draw(ident);
-			root.draw(baseTransform);
+			{
+				PROFILE_GPU_ZONE("viewport inset");
+				glViewport(0,0,windowWidth/4, windowHeight/4);
+				glUseProgram(program);
+				bg.draw(ident);
+				drawCalls += drawScene(scene, path, jobs, instanced, queue, batches, blocks, staticBatches, program, baseTransform, scratch, insetCull);
+				drawCalls += drawSceneFile(sceneFile, streamer, program, baseTransform);
+			}
 		} else {
-			glViewport(0,0,windowWidth, windowHeight);
-			root.draw(baseTransform);
+			{
+				PROFILE_GPU_ZONE("viewport full");
+				glViewport(0,0,windowWidth, windowHeight);
+				drawCalls += drawScene(scene, path, jobs, instanced, queue, batches, blocks, staticBatches, program, baseTransform, scratch, fullCull);
+				drawCalls += drawSceneFile(sceneFile, streamer, program, baseTransform);
+			}
 			
-			glViewport(0,0,windowWidth/4, windowHeight/4);
-			GLMatrix4 ident;
-			ident.setIdentity();
-			bg.draw(ident);
-			root.draw(ident);
+			{
+				PROFILE_GPU_ZONE("viewport inset");
+				glViewport(0,0,windowWidth/4, windowHeight/4);
+				glUseProgram(program);
+				bg.draw(ident);
+				drawCalls += drawScene(scene, path, jobs, instanced, queue, batches, blocks, staticBatches, program, ident, scratch, insetCull);
+				drawCalls += drawSceneFile(sceneFile, streamer, program, ident);
+			}
 		}
 		
-		glfwSwapBuffers();
-		t += 0.02f;
-	} while ( glfwGetKey(GLFW_KEY_ESC) != GLFW_PRESS && glfwGetWindowParam(GLFW_OPENED) );
-	
-	for ( size_t i = 0; i < nodeList.size(); ++i )
-		delete nodeList[i];
+		gpu.end();
+		const double cpuMs = elapsedMs(frameStart);
+#ifdef CS177_COUNT_ALLOCATIONS
+		frameAllocs = heapAllocations() - allocsAtStart;
+#endif
+		double gpuMs;
+		const bool gpuReady = gpu.poll(gpuMs);
+		
+		if ( headless ) {
+			{
+				PROFILE_ZONE("finish");
+				glFinish();
+			}
+			samples.cpuMs.push_back(cpuMs);
+			samples.wallMs.push_back(elapsedMs(frameStart));
+			samples.drawCalls.push_back((double) drawCalls);
+			if ( gpuReady )
+				samples.gpuMs.push_back(gpuMs);
+			samples.latencyMs.push_back(pipeline.release(snapshot));
+#ifdef CS177_COUNT_ALLOCATIONS
+			samples.heapAllocs.push_back((double) frameAllocs);
+#endif
+			++frame;
+			continue;
+		}
+		
+		if ( ++frame % 60 == 0 ) {
+			char title[1024];
+			int length;
+			if ( path == RENDER_INSTANCED )
+				length = sprintf(title, "2D Transformations - %lu/%lu matrices recomputed, %lu instanced draws/viewport",
+				                 (unsigned long) scene.stats.recomputed, (unsigned long) scene.size(),
+				                 (unsigned long) instanced.lastDrawCalls());
+			else if ( path == RENDER_UNIFORM_BLOCKS )
+				length = sprintf(title, "2D Transformations - %lu/%lu matrices recomputed, %lu draws, %lu bytes of uniforms",
+				                 (unsigned long) scene.stats.recomputed, (unsigned long) scene.size(),
+				                 (unsigned long) blocks.lastDrawCalls(), (unsigned long) blocks.lastUniformBytes());
+			else if ( path == RENDER_BATCHES )
+				length = sprintf(title, "2D Transformations - %lu/%lu matrices recomputed, %lu typed batches, %lu draws/viewport",
+				                 (unsigned long) scene.stats.recomputed, (unsigned long) scene.size(),
+				                 (unsigned long) batches.batchCount(), (unsigned long) batches.lastDrawCalls());
+			else
+				length = sprintf(title, "2D Transformations - %lu/%lu matrices recomputed, %lu draws, %lu state changes skipped, %lu/%lu uniform uploads",
+				                 (unsigned long) scene.stats.recomputed, (unsigned long) scene.size(),
+				                 (unsigned long) queue.stats.drawCalls, (unsigned long) queue.stats.stateChangesSkipped,
+				                 (unsigned long) queue.stats.uniformUploads,
+				                 (unsigned long) (queue.stats.uniformUploads + queue.stats.uniformUploadsSkipped));
+			length += sprintf(title + length, ", drawn/culled %lu/%lu main, %lu/%lu inset, animation %.3f ms sampling + %.3f ms apply",
+			                  (unsigned long) fullCull.drawn, (unsigned long) fullCull.culled,
+			                  (unsigned long) insetCull.drawn, (unsigned long) insetCull.culled,
+			                  snapshot->frame.animationSampleMs, snapshot->frame.animationApplyMs);
+			length += sprintf(title + length, ", pipeline depth %u: %.1f frames/%.1f ms input latency, %.1f fps",
+			                  pipeline.depth(), pipelineStats.latencyFrames, pipelineStats.latencyMs, pipelineStats.framesPerSecond);
+			if ( staticBatches )
+				length += sprintf(title + length, ", %lu static meshes in %lu batches, %lu batch draws/viewport",
+				                  (unsigned long) statics.entryCount(), (unsigned long) statics.batchCount(), (unsigned long) statics.lastDrawCalls());
+			if ( streamer.isOpen() )
+				length += sprintf(title + length, ", streamed %lu/%lu nodes in %.1f MB, %lu pages loading",
+				                  (unsigned long) streamer.stats().residentNodes, (unsigned long) streamer.size(),
+				                  streamer.stats().residentBytes / (1024.0 * 1024.0), (unsigned long) streamer.stats().pendingPages);
+#ifdef CS177_COUNT_ALLOCATIONS
+			sprintf(title + length, ", %lu heap allocations last frame", (unsigned long) frameAllocs);
+#endif
+			glfwSetWindowTitle(title);
+		}
+		
+		{
+			PROFILE_ZONE("swap");
+			glfwSwapBuffers();
+		}
+		pipeline.release(snapshot);
+		if ( frame % 60 == 0 ) {
+			pipelineStats = pipeline.stats();
+			pipeline.resetStats();
+		}
+	} while ( headless ? frame < (unsigned) headlessFrames : !keyDown(GLFW_KEY_ESC) && glfwGetWindowParam(GLFW_OPENED) );
+	
+	if ( headless )
+		samples.writeJson(stdout, "demo", instanced.ready() ? "instanced" : "queue", flatScene.size());
+	PROFILE_FRAME_END();
+	PROFILE_WRITE_TRACE("frame_trace.json");
+	if ( streamer.isOpen() && !headless ) {
+		const StreamingStats &streamed = streamer.stats();
+		printf("Streaming: %lu pages in (%.1f MB), %lu out (%.1f MB), page load latency:\n", (unsigned long) streamed.pagesLoaded,
+		       streamed.bytesPagedIn / (1024.0 * 1024.0), (unsigned long) streamed.pagesEvicted, streamed.bytesPagedOut / (1024.0 * 1024.0));
+		streamed.latency.print(stdout);
+	}
 	
-	glfwTerminate();
+	//the update thread still holds the nodes
+	pipeline.finish();
+	arena.clear();
+	
+	gpu.destroy();
+	instanced.destroy();
+	blocks.destroy();
+	sceneFile.destroy();
+	statics.destroy();
+	streamer.destroy();
+	globalMeshCache().clear();
+	if ( !headless )
+		glfwTerminate();
 
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,56 @@
+#ifndef CS177_ALLOCATION_COUNTER_HPP
+#define CS177_ALLOCATION_COUNTER_HPP
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+/********************
+ *
+ * Heap allocation counting.
+ *
+ * With CS177_COUNT_ALLOCATIONS defined, this header replaces the global
+ * operator new/delete with versions that count every allocation, so
+ * heapAllocations() can show whether the frame loop still touches the heap.
+ * Replacements may only be defined once per program: include it with the
+ * macro set from the .cpp file that has main() and nowhere else. Without
+ * the macro heapAllocations() always returns 0.
+ *
+ * Only C++ allocations are seen; malloc() calls inside GL drivers or C
+ * libraries are not.
+ *
+ ********************/
+inline std::atomic<size_t> &heapAllocationCounter() {
+	static std::atomic<size_t> counter(0);
+	return counter;
+}
+
+inline size_t heapAllocations() {
+	return heapAllocationCounter().load(std::memory_order_relaxed);
+}
+
+#ifdef CS177_COUNT_ALLOCATIONS
+
+void *operator new(size_t size) {
+	heapAllocationCounter().fetch_add(1, std::memory_order_relaxed);
+	void *p = malloc(size ? size : 1);
+	if ( !p )
+		throw std::bad_alloc();
+	return p;
+}
+
+void *operator new[](size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+	free(p);
+}
+
+void operator delete[](void *p) noexcept {
+	free(p);
+}
+
+#endif
+
+#endif
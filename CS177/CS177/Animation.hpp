@@ -0,0 +1,289 @@
+#ifndef CS177_ANIMATION_HPP
+#define CS177_ANIMATION_HPP
+
+#include "Utility.hpp"
+#include "Quaternion.hpp"
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/********************
+ *
+ * Keyframe animation.
+ *
+ * A KeyframeAnimation drives one node per track with translation, rotation
+ * (a quaternion) and scale keys. All tracks share one fixed key rate, so at
+ * any time every track blends the same two keys with the same factor, and
+ * sampling is a plain lerp over arrays. Each channel (tx, ty, ..., sz) is
+ * stored as its own plane laid out [key][track], with the track count padded
+ * to a multiple of 4, so one SSE step samples one channel of four tracks.
+ * Rotations are blended with a normalized lerp along the shorter arc.
+ *
+ * sample(time) only writes the pose arrays and touches no node, so it can run
+ * on a worker (see AnimationWorker); apply() then writes the pose into the
+ * node transforms as translate * rotate * scale and bumps their revisions, so
+ * FlatScene picks up exactly the animated subtrees.
+ *
+ * The clip loops: keys 0 and keyCount - 1 should be equal for a seamless
+ * loop, and the clip lasts (keyCount - 1) / keysPerSecond seconds.
+ *
+ ********************/
+struct TrackKey {
+	GLfloat translation[3];
+	Quaternion rotation;
+	GLfloat scale[3];
+};
+
+class KeyframeAnimation {
+	enum { TX, TY, TZ, RW, RX, RY, RZ, SX, SY, SZ, CHANNELS };
+
+	size_t trackCount, stride, keyCount;
+	float keysPerSecond;
+	vector<SceneNode*> targets;
+	vector<float> keys;      //CHANNELS planes of keyCount * stride
+	vector<float> pose;      //CHANNELS rows of stride, the last sample
+	double sampleMs, applyMs;
+
+	float *plane(int channel, size_t key) {
+		return &keys[(channel * keyCount + key) * stride];
+	}
+
+	//the two keys around time and the blend factor between them
+	void locate(double time, size_t &key, float &f) const {
+		const double length = (keyCount - 1) / (double) keysPerSecond;
+		double phase = fmod(time, length);
+		if ( phase < 0 )
+			phase += length;
+		phase *= keysPerSecond;
+		key = min((size_t) phase, keyCount - 2);
+		f = (float) (phase - key);
+	}
+
+	//interpolates tracks [begin, end) one at a time
+	void sampleTracksScalar(size_t k, float f, size_t begin, size_t end) {
+		for ( int c = 0; c < CHANNELS; ++c ) {
+			if ( c >= RW && c <= RZ )
+				continue;
+			const float *a = plane(c, k), *b = plane(c, k + 1);
+			float *out = &pose[c * stride];
+			for ( size_t i = begin; i < end; ++i )
+				out[i] = a[i] + (b[i] - a[i]) * f;
+		}
+		const float *a[4] = { plane(RW, k), plane(RX, k), plane(RY, k), plane(RZ, k) };
+		const float *b[4] = { plane(RW, k + 1), plane(RX, k + 1), plane(RY, k + 1), plane(RZ, k + 1) };
+		for ( size_t i = begin; i < end; ++i ) {
+			const float dot = a[0][i] * b[0][i] + a[1][i] * b[1][i] + a[2][i] * b[2][i] + a[3][i] * b[3][i];
+			const float sign = dot < 0 ? -1.0f : 1.0f;
+			float q[4], length = 0;
+			for ( int j = 0; j < 4; ++j ) {
+				q[j] = a[j][i] + (sign * b[j][i] - a[j][i]) * f;
+				length += q[j] * q[j];
+			}
+			length = std::sqrt(length);
+			for ( int j = 0; j < 4; ++j )
+				pose[(RW + j) * stride + i] = q[j] / length;
+		}
+	}
+
+	KeyframeAnimation(const KeyframeAnimation &);
+	KeyframeAnimation &operator=(const KeyframeAnimation &);
+
+public:
+	//keyCount >= 2; every key starts out as the identity
+	KeyframeAnimation(size_t tracks, size_t keyCount, float keysPerSecond)
+		: trackCount(tracks), stride((tracks + 3) & ~(size_t) 3), keyCount(max<size_t>(2, keyCount)),
+		  keysPerSecond(keysPerSecond), targets(tracks, (SceneNode*) 0), sampleMs(0), applyMs(0) {
+		keys.assign(CHANNELS * this->keyCount * stride, 0.0f);
+		pose.assign(CHANNELS * stride, 0.0f);
+		const int ones[4] = { RW, SX, SY, SZ };
+		for ( size_t k = 0; k < this->keyCount; ++k )
+			for ( int c = 0; c < 4; ++c )
+				fill(plane(ones[c], k), plane(ones[c], k) + stride, 1.0f);
+	}
+
+	size_t tracks() const {
+		return trackCount;
+	}
+
+	void setTarget(size_t track, SceneNode *node) {
+		targets[track] = node;
+	}
+
+	void setKey(size_t track, size_t key, const TrackKey &value) {
+		plane(TX, key)[track] = value.translation[0];
+		plane(TY, key)[track] = value.translation[1];
+		plane(TZ, key)[track] = value.translation[2];
+		const Quaternion r = value.rotation.normalized();
+		plane(RW, key)[track] = r.w;
+		plane(RX, key)[track] = r.x;
+		plane(RY, key)[track] = r.y;
+		plane(RZ, key)[track] = r.z;
+		plane(SX, key)[track] = value.scale[0];
+		plane(SY, key)[track] = value.scale[1];
+		plane(SZ, key)[track] = value.scale[2];
+	}
+
+	//evaluates every track at time (seconds) into the pose; touches no node
+	void sample(double time) {
+		const chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		size_t k;
+		float f;
+		locate(time, k, f);
+#ifdef CS177_USE_SSE
+		const __m128 blend = _mm_set1_ps(f);
+		for ( int c = 0; c < CHANNELS; ++c ) {
+			if ( c >= RW && c <= RZ )
+				continue;
+			const float *a = plane(c, k), *b = plane(c, k + 1);
+			float *out = &pose[c * stride];
+			for ( size_t i = 0; i < stride; i += 4 ) {
+				const __m128 va = _mm_loadu_ps(a + i), vb = _mm_loadu_ps(b + i);
+				_mm_storeu_ps(out + i, _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), blend)));
+			}
+		}
+		const __m128 signBit = _mm_set1_ps(-0.0f);
+		for ( size_t i = 0; i < stride; i += 4 ) {
+			__m128 qa[4], qb[4];
+			for ( int j = 0; j < 4; ++j ) {
+				qa[j] = _mm_loadu_ps(plane(RW + j, k) + i);
+				qb[j] = _mm_loadu_ps(plane(RW + j, k + 1) + i);
+			}
+			__m128 dot = _mm_mul_ps(qa[0], qb[0]);
+			for ( int j = 1; j < 4; ++j )
+				dot = _mm_add_ps(dot, _mm_mul_ps(qa[j], qb[j]));
+			//the shorter arc: flip b where the dot product is negative
+			const __m128 flip = _mm_and_ps(dot, signBit);
+			__m128 q[4], length = _mm_setzero_ps();
+			for ( int j = 0; j < 4; ++j ) {
+				q[j] = _mm_add_ps(qa[j], _mm_mul_ps(_mm_sub_ps(_mm_xor_ps(qb[j], flip), qa[j]), blend));
+				length = _mm_add_ps(length, _mm_mul_ps(q[j], q[j]));
+			}
+			//padding lanes are all zero; keep them from dividing by zero
+			length = _mm_sqrt_ps(_mm_max_ps(length, _mm_set1_ps(1e-30f)));
+			for ( int j = 0; j < 4; ++j )
+				_mm_storeu_ps(&pose[(RW + j) * stride + i], _mm_div_ps(q[j], length));
+		}
+#else
+		sampleTracksScalar(k, f, 0, trackCount);
+#endif
+		sampleMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+	}
+
+	//the scalar reference for sample(), for tests and benchmarks
+	void sampleScalar(double time) {
+		size_t k;
+		float f;
+		locate(time, k, f);
+		sampleTracksScalar(k, f, 0, trackCount);
+	}
+
+	//the sampled transform of a track, column-major
+	void poseMatrix(size_t track, GLfloat *mat) const {
+		const float *p = &pose[track];
+		const Quaternion r(p[RW * stride], p[RX * stride], p[RY * stride], p[RZ * stride]);
+		r.toMatrix(mat);
+		const float s[3] = { p[SX * stride], p[SY * stride], p[SZ * stride] };
+		for ( int c = 0; c < 3; ++c )
+			for ( int row = 0; row < 3; ++row )
+				mat[4 * c + row] *= s[c];
+		mat[12] = p[TX * stride];
+		mat[13] = p[TY * stride];
+		mat[14] = p[TZ * stride];
+	}
+
+	//writes the last sample into the target transforms; must not overlap a sample()
+	void apply() {
+		const chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		for ( size_t i = 0; i < trackCount; ++i ) {
+			if ( !targets[i] )
+				continue;
+			GLMatrix4 &t = targets[i]->transform;
+			poseMatrix(i, t.mat);
+			t.touch();
+		}
+		applyMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+	}
+
+	//time spent in the last sample() and apply()
+	double lastSampleMs() const {
+		return sampleMs;
+	}
+
+	double lastApplyMs() const {
+		return applyMs;
+	}
+};
+
+/********************
+ *
+ * Runs KeyframeAnimation::sample() on a thread of its own.
+ *
+ * request(time) starts sampling and returns at once; wait() blocks until the
+ * sample is done. A frame waits, applies the pose and requests the next one,
+ * so sampling frame N+1 overlaps drawing frame N. The animation must not be
+ * touched between request() and wait().
+ *
+ ********************/
+class AnimationWorker {
+	KeyframeAnimation &animation;
+	std::thread thread;
+	std::mutex lock;
+	std::condition_variable wake, done;
+	double requested;
+	bool pending, stopping;
+
+	void run() {
+		for ( ;; ) {
+			double time;
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				wake.wait(guard, [&] { return stopping || pending; });
+				if ( stopping )
+					return;
+				time = requested;
+			}
+			animation.sample(time);
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				pending = false;
+			}
+			done.notify_one();
+		}
+	}
+
+	AnimationWorker(const AnimationWorker &);
+	AnimationWorker &operator=(const AnimationWorker &);
+
+public:
+	explicit AnimationWorker(KeyframeAnimation &animation) : animation(animation), requested(0), pending(false), stopping(false) {
+		thread = std::thread(&AnimationWorker::run, this);
+	}
+
+	~AnimationWorker() {
+		wait();
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+		}
+		wake.notify_one();
+		thread.join();
+	}
+
+	void request(double time) {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			assert(!pending);
+			requested = time;
+			pending = true;
+		}
+		wake.notify_one();
+	}
+
+	void wait() {
+		std::unique_lock<std::mutex> guard(lock);
+		done.wait(guard, [&] { return !pending; });
+	}
+};
+
+#endif
@@ -0,0 +1,212 @@
+#ifndef CS177_ARENA_HPP
+#define CS177_ARENA_HPP
+
+#include "Utility.hpp"
+#include <utility>
+
+/********************
+ *
+ * Node arena.
+ *
+ * Scene nodes are constructed back to back in large blocks instead of one
+ * heap allocation each, and clear() destroys them all at once (newest first)
+ * while keeping the blocks for the next scene. Blocks never move, so node
+ * pointers stay valid until clear().
+ *
+ * Every node also gets a NodeHandle, an index plus the arena generation it
+ * was created in; get() returns null for a handle from before the last
+ * clear(), so code that keeps handles around (tools, loaders) can't touch a
+ * destroyed node by accident.
+ *
+ ********************/
+struct NodeHandle {
+	unsigned index;
+	unsigned generation;     //0 is never used, so a zeroed handle is always invalid
+};
+
+class NodeArena {
+	enum { BLOCK_SIZE = 64 * 1024, ALIGN = 16 };
+
+	vector<char*> blocks;
+	vector<size_t> blockSizes;
+	size_t block, used;      //current block and the bytes used in it
+	vector<SceneNode*> nodes;
+	unsigned generation;
+	size_t blockAllocations;
+
+	void *allocate(size_t bytes) {
+		bytes = (bytes + ALIGN - 1) & ~(size_t) (ALIGN - 1);
+		while ( block < blocks.size() && used + bytes > blockSizes[block] ) {
+			++block;
+			used = 0;
+		}
+		if ( block == blocks.size() ) {
+			//oversized nodes get a block of their own
+			const size_t size = max<size_t>(BLOCK_SIZE, bytes);
+			blocks.push_back(new char[size]);
+			blockSizes.push_back(size);
+			++blockAllocations;
+			used = 0;
+		}
+		void *p = blocks[block] + used;
+		used += bytes;
+		return p;
+	}
+
+	NodeArena(const NodeArena &);
+	NodeArena &operator=(const NodeArena &);
+
+public:
+	NodeArena() : block(0), used(0), generation(1), blockAllocations(0) {
+	}
+
+	~NodeArena() {
+		clear();
+		for ( size_t i = 0; i < blocks.size(); ++i )
+			delete[] blocks[i];
+	}
+
+	template<class T, class... Args>
+	T *create(Args&&... args) {
+		T *node = new (allocate(sizeof(T))) T(std::forward<Args>(args)...);
+		nodes.push_back(node);
+		return node;
+	}
+
+	//the handle of the index-th node created since the last clear()
+	NodeHandle handle(size_t index) const {
+		NodeHandle h = { (unsigned) index, generation };
+		return h;
+	}
+
+	NodeHandle lastHandle() const {
+		assert(!nodes.empty());
+		return handle(nodes.size() - 1);
+	}
+
+	//null if the handle is stale or was never valid
+	SceneNode *get(NodeHandle h) const {
+		if ( h.generation != generation || h.index >= nodes.size() )
+			return 0;
+		return nodes[h.index];
+	}
+
+	size_t size() const {
+		return nodes.size();
+	}
+
+	SceneNode *node(size_t index) const {
+		return nodes[index];
+	}
+
+	//destroys every node and invalidates all handles; the blocks are kept
+	void clear() {
+		for ( size_t i = nodes.size(); i-- > 0; )
+			nodes[i]->~SceneNode();
+		nodes.clear();
+		block = 0;
+		used = 0;
+		++generation;
+	}
+
+	size_t bytesReserved() const {
+		size_t total = 0;
+		for ( size_t i = 0; i < blockSizes.size(); ++i )
+			total += blockSizes[i];
+		return total;
+	}
+
+	//heap allocations made for blocks over the arena's lifetime
+	size_t blockAllocationCount() const {
+		return blockAllocations;
+	}
+};
+
+/********************
+ *
+ * Per-frame linear scratch allocator.
+ *
+ * alloc() just bumps an offset; reset() at the start of each frame releases
+ * everything at once. Only use it for data that lives within one frame and
+ * needs no destructor (masks, matrices, plain structs). If a frame needs more
+ * than the current block, another block is chained on, and the next reset()
+ * merges them into one block of the combined size, so after the first few
+ * frames the scratch stops touching the heap.
+ *
+ ********************/
+class FrameScratch {
+	enum { ALIGN = 16 };
+
+	vector<char*> blocks;
+	vector<size_t> blockSizes;
+	size_t block, used;
+	size_t frameBytes, peak, blockAllocations;
+
+	FrameScratch(const FrameScratch &);
+	FrameScratch &operator=(const FrameScratch &);
+
+public:
+	explicit FrameScratch(size_t initialSize = 64 * 1024) : block(0), used(0), frameBytes(0), peak(0), blockAllocations(1) {
+		blocks.push_back(new char[initialSize]);
+		blockSizes.push_back(initialSize);
+	}
+
+	~FrameScratch() {
+		for ( size_t i = 0; i < blocks.size(); ++i )
+			delete[] blocks[i];
+	}
+
+	void *alloc(size_t bytes) {
+		bytes = (bytes + ALIGN - 1) & ~(size_t) (ALIGN - 1);
+		frameBytes += bytes;
+		while ( used + bytes > blockSizes[block] ) {
+			if ( ++block == blocks.size() ) {
+				const size_t size = max(bytes, blockSizes.back() * 2);
+				blocks.push_back(new char[size]);
+				blockSizes.push_back(size);
+				++blockAllocations;
+			}
+			used = 0;
+		}
+		void *p = blocks[block] + used;
+		used += bytes;
+		return p;
+	}
+
+	template<class T>
+	T *allocArray(size_t count) {
+		return static_cast<T*>(alloc(sizeof(T) * count));
+	}
+
+	//frees everything allocated since the last reset
+	void reset() {
+		peak = max(peak, frameBytes);
+		if ( blocks.size() > 1 ) {
+			size_t total = 0;
+			for ( size_t i = 0; i < blocks.size(); ++i ) {
+				total += blockSizes[i];
+				delete[] blocks[i];
+			}
+			blocks.assign(1, new char[total]);
+			blockSizes.assign(1, total);
+			++blockAllocations;
+		}
+		block = 0;
+		used = 0;
+		frameBytes = 0;
+	}
+
+	size_t bytesThisFrame() const {
+		return frameBytes;
+	}
+
+	size_t peakBytes() const {
+		return max(peak, frameBytes);
+	}
+
+	size_t blockAllocationCount() const {
+		return blockAllocations;
+	}
+};
+
+#endif
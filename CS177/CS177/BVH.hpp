@@ -0,0 +1,358 @@
+#ifndef CS177_BVH_HPP
+#define CS177_BVH_HPP
+
+#include "FlatScene.hpp"
+
+/********************
+ *
+ * Bounding volume hierarchy over the world boxes of a FlatScene, for
+ * "what is under this point / inside this rectangle / along this ray" queries
+ * without walking the whole scene.
+ *
+ * build() indexes every entry that has geometry and splits them top-down with
+ * the surface area heuristic, evaluated over BINS buckets of box centroids
+ * along the widest axis. Call it again whenever the scene was rebuilt. When
+ * only transforms changed, refit() recomputes the boxes bottom-up in one
+ * linear sweep and keeps the tree shape; the tree gets looser as things move
+ * far from where they were at build time, which cost() measures.
+ *
+ * Nodes live in one array with both children of a node stored next to each
+ * other, always after their parent. Query results are FlatScene entry
+ * indices in no particular order.
+ *
+ ********************/
+class SceneBVH {
+public:
+	//below MEDIAN_DEPTH, or once median splits all the way down would only just fit in MAX_DEPTH, nodes
+	//are split at the median, so no leaf is deeper than MAX_DEPTH - 1 and the query stack can't overflow
+	enum { LEAF_SIZE = 4, BINS = 16, MEDIAN_DEPTH = 40, MAX_DEPTH = 64 };
+
+private:
+	struct Node {
+		GLfloat box[6];
+		int first;       //leaf: first slot in items; inner node: left child, the right one follows
+		int count;       //entries in a leaf, 0 for inner nodes
+	};
+
+	const FlatScene *scene;
+	vector<Node> nodes;
+	vector<int> items;           //FlatScene entries, grouped by leaf
+	vector<GLfloat> centroids;   //3 floats per entry, only used while building
+
+	//surface area, with flat boxes (z extent 0, as in the 2D scenes) reducing to the xy area
+	static GLfloat area(const GLfloat box[6]) {
+		if ( boxIsEmpty(box) )
+			return 0;
+		const GLfloat dx = box[3] - box[0], dy = box[4] - box[1], dz = box[5] - box[2];
+		return dx * dy + dy * dz + dz * dx;
+	}
+
+	struct BinOf {
+		const GLfloat *centroids;
+		int axis;
+		GLfloat low, scale;
+		int operator()(int entry) const {
+			const int bin = (int) ((centroids[3 * entry + axis] - low) * scale);
+			return min(max(bin, 0), (int) BINS - 1);
+		}
+	};
+
+	struct BinBelow {
+		BinOf binOf;
+		int split;
+		bool operator()(int entry) const {
+			return binOf(entry) <= split;
+		}
+	};
+
+	//a node over items[begin, end) waiting to be split
+	struct Pending {
+		int node, begin, end, depth;
+	};
+
+	struct CentroidLess {
+		const GLfloat *centroids;
+		int axis;
+		bool operator()(int a, int b) const {
+			return centroids[3 * a + axis] < centroids[3 * b + axis];
+		}
+	};
+
+	//decides whether nodes[n] over items[begin, end) becomes a leaf; otherwise returns the split point
+	int split(int n, int begin, int end, bool median) {
+		const int count = end - begin;
+		if ( count <= 1 )
+			return -1;
+		GLfloat bounds[6];
+		boxSetEmpty(bounds);
+		for ( int i = begin; i < end; ++i ) {
+			const GLfloat *c = &centroids[3 * items[i]];
+			const GLfloat point[6] = { c[0], c[1], c[2], c[0], c[1], c[2] };
+			boxMerge(bounds, point);
+		}
+		int axis = 0;
+		for ( int a = 1; a < 3; ++a )
+			if ( bounds[a + 3] - bounds[a] > bounds[axis + 3] - bounds[axis] )
+				axis = a;
+		const GLfloat extent = bounds[axis + 3] - bounds[axis];
+		if ( extent <= 0 ) {
+			//every centroid is the same; only split to keep leaves small
+			return count <= LEAF_SIZE ? -1 : begin + count / 2;
+		}
+
+		BinOf binOf = { &centroids[0], axis, bounds[axis], BINS / extent };
+		int binCounts[BINS] = { 0 };
+		GLfloat binBoxes[BINS][6];
+		for ( int b = 0; b < BINS; ++b )
+			boxSetEmpty(binBoxes[b]);
+		for ( int i = begin; i < end; ++i ) {
+			const int b = binOf(items[i]);
+			++binCounts[b];
+			boxMerge(binBoxes[b], boxOf(items[i]));
+		}
+
+		//sweep from the right to get the cost of everything above each split
+		GLfloat rightArea[BINS];
+		int rightCount[BINS];
+		GLfloat acc[6];
+		boxSetEmpty(acc);
+		for ( int b = BINS - 1, total = 0; b > 0; --b ) {
+			boxMerge(acc, binBoxes[b]);
+			total += binCounts[b];
+			rightArea[b] = area(acc);
+			rightCount[b] = total;
+		}
+		boxSetEmpty(acc);
+		GLfloat bestCost = 0;
+		int bestSplit = -1;
+		for ( int b = 0, total = 0; b < BINS - 1; ++b ) {
+			boxMerge(acc, binBoxes[b]);
+			total += binCounts[b];
+			if ( !total || !rightCount[b + 1] )
+				continue;
+			const GLfloat cost = area(acc) * total + rightArea[b + 1] * rightCount[b + 1];
+			if ( bestSplit < 0 || cost < bestCost ) {
+				bestCost = cost;
+				bestSplit = b;
+			}
+		}
+
+		//stop when the children plus the extra node test cost more than testing every entry of a small leaf
+		const GLfloat nodeArea = area(nodes[n].box);
+		if ( count <= LEAF_SIZE && (bestSplit < 0 || bestCost + nodeArea >= nodeArea * count) )
+			return -1;
+		if ( bestSplit >= 0 && !median ) {
+			BinBelow below = { binOf, bestSplit };
+			const int mid = (int) (partition(items.begin() + begin, items.begin() + end, below) - items.begin());
+			if ( mid > begin && mid < end )
+				return mid;
+		}
+		const int mid = begin + count / 2;
+		CentroidLess less = { &centroids[0], axis };
+		nth_element(items.begin() + begin, items.begin() + mid, items.begin() + end, less);
+		return mid;
+	}
+
+	static int ceilLog2(int n) {
+		int bits = 0;
+		while ( (1 << bits) < n )
+			++bits;
+		return bits;
+	}
+
+	//median splits from here keep depth + ceilLog2(count) as it is, so they are switched to while that
+	//still leaves the leaves within MAX_DEPTH - 1; the root has at most 31, as the entry count is an int
+	static bool medianFrom(int depth, int count) {
+		return depth >= MEDIAN_DEPTH || depth + ceilLog2(count) >= MAX_DEPTH - 1;
+	}
+
+	void setLeafBox(Node &node) const {
+		boxSetEmpty(node.box);
+		for ( int i = node.first; i < node.first + node.count; ++i )
+			boxMerge(node.box, boxOf(items[i]));
+	}
+
+	static bool overlaps(const GLfloat a[6], const GLfloat b[6]) {
+		return a[0] <= b[3] && b[0] <= a[3] && a[1] <= b[4] && b[1] <= a[4] && a[2] <= b[5] && b[2] <= a[5];
+	}
+
+	//slab test for the half line origin + t * dir, t >= 0
+	static bool hitsRay(const GLfloat box[6], const GLfloat origin[3], const GLfloat dir[3]) {
+		GLfloat tNear = 0, tFar = FLT_MAX;
+		for ( int a = 0; a < 3; ++a ) {
+			if ( dir[a] == 0 ) {
+				if ( origin[a] < box[a] || origin[a] > box[a + 3] )
+					return false;
+				continue;
+			}
+			GLfloat t0 = (box[a] - origin[a]) / dir[a], t1 = (box[a + 3] - origin[a]) / dir[a];
+			if ( t0 > t1 )
+				swap(t0, t1);
+			tNear = max(tNear, t0);
+			tFar = min(tFar, t1);
+			if ( tNear > tFar )
+				return false;
+		}
+		return true;
+	}
+
+	//visits every leaf entry whose box passes test, pruning inner nodes with the same test
+	template<class Test>
+	void query(const Test &test, vector<size_t> &out) const {
+		out.clear();
+		if ( nodes.empty() )
+			return;
+		//a node at depth d leaves at most d siblings behind, and leaves are at most MAX_DEPTH - 1 deep
+		int stack[MAX_DEPTH];
+		int top = 0;
+		stack[top++] = 0;
+		while ( top ) {
+			const Node &node = nodes[stack[--top]];
+			if ( !test(node.box) )
+				continue;
+			if ( node.count ) {
+				for ( int i = node.first; i < node.first + node.count; ++i )
+					if ( test(boxOf(items[i])) )
+						out.push_back(items[i]);
+			} else {
+				assert(top + 2 <= MAX_DEPTH);
+				stack[top++] = node.first + 1;
+				stack[top++] = node.first;
+			}
+		}
+	}
+
+	const GLfloat *boxOf(int entry) const {
+		return scene->box(entry);
+	}
+
+	struct PointTest {
+		const GLfloat *p;
+		bool operator()(const GLfloat box[6]) const {
+			return p[0] >= box[0] && p[0] <= box[3] && p[1] >= box[1] && p[1] <= box[4] && p[2] >= box[2] && p[2] <= box[5];
+		}
+	};
+
+	struct BoxTest {
+		const GLfloat *range;
+		bool operator()(const GLfloat box[6]) const {
+			return overlaps(range, box);
+		}
+	};
+
+	struct RayTest {
+		const GLfloat *origin, *dir;
+		bool operator()(const GLfloat box[6]) const {
+			return hitsRay(box, origin, dir);
+		}
+	};
+
+public:
+	SceneBVH() : scene(0) {
+	}
+
+	//indexes the scene's current world boxes; the scene must outlive the BVH
+	void build(const FlatScene &flatScene) {
+		PROFILE_ZONE("bvh build");
+		scene = &flatScene;
+		nodes.clear();
+		items.clear();
+		centroids.resize(3 * flatScene.size());
+		for ( size_t i = 0; i < flatScene.size(); ++i ) {
+			if ( !flatScene.hasGeometry[i] )
+				continue;
+			const GLfloat *b = flatScene.box(i);
+			centroids[3 * i] = (b[0] + b[3]) * 0.5f;
+			centroids[3 * i + 1] = (b[1] + b[4]) * 0.5f;
+			centroids[3 * i + 2] = (b[2] + b[5]) * 0.5f;
+			items.push_back((int) i);
+		}
+		if ( items.empty() )
+			return;
+		nodes.reserve(2 * items.size() / LEAF_SIZE + 1);
+
+		//explicit stack of pending splits, like FlatScene::build
+		vector<Pending> stack;
+		Node root;
+		root.first = 0;
+		root.count = (int) items.size();
+		setLeafBox(root);
+		nodes.push_back(root);
+		Pending all = { 0, 0, (int) items.size(), 0 };
+		stack.push_back(all);
+		while ( !stack.empty() ) {
+			const Pending job = stack.back();
+			stack.pop_back();
+			const int mid = split(job.node, job.begin, job.end, medianFrom(job.depth, job.end - job.begin));
+			if ( mid < 0 )
+				continue;
+			const int left = (int) nodes.size();
+			Node child;
+			child.first = job.begin;
+			child.count = mid - job.begin;
+			setLeafBox(child);
+			nodes.push_back(child);
+			child.first = mid;
+			child.count = job.end - mid;
+			setLeafBox(child);
+			nodes.push_back(child);
+			nodes[job.node].first = left;
+			nodes[job.node].count = 0;
+			Pending l = { left, job.begin, mid, job.depth + 1 }, r = { left + 1, mid, job.end, job.depth + 1 };
+			stack.push_back(r);
+			stack.push_back(l);
+		}
+		vector<GLfloat>().swap(centroids);
+	}
+
+	//refreshes every box after FlatScene::updateWorld; the scene's topology must not have changed
+	void refit() {
+		PROFILE_ZONE("bvh refit");
+		//children always come after their parent
+		for ( size_t n = nodes.size(); n-- > 0; ) {
+			Node &node = nodes[n];
+			if ( node.count )
+				setLeafBox(node);
+			else {
+				memcpy(node.box, nodes[node.first].box, sizeof(node.box));
+				boxMerge(node.box, nodes[node.first + 1].box);
+			}
+		}
+	}
+
+	size_t size() const {
+		return items.size();
+	}
+
+	size_t nodeCount() const {
+		return nodes.size();
+	}
+
+	//expected box tests per query relative to the root area (the SAH cost); grows as refits loosen the tree
+	double cost() const {
+		if ( nodes.empty() || area(nodes[0].box) <= 0 )
+			return 0;
+		double sum = 0;
+		for ( size_t n = 0; n < nodes.size(); ++n )
+			sum += area(nodes[n].box) * (nodes[n].count ? nodes[n].count : 2);
+		return sum / area(nodes[0].box);
+	}
+
+	void queryPoint(const GLfloat point[3], vector<size_t> &out) const {
+		PointTest test = { point };
+		query(test, out);
+	}
+
+	//box as {minX, minY, minZ, maxX, maxY, maxZ}; a rectangle in the 2D scenes has z from 0 to 0
+	void queryBox(const GLfloat range[6], vector<size_t> &out) const {
+		BoxTest test = { range };
+		query(test, out);
+	}
+
+	void queryRay(const GLfloat origin[3], const GLfloat dir[3], vector<size_t> &out) const {
+		RayTest test = { origin, dir };
+		query(test, out);
+	}
+};
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef CS177_BOUNDS_HPP
+#define CS177_BOUNDS_HPP
+
+#include "Utility.hpp"
+#include <cfloat>
+
+/********************
+ *
+ * Axis-aligned bounding boxes and view-volume tests.
+ *
+ * A box is 6 floats, {minX, minY, minZ, maxX, maxY, maxZ}; an empty box has
+ * min > max so merging it into another box changes nothing.
+ *
+ ********************/
+inline void boxSetEmpty(GLfloat box[6]) {
+	box[0] = box[1] = box[2] = FLT_MAX;
+	box[3] = box[4] = box[5] = -FLT_MAX;
+}
+
+inline bool boxIsEmpty(const GLfloat box[6]) {
+	return box[0] > box[3];
+}
+
+inline void boxMerge(GLfloat box[6], const GLfloat other[6]) {
+	for ( int i = 0; i < 3; ++i ) {
+		box[i] = min(box[i], other[i]);
+		box[i + 3] = max(box[i + 3], other[i + 3]);
+	}
+}
+
+//bounds of the transformed box: the center is transformed and the half extents go through |m|
+inline void boxTransform(const GLfloat m[16], const GLfloat in[6], GLfloat out[6]) {
+	if ( boxIsEmpty(in) ) {
+		boxSetEmpty(out);
+		return;
+	}
+	const GLfloat c[3] = { (in[0] + in[3]) * 0.5f, (in[1] + in[4]) * 0.5f, (in[2] + in[5]) * 0.5f };
+	const GLfloat e[3] = { (in[3] - in[0]) * 0.5f, (in[4] - in[1]) * 0.5f, (in[5] - in[2]) * 0.5f };
+	for ( int r = 0; r < 3; ++r ) {
+		const GLfloat center = m[r] * c[0] + m[4 + r] * c[1] + m[8 + r] * c[2] + m[12 + r];
+		const GLfloat extent = fabs(m[r]) * e[0] + fabs(m[4 + r]) * e[1] + fabs(m[8 + r]) * e[2];
+		out[r] = center - extent;
+		out[r + 3] = center + extent;
+	}
+}
+
+/********************
+ *
+ * The view volume of a transform as six planes, pulled straight out of the
+ * matrix rows (Gribb/Hartmann): everything the matrix maps inside the
+ * [-1, 1] clip cube. Works for the orthographic 2D views here as well as for
+ * a perspective projection.
+ *
+ ********************/
+struct Frustum {
+	GLfloat planes[6][4];   //a, b, c, d with a*x + b*y + c*z + d >= 0 inside
+
+	Frustum() {
+	}
+
+	explicit Frustum(const GLMatrix4 &viewTransform) {
+		set(viewTransform.mat);
+	}
+
+	void set(const GLfloat m[16]) {
+		for ( int axis = 0; axis < 3; ++axis )
+			for ( int side = 0; side < 2; ++side ) {
+				const GLfloat sign = side ? -1.0f : 1.0f;
+				for ( int c = 0; c < 4; ++c )
+					planes[2 * axis + side][c] = m[4 * c + 3] + sign * m[4 * c + axis];
+			}
+	}
+
+	//false only when the box is entirely outside one plane; empty boxes are never visible
+	bool intersects(const GLfloat box[6]) const {
+		if ( boxIsEmpty(box) )
+			return false;
+		for ( int p = 0; p < 6; ++p ) {
+			const GLfloat *pl = planes[p];
+			//the corner furthest along the plane normal
+			const GLfloat x = pl[0] > 0 ? box[3] : box[0];
+			const GLfloat y = pl[1] > 0 ? box[4] : box[1];
+			const GLfloat z = pl[2] > 0 ? box[5] : box[2];
+			if ( pl[0] * x + pl[1] * y + pl[2] * z + pl[3] < 0 )
+				return false;
+		}
+		return true;
+	}
+};
+
+struct CullStats {
+	size_t drawn;               //entries with geometry that passed
+	size_t culled;              //entries with geometry that were rejected
+	size_t subtreesRejected;    //whole subtrees skipped with a single test
+	size_t tests;               //box tests performed
+};
+
+#endif
@@ -0,0 +1,293 @@
+#ifndef CS177_DRAW_QUEUE_HPP
+#define CS177_DRAW_QUEUE_HPP
+
+#include "FlatScene.hpp"
+
+/********************
+ *
+ * Sorted draw-command queue.
+ *
+ * Instead of issuing GL calls in traversal order, draws are recorded as
+ * commands keyed by (layer, depth, program, primitive, line width, mesh) and
+ * submit() sorts them and walks the sorted list while tracking the bound
+ * program, mesh and line state, so only the calls that actually change
+ * something are issued. A matrix upload is skipped as well when the same
+ * program already holds that exact matrix.
+ *
+ * Sorting reorders draws; in a 2D scene without depth testing that changes
+ * what ends up on top. Lower layers are drawn first, and within a layer the
+ * depth keeps the recording order wherever draws overlap: submit() walks the
+ * commands as recorded over a grid of the view, and a command goes one depth
+ * past every earlier one sharing a cell with its screen box. Only draws that
+ * can't cover each other share a depth and get sorted by state. Equal keys
+ * keep their recording order; the sort breaks ties on a sequence number
+ * rather than using stable_sort, which would allocate a temporary buffer
+ * every frame.
+ *
+ * stats accumulates over every submit() since the last beginFrame().
+ *
+ * recordSceneParallel() records on a JobSystem instead: every job fills the
+ * command list of its own range of entries with no GL calls and no locking,
+ * and the lists are appended in range order on the calling (GL) thread, so
+ * the merged queue draws in the same order as recordScene(). Meshes can only be uploaded on the GL thread, so every
+ * MeshNode must have been drawn or had getMesh() called once before.
+ *
+ ********************/
+struct DrawCommand {
+	int layer;
+	GLuint program;
+	GLenum primitive;
+	GLfloat lineWidth;
+	Mesh *mesh;
+	GLint matrixUniform;
+	GLfloat transform[16];
+	GLfloat screenBox[4];       //x and y extent in clip space: min x, min y, max x, max y
+	int depth;                  //painter's order within the layer, set by submit()
+	const char *nodeType;       //for the profiler
+	size_t sequence;            //recording order, the final sort key
+};
+
+struct DrawQueueStats {
+	size_t commands;
+	size_t drawCalls;
+	size_t programBinds;
+	size_t meshBinds;
+	size_t lineStateChanges;
+	size_t stateChangesSkipped;
+	size_t uniformUploads;
+	size_t uniformUploadsSkipped;
+};
+
+class DrawQueue {
+	enum { DEPTH_GRID = 64 };
+
+	vector<DrawCommand> commands;
+	vector< vector<DrawCommand> > rangeLists;    //per job of recordSceneParallel(), in scene order
+	int cellDepths[DEPTH_GRID * DEPTH_GRID];     //the depth a new command covering the cell must take
+
+	//the state shared by recordSceneParallel()'s jobs
+	struct ParallelRecord {
+		DrawQueue *queue;
+		int layer;
+		GLuint program;
+		GLint matrixUniform;
+		const FlatScene *scene;
+		const GLMatrix4 *viewTransform;
+		const char *visible;
+		size_t first, grain;        //the recorded range starts at first
+
+		static void job(void *context, size_t begin, size_t end) {
+			const ParallelRecord &r = *static_cast<ParallelRecord*>(context);
+			vector<DrawCommand> &list = r.queue->rangeLists[(begin - r.first) / r.grain];
+			for ( size_t i = begin; i < end; ++i ) {
+				if ( r.visible && !r.visible[i] )
+					continue;
+				MeshNode *node = dynamic_cast<MeshNode*>(r.scene->nodes[i]);
+				if ( !node )
+					continue;
+				DrawCommand cmd;
+				fill(cmd, r.layer, r.program, r.matrixUniform, *node, node->uploadedMesh());
+				assert(cmd.mesh);
+				mat4Multiply(r.viewTransform->mat, r.scene->world(i), cmd.transform);
+				screenBox(*r.viewTransform, r.scene->box(i), cmd.screenBox);
+				list.push_back(cmd);
+			}
+		}
+	};
+
+	static void fill(DrawCommand &cmd, int layer, GLuint program, GLint matrixUniform, const MeshNode &node, Mesh *mesh) {
+		cmd.layer = layer;
+		cmd.program = program;
+		cmd.primitive = node.primitive();
+		cmd.lineWidth = node.getLineWidth();
+		cmd.mesh = mesh;
+		cmd.matrixUniform = matrixUniform;
+		cmd.nodeType = node.typeName();
+	}
+
+	//the clip space rectangle covered by a world box seen through viewTransform
+	static void screenBox(const GLMatrix4 &viewTransform, const GLfloat *worldBox, GLfloat *out) {
+		GLfloat box[6];
+		if ( boxIsEmpty(worldBox) ) {
+			out[0] = out[1] = -1;
+			out[2] = out[3] = 1;
+			return;
+		}
+		boxTransform(viewTransform.mat, worldBox, box);
+		out[0] = box[0];
+		out[1] = box[1];
+		out[2] = box[3];
+		out[3] = box[4];
+	}
+
+	static int cell(GLfloat x) {
+		const int c = (int) floor((x + 1) * 0.5f * DEPTH_GRID);
+		return c < 0 ? 0 : c >= DEPTH_GRID ? DEPTH_GRID - 1 : c;
+	}
+
+	//gives every command, in recording order, the depth past the earlier commands it may overlap
+	void assignDepths() {
+		std::fill(cellDepths, cellDepths + DEPTH_GRID * DEPTH_GRID, 0);
+		for ( size_t i = 0; i < commands.size(); ++i ) {
+			DrawCommand &cmd = commands[i];
+			const int x0 = cell(cmd.screenBox[0]), y0 = cell(cmd.screenBox[1]);
+			const int x1 = cell(cmd.screenBox[2]), y1 = cell(cmd.screenBox[3]);
+			int depth = 0;
+			for ( int y = y0; y <= y1; ++y )
+				for ( int x = x0; x <= x1; ++x )
+					depth = max(depth, cellDepths[y * DEPTH_GRID + x]);
+			cmd.depth = depth;
+			for ( int y = y0; y <= y1; ++y )
+				for ( int x = x0; x <= x1; ++x )
+					cellDepths[y * DEPTH_GRID + x] = depth + 1;
+		}
+	}
+
+	static bool commandOrder(const DrawCommand &a, const DrawCommand &b) {
+		if ( a.layer != b.layer ) return a.layer < b.layer;
+		if ( a.depth != b.depth ) return a.depth < b.depth;
+		if ( a.program != b.program ) return a.program < b.program;
+		if ( a.primitive != b.primitive ) return a.primitive < b.primitive;
+		if ( a.lineWidth != b.lineWidth ) return a.lineWidth < b.lineWidth;
+		if ( a.mesh != b.mesh ) return a.mesh < b.mesh;
+		return a.sequence < b.sequence;
+	}
+
+public:
+	DrawQueueStats stats;
+
+	DrawQueue() {
+		beginFrame();
+	}
+
+	void beginFrame() {
+		memset(&stats, 0, sizeof(stats));
+	}
+
+	//screenBox is what the draw may cover in clip space (min x, min y, max x, max y); without one it is
+	//taken to cover the whole view and stays in order with everything else on its layer
+	void record(int layer, GLuint program, GLint matrixUniform, MeshNode &node, const GLfloat *transform, const GLfloat *screenBox = 0) {
+		static const GLfloat wholeView[4] = { -1, -1, 1, 1 };
+		DrawCommand cmd;
+		fill(cmd, layer, program, matrixUniform, node, node.getMesh());
+		memcpy(cmd.transform, transform, sizeof(cmd.transform));
+		memcpy(cmd.screenBox, screenBox ? screenBox : wholeView, sizeof(cmd.screenBox));
+		cmd.sequence = commands.size();
+		commands.push_back(cmd);
+	}
+
+	//records every MeshNode of the scene with viewTransform * world, or only those marked in visible;
+	//with a range only entries [begin, end)
+	void recordScene(int layer, GLuint program, GLint matrixUniform, const FlatScene &scene, const GLMatrix4 &viewTransform, const char *visible = 0,
+	                 size_t begin = 0, size_t end = (size_t) -1) {
+		GLfloat t[16], box[4];
+		end = min(end, scene.size());
+		for ( size_t i = begin; i < end; ++i ) {
+			if ( visible && !visible[i] )
+				continue;
+			MeshNode *node = dynamic_cast<MeshNode*>(scene.nodes[i]);
+			if ( !node )
+				continue;
+			mat4Multiply(viewTransform.mat, scene.world(i), t);
+			screenBox(viewTransform, scene.box(i), box);
+			record(layer, program, matrixUniform, *node, t, box);
+		}
+	}
+
+	//recordScene() split into ranges of grain entries over jobs; call from the GL thread
+	void recordSceneParallel(JobSystem &jobs, int layer, GLuint program, GLint matrixUniform, const FlatScene &scene,
+	                         const GLMatrix4 &viewTransform, const char *visible = 0, size_t begin = 0, size_t end = (size_t) -1,
+	                         size_t grain = 1024) {
+		end = min(end, scene.size());
+		if ( jobs.size() == 1 || end <= begin + 2 * grain ) {
+			recordScene(layer, program, matrixUniform, scene, viewTransform, visible, begin, end);
+			return;
+		}
+		//only ever grown, so the lists keep their capacity across calls with shorter ranges
+		const size_t ranges = (end - begin + grain - 1) / grain;
+		if ( rangeLists.size() < ranges )
+			rangeLists.resize(ranges);
+		ParallelRecord record = { this, layer, program, matrixUniform, &scene, &viewTransform, visible, begin, grain };
+		JobGroup group;
+		for ( size_t first = begin; first < end; first += grain )
+			jobs.run(group, ParallelRecord::job, &record, first, min(end, first + grain));
+		jobs.wait(group);
+		//the ranges in order are the scene order, which submit() assigns the depths in; numbered like recordScene()
+		for ( size_t r = 0; r < ranges; ++r ) {
+			for ( size_t i = 0; i < rangeLists[r].size(); ++i ) {
+				commands.push_back(rangeLists[r][i]);
+				commands.back().sequence = commands.size() - 1;
+			}
+			rangeLists[r].clear();
+		}
+	}
+
+	size_t size() const {
+		return commands.size();
+	}
+
+	//drops the recorded commands without submitting them
+	void clear() {
+		commands.clear();
+	}
+
+	//sorts, submits and clears the recorded commands
+	void submit() {
+		assignDepths();
+		sort(commands.begin(), commands.end(), commandOrder);
+
+		//state is only tracked within one submit; other code may touch GL in between
+		GLuint boundProgram = 0;
+		Mesh *boundMesh = 0;
+		GLfloat boundLineWidth = 0;
+		bool lineSmooth = false;
+		const GLfloat *lastUpload = 0;
+		for ( size_t i = 0; i < commands.size(); ++i ) {
+			const DrawCommand &cmd = commands[i];
+			PROFILE_NODE(cmd.nodeType);
+			if ( i == 0 || cmd.program != boundProgram ) {
+				glUseProgram(cmd.program);
+				boundProgram = cmd.program;
+				lastUpload = 0;
+				++stats.programBinds;
+			} else
+				++stats.stateChangesSkipped;
+
+			if ( cmd.mesh != boundMesh ) {
+				cmd.mesh->bind();
+				boundMesh = cmd.mesh;
+				++stats.meshBinds;
+			} else
+				++stats.stateChangesSkipped;
+
+			if ( cmd.lineWidth > 0 ) {
+				if ( !lineSmooth ) {
+					glEnable(GL_LINE_SMOOTH);
+					lineSmooth = true;
+					++stats.lineStateChanges;
+				}
+				if ( cmd.lineWidth != boundLineWidth ) {
+					glLineWidth(cmd.lineWidth);
+					boundLineWidth = cmd.lineWidth;
+					++stats.lineStateChanges;
+				} else
+					++stats.stateChangesSkipped;
+			}
+
+			if ( lastUpload && memcmp(lastUpload, cmd.transform, sizeof(cmd.transform)) == 0 )
+				++stats.uniformUploadsSkipped;
+			else {
+				glUniformMatrix4fv(cmd.matrixUniform, 1, false, cmd.transform);
+				lastUpload = cmd.transform;
+				++stats.uniformUploads;
+			}
+
+			glDrawArrays(cmd.primitive, 0, cmd.mesh->count);
+			++stats.drawCalls;
+		}
+		stats.commands += commands.size();
+		commands.clear();
+	}
+};
+
+#endif
@@ -0,0 +1,408 @@
+#ifndef CS177_FLAT_SCENE_HPP
+#define CS177_FLAT_SCENE_HPP
+
+#include "Bounds.hpp"
+#include "Profiler.hpp"
+#include "JobSystem.hpp"
+
+/********************
+ *
+ * Flattened scene hierarchy.
+ *
+ * build() walks a SceneNode tree once and stores every node occurrence in
+ * contiguous arrays sorted parent-before-child (depth-first pre-order), with
+ * the parent's index instead of a pointer and the local/world matrices kept
+ * as separate structure-of-arrays blocks of 16 floats. updateWorld() is then a
+ * single linear sweep with no recursion and no pointer chasing.
+ *
+ * A node that is attached to several parents (like the shared
+ * CoordinateFrameNode in createScene) gets one entry per occurrence, since
+ * each occurrence has its own world transform.
+ *
+ * World matrices are cached between frames. build() has the scene's
+ * TransformLog watch the node transforms, so syncLocals() only visits the
+ * transforms that changed since the last sync, copies them and flags their
+ * entries dirty; updateWorld() propagates the flag to descendants (a parent
+ * always comes first) and recomputes only flagged entries. stats holds the
+ * counts for the last update. Transforms another scene watched first, and
+ * all of them in a copy of a scene, are compared by GLMatrix4::revision
+ * every sync instead.
+ *
+ * Every entry also keeps the world box of its own geometry (from
+ * SceneNode::localBounds) and of its whole subtree, refreshed along with the
+ * world matrices. Since a subtree is a contiguous range of entries, cull()
+ * can reject it with one test against the view volume and jump past it; the
+ * draw paths then skip the entries it marked invisible.
+ *
+ ********************/
+struct FlatSceneStats {
+	size_t localsChanged;       //entries whose node transform changed since the last sync
+	size_t recomputed;          //world matrices multiplied in the last updateWorld()
+	size_t reused;              //world matrices kept from the previous update
+};
+
+struct FlatScene {
+	vector<SceneNode*> nodes;   //the node each entry was built from
+	vector<int> parents;        //parent entry, -1 for the root; always < own index
+	vector<GLfloat> locals;     //16 floats per entry
+	vector<GLfloat> worlds;     //16 floats per entry, relative to the root transform
+	vector<unsigned> revisions; //node->transform.revision when the local was copied
+	vector<char> dirty;         //world matrix must be recomputed
+	vector<char> hasGeometry;   //the node draws something itself
+	vector<GLfloat> localBoxes; //6 floats per entry, own geometry in local space
+	vector<GLfloat> boxes;      //6 floats per entry, own geometry in world space
+	vector<GLfloat> subtreeBoxes; //6 floats per entry, own geometry and all descendants
+	vector<int> subtreeEnds;    //one past the entry's last descendant
+	vector<int> subtreeMeshes;  //entries with geometry in the subtree
+	GLMatrix4 lastRoot;
+	bool rootValid;
+	FlatSceneStats stats;
+	vector<int> openStack;      //updateParallel()'s subtrees still to open up, kept to avoid reallocating
+	vector<int> firstEntry;     //per log slot, an entry of that node
+	vector<int> nextEntry;      //the next entry of the same node (one is shared), -1 after the last
+	vector<int> polled;         //entries whose transform another log watches
+
+	//owns the TransformLog; a copy of the scene starts without one
+	struct LogHolder {
+		TransformLog *log;
+
+		LogHolder() : log(0) {
+		}
+
+		LogHolder(const LogHolder &) : log(0) {
+		}
+
+		LogHolder &operator=(const LogHolder &) {
+			delete log;
+			log = 0;
+			return *this;
+		}
+
+		~LogHolder() {
+			delete log;
+		}
+	};
+	LogHolder changes;
+
+	//the state shared by updateParallel()'s jobs
+	struct ParallelUpdate {
+		FlatScene *scene;
+		const GLMatrix4 *rootTransform;
+		bool rootChanged;
+		std::atomic<size_t> recomputed;
+
+		void run(size_t begin, size_t end) {
+			recomputed += scene->updateRange(begin, end, *rootTransform, rootChanged);
+		}
+
+		static void job(void *context, size_t begin, size_t end) {
+			static_cast<ParallelUpdate*>(context)->run(begin, end);
+		}
+	};
+
+	FlatScene() : rootValid(false) {
+		memset(&stats, 0, sizeof(stats));
+	}
+
+	size_t size() const {
+		return nodes.size();
+	}
+
+	const GLfloat *local(size_t i) const {
+		return &locals[16 * i];
+	}
+
+	const GLfloat *world(size_t i) const {
+		return &worlds[16 * i];
+	}
+
+	void clear() {
+		nodes.clear();
+		parents.clear();
+		locals.clear();
+		worlds.clear();
+		revisions.clear();
+		dirty.clear();
+		hasGeometry.clear();
+		localBoxes.clear();
+		boxes.clear();
+		subtreeBoxes.clear();
+		subtreeEnds.clear();
+		subtreeMeshes.clear();
+		firstEntry.clear();
+		nextEntry.clear();
+		polled.clear();
+		if ( changes.log )
+			changes.log->clear();
+		rootValid = false;
+	}
+
+	//appends one entry; parent must already be in the scene (or -1)
+	int add(SceneNode *node, int parent) {
+		assert(parent < (int) nodes.size());
+		const int index = (int) nodes.size();
+		nodes.push_back(node);
+		parents.push_back(parent);
+		locals.insert(locals.end(), node->transform.mat, node->transform.mat + 16);
+		worlds.resize(worlds.size() + 16);
+		revisions.push_back(node->transform.revision);
+		dirty.push_back(1);
+		GLfloat box[6];
+		hasGeometry.push_back(node->localBounds(box));
+		if ( !hasGeometry.back() )
+			boxSetEmpty(box);
+		localBoxes.insert(localBoxes.end(), box, box + 6);
+		boxes.resize(boxes.size() + 6);
+		subtreeBoxes.resize(subtreeBoxes.size() + 6);
+		subtreeEnds.push_back(index + 1);
+		subtreeMeshes.push_back(hasGeometry.back());
+		nextEntry.push_back(-1);
+		if ( !changes.log )
+			changes.log = new TransformLog;
+		const int slot = changes.log->watch(node->transform);
+		if ( slot < 0 ) {
+			polled.push_back(index);
+		} else if ( slot == (int) firstEntry.size() ) {
+			firstEntry.push_back(index);
+		} else {
+			nextEntry[index] = firstEntry[slot];
+			firstEntry[slot] = index;
+		}
+		return index;
+	}
+
+	void build(SceneNode &root) {
+		clear();
+		//explicit stack of (node, parent entry) so deep hierarchies can't overflow the call stack
+		vector< pair<SceneNode*, int> > stack;
+		stack.push_back(make_pair(&root, -1));
+		while ( !stack.empty() ) {
+			SceneNode *node = stack.back().first;
+			const int index = add(node, stack.back().second);
+			stack.pop_back();
+			//pushed in reverse so the children come out in their original order
+			for ( size_t i = node->children.size(); i-- > 0; )
+				stack.push_back(make_pair(node->children[i], index));
+		}
+		//children come after their parent, so a reverse sweep sees every subtree finished
+		for ( size_t i = nodes.size(); i-- > 1; ) {
+			const int p = parents[i];
+			subtreeEnds[p] = max(subtreeEnds[p], subtreeEnds[i]);
+			subtreeMeshes[p] += subtreeMeshes[i];
+		}
+	}
+
+	//copy the transforms that changed since the last sync into the local array
+	void syncLocals() {
+		size_t changed = 0;
+		if ( !changes.log ) {
+			for ( size_t i = 0; i < nodes.size(); ++i )
+				changed += syncEntry(i, nodes[i]->transform);
+			stats.localsChanged = changed;
+			return;
+		}
+		const vector<unsigned> &slots = changes.log->changes();
+		for ( size_t k = 0; k < slots.size(); ++k ) {
+			const GLMatrix4 *t = changes.log->matrix(slots[k]);
+			if ( !t )
+				continue;
+			for ( int i = firstEntry[slots[k]]; i >= 0; i = nextEntry[i] )
+				changed += syncEntry(i, *t);
+		}
+		changes.log->drained();
+		for ( size_t k = 0; k < polled.size(); ++k )
+			changed += syncEntry(polled[k], nodes[polled[k]]->transform);
+		stats.localsChanged = changed;
+	}
+
+	//world[i] = world[parent[i]] * local[i], world[root] = rootTransform * local[root]
+	void updateWorld(const GLMatrix4 &rootTransform) {
+		const bool rootChanged = beginUpdate(rootTransform);
+		stats.recomputed = updateRange(0, nodes.size(), rootTransform, rootChanged);
+		endUpdate();
+	}
+
+	/********************
+	 *
+	 * syncLocals() and updateWorld() in one pass, spread over a JobSystem.
+	 *
+	 * A subtree is a contiguous range whose entries only depend on each other
+	 * and on the subtree root's parent, so once a node is done its children's
+	 * subtrees can run in parallel. Starting at the root, a subtree of more
+	 * than grain entries is opened up: its root is done here and its children
+	 * are handed out as jobs, consecutive small siblings grouped into ranges
+	 * of about grain entries, while big children are opened up in turn. The
+	 * results are identical to the serial calls. Small scenes just run
+	 * serially. The changed locals are copied before, on this thread, since
+	 * that only costs as much as there are changes.
+	 *
+	 ********************/
+	void updateParallel(JobSystem &jobs, const GLMatrix4 &rootTransform, size_t grain = 1024) {
+		if ( jobs.size() == 1 || nodes.size() <= 2 * grain ) {
+			syncLocals();
+			updateWorld(rootTransform);
+			return;
+		}
+		syncLocals();
+		ParallelUpdate update;
+		update.scene = this;
+		update.rootTransform = &rootTransform;
+		update.rootChanged = beginUpdate(rootTransform);
+		update.recomputed = 0;
+
+		JobGroup group;
+		vector<int> &open = openStack;
+		open.assign(1, 0);
+		while ( !open.empty() ) {
+			const int i = open.back();
+			open.pop_back();
+			update.run(i, i + 1);
+			size_t first = i + 1;
+			for ( int child = i + 1; child < subtreeEnds[i]; child = subtreeEnds[child] ) {
+				if ( (size_t) (subtreeEnds[child] - child) > grain ) {
+					if ( first < (size_t) child )
+						jobs.run(group, ParallelUpdate::job, &update, first, child);
+					open.push_back(child);
+					first = subtreeEnds[child];
+				} else if ( (size_t) subtreeEnds[child] - first >= grain ) {
+					jobs.run(group, ParallelUpdate::job, &update, first, subtreeEnds[child]);
+					first = subtreeEnds[child];
+				}
+			}
+			if ( first < (size_t) subtreeEnds[i] )
+				jobs.run(group, ParallelUpdate::job, &update, first, subtreeEnds[i]);
+		}
+		jobs.wait(group);
+
+		stats.recomputed = update.recomputed;
+		endUpdate();
+	}
+
+	//copies t into entry i if it changed since the last copy; returns whether it did
+	size_t syncEntry(size_t i, const GLMatrix4 &t) {
+		if ( t.revision == revisions[i] )
+			return 0;
+		memcpy(&locals[16 * i], t.mat, sizeof(GLfloat) * 16);
+		revisions[i] = t.revision;
+		dirty[i] = 1;
+		return 1;
+	}
+
+	//recomputes the dirty world matrices of entries [begin, end), whose parents outside the range
+	//must be up to date; returns how many were recomputed
+	size_t updateRange(size_t begin, size_t end, const GLMatrix4 &rootTransform, bool rootChanged) {
+		size_t recomputed = 0;
+		for ( size_t i = begin; i < end; ++i ) {
+			const int p = parents[i];
+			if ( p < 0 ? rootChanged : dirty[p] != 0 )
+				dirty[i] = 1;
+			if ( !dirty[i] )
+				continue;
+			const GLfloat *parent = p < 0 ? rootTransform.mat : &worlds[16 * p];
+			mat4Multiply(parent, &locals[16 * i], &worlds[16 * i]);
+			boxTransform(&worlds[16 * i], &localBoxes[6 * i], &boxes[6 * i]);
+			++recomputed;
+		}
+		return recomputed;
+	}
+
+	//returns whether the root transform changed since the last update
+	bool beginUpdate(const GLMatrix4 &rootTransform) {
+		const bool rootChanged = !rootValid || memcmp(lastRoot.mat, rootTransform.mat, sizeof(lastRoot.mat)) != 0;
+		lastRoot = rootTransform;
+		rootValid = true;
+		return rootChanged;
+	}
+
+	void endUpdate() {
+		stats.reused = nodes.size() - stats.recomputed;
+		if ( stats.recomputed )
+			updateSubtreeBoxes();
+
+		//a child reads its parent's flag in the same sweep, so flags are only cleared afterwards
+		fill(dirty.begin(), dirty.end(), 0);
+	}
+
+	void updateSubtreeBoxes() {
+		subtreeBoxes = boxes;
+		for ( size_t i = nodes.size(); i-- > 1; )
+			boxMerge(&subtreeBoxes[6 * parents[i]], &subtreeBoxes[6 * i]);
+	}
+
+	const GLfloat *box(size_t i) const {
+		return &boxes[6 * i];
+	}
+
+	const GLfloat *subtreeBox(size_t i) const {
+		return &subtreeBoxes[6 * i];
+	}
+
+	//copies what cull() and the draw paths read for the current frame into to, so the frame can be
+	//drawn from to while this scene is updated further; everything is copied when to holds other nodes.
+	//Of the locals only those whose revision moved are copied, for StaticBatches::refresh()
+	void copyFrame(FlatScene &to) const {
+		if ( to.nodes != nodes ) {
+			to = *this;
+			return;
+		}
+		for ( size_t i = 0; i < revisions.size(); ++i )
+			if ( to.revisions[i] != revisions[i] ) {
+				memcpy(&to.locals[16 * i], &locals[16 * i], sizeof(GLfloat) * 16);
+				to.revisions[i] = revisions[i];
+			}
+		to.worlds = worlds;
+		to.boxes = boxes;
+		to.subtreeBoxes = subtreeBoxes;
+		to.stats = stats;
+	}
+
+	//marks the entries whose geometry may be visible through viewTransform in visible, which
+	//must hold size() flags; call after updateWorld()
+	void cull(const GLMatrix4 &viewTransform, char *visible, CullStats &cullStats) const {
+		PROFILE_ZONE("cull");
+		memset(&cullStats, 0, sizeof(cullStats));
+		memset(visible, 0, nodes.size());
+		const Frustum frustum(viewTransform);
+		for ( size_t i = 0; i < nodes.size(); ) {
+			if ( !subtreeMeshes[i] ) {
+				i = subtreeEnds[i];
+				continue;
+			}
+			++cullStats.tests;
+			if ( !frustum.intersects(&subtreeBoxes[6 * i]) ) {
+				cullStats.culled += subtreeMeshes[i];
+				++cullStats.subtreesRejected;
+				i = subtreeEnds[i];
+				continue;
+			}
+			if ( hasGeometry[i] ) {
+				//a lone entry with no children was already settled by the subtree test
+				const bool leaf = subtreeEnds[i] == (int) i + 1;
+				if ( !leaf )
+					++cullStats.tests;
+				if ( leaf || frustum.intersects(&boxes[6 * i]) ) {
+					visible[i] = 1;
+					++cullStats.drawn;
+				} else
+					++cullStats.culled;
+			}
+			++i;
+		}
+	}
+
+	//draws every entry with viewTransform * world, the same result as root.draw(viewTransform);
+	//with visible (from cull()) only the marked entries are drawn, and only entries [begin, end) with a range
+	void draw(const GLMatrix4 &viewTransform, const char *visible = 0, size_t begin = 0, size_t end = (size_t) -1) const {
+		GLMatrix4 t;
+		end = min(end, nodes.size());
+		for ( size_t i = begin; i < end; ++i ) {
+			if ( visible && !visible[i] )
+				continue;
+			mat4Multiply(viewTransform.mat, &worlds[16 * i], t.mat);
+			PROFILE_NODE(nodes[i]->typeName());
+			nodes[i]->drawSelf(t);
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef CS177_FOUNTAIN_PARTICLE_HPP
+#define CS177_FOUNTAIN_PARTICLE_HPP
+
+//one vertex of fountain.vsh (see ParticleFountain.hpp); plain types, so producers
+//such as ParticleSim.hpp can fill it without GL
+struct FountainParticle {
+	float startTime;
+	float velocity[3];
+	unsigned color;
+};
+
+#endif
@@ -0,0 +1,213 @@
+#ifndef CS177_FRAME_PIPELINE_HPP
+#define CS177_FRAME_PIPELINE_HPP
+
+#include "FlatScene.hpp"
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/********************
+ *
+ * Pipelined frame execution.
+ *
+ * A plain frame polls input, updates the scene, submits it and swaps, one
+ * step after the other, so the CPU sits idle in the swap and the GPU during
+ * the update. A FramePipeline moves the update to a thread of its own:
+ * advance(input) hands frame N's input to that thread and returns the
+ * snapshot of frame N - (depth - 1) to draw, so the newer updates run while
+ * the older frame is submitted and swapped.
+ *
+ * A snapshot holds the Frame (the input, plus whatever the update function
+ * writes back into it, e.g. the view transform) and a copy of the scene's
+ * world matrices and bounds for that frame (FlatScene::copyFrame()); the
+ * draw paths take snapshot->scene like the live scene. While the pipeline
+ * runs, the live scene and the node transforms belong to the update thread;
+ * the render thread may only use what never changes after build(), such as
+ * the node types and meshes.
+ *
+ * depth 1 runs the update inline in advance() and draws the live scene, the
+ * old sequential loop. Each further stage overlaps one more update and adds
+ * one frame of input latency; advance() returns 0 while the pipeline fills.
+ * Every snapshot goes back through release() after the swap that presents
+ * it, which is also where the latency is measured.
+ *
+ ********************/
+template<class Frame>
+struct FrameSnapshot {
+	const FlatScene *scene;     //the frame's scene, the live one at depth 1
+	Frame frame;
+	unsigned number;            //advance() call that supplied the input
+	chrono::high_resolution_clock::time_point inputTime;
+	double updateMs;
+	FlatScene copy;             //scene points here past depth 1
+};
+
+//averages since the last resetStats()
+struct FramePipelineStats {
+	size_t frames;              //snapshots released
+	double latencyFrames;       //input to present, counting the frame that presents it
+	double latencyMs;           //from advance() taking the input until its release()
+	double updateMs;            //update function plus the snapshot copy
+	double waitMs;              //render thread blocked in advance() on the update
+	double framesPerSecond;
+};
+
+template<class Frame>
+class FramePipeline {
+public:
+	typedef void (*UpdateFunction)(void *context, Frame &frame, FlatScene &scene);
+	typedef FrameSnapshot<Frame> Snapshot;
+
+private:
+	typedef chrono::high_resolution_clock Clock;
+
+	FlatScene &live;
+	UpdateFunction update;
+	void *context;
+	vector<Snapshot> slots;     //input n lives in slots[n % depth] until it is released
+	std::thread updater;
+	std::mutex lock;
+	std::condition_variable submittedCondition, updatedCondition, releasedCondition;
+	unsigned submitted, updated, acquired, released;
+	bool stopping;
+
+	size_t statFrames;
+	double latencyFrameSum, latencyMsSum, updateMsSum, waitMsSum;
+	Clock::time_point statStart;
+
+	void runUpdate(Snapshot &slot) {
+		const Clock::time_point start = Clock::now();
+		update(context, slot.frame, live);
+		if ( slot.scene != &live )
+			live.copyFrame(slot.copy);
+		slot.updateMs = chrono::duration<double, milli>(Clock::now() - start).count();
+	}
+
+	void updaterLoop() {
+		for ( ;; ) {
+			Snapshot *slot;
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				submittedCondition.wait(guard, [&] { return stopping || updated != submitted; });
+				if ( stopping )
+					return;
+				slot = &slots[updated % slots.size()];
+			}
+			runUpdate(*slot);
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				++updated;
+			}
+			updatedCondition.notify_one();
+		}
+	}
+
+	FramePipeline(const FramePipeline &);
+	FramePipeline &operator=(const FramePipeline &);
+
+public:
+	FramePipeline(FlatScene &live, unsigned depth, UpdateFunction update, void *context)
+		: live(live), update(update), context(context), slots(max(1u, depth)),
+		  submitted(0), updated(0), acquired(0), released(0), stopping(false) {
+		for ( size_t i = 0; i < slots.size(); ++i ) {
+			slots[i].scene = slots.size() == 1 ? &live : &slots[i].copy;
+			slots[i].updateMs = 0;
+		}
+		resetStats();
+		if ( slots.size() > 1 )
+			updater = std::thread(&FramePipeline::updaterLoop, this);
+	}
+
+	~FramePipeline() {
+		finish();
+	}
+
+	//lets the update in progress, if any, finish and stops the update thread, so the scene can be
+	//torn down; frames still in flight are dropped and advance() must not be called again
+	void finish() {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+		}
+		submittedCondition.notify_one();
+		if ( updater.joinable() )
+			updater.join();
+	}
+
+	unsigned depth() const {
+		return (unsigned) slots.size();
+	}
+
+	//queues the update for input and returns the oldest frame that is due, 0 while filling up
+	Snapshot *advance(const Frame &input) {
+		const Clock::time_point start = Clock::now();
+		Snapshot *slot;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			releasedCondition.wait(guard, [&] { return submitted - released < slots.size(); });
+			slot = &slots[submitted % slots.size()];
+		}
+		slot->frame = input;
+		slot->number = submitted;
+		slot->inputTime = start;
+		if ( slots.size() == 1 ) {
+			runUpdate(*slot);
+			++submitted;
+			++updated;
+			++acquired;
+			return slot;
+		}
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			++submitted;
+		}
+		submittedCondition.notify_one();
+		if ( submitted - acquired < slots.size() )
+			return 0;
+		const Clock::time_point waitStart = Clock::now();
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			updatedCondition.wait(guard, [&] { return updated != acquired; });
+		}
+		waitMsSum += chrono::duration<double, milli>(Clock::now() - waitStart).count();
+		return &slots[acquired++ % slots.size()];
+	}
+
+	//hands a snapshot from advance() back once its frame has been presented; returns its latency in ms
+	double release(Snapshot *snapshot) {
+		assert(snapshot == &slots[released % slots.size()]);
+		const double latencyMs = chrono::duration<double, milli>(Clock::now() - snapshot->inputTime).count();
+		++statFrames;
+		latencyFrameSum += submitted - snapshot->number;
+		latencyMsSum += latencyMs;
+		updateMsSum += snapshot->updateMs;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			++released;
+		}
+		releasedCondition.notify_one();
+		return latencyMs;
+	}
+
+	FramePipelineStats stats() const {
+		FramePipelineStats s;
+		const double n = (double) max<size_t>(1, statFrames);
+		const double seconds = chrono::duration<double>(Clock::now() - statStart).count();
+		s.frames = statFrames;
+		s.latencyFrames = latencyFrameSum / n;
+		s.latencyMs = latencyMsSum / n;
+		s.updateMs = updateMsSum / n;
+		s.waitMs = waitMsSum / n;
+		s.framesPerSecond = seconds > 0 ? statFrames / seconds : 0;
+		return s;
+	}
+
+	void resetStats() {
+		statFrames = 0;
+		latencyFrameSum = latencyMsSum = updateMsSum = waitMsSum = 0;
+		statStart = Clock::now();
+	}
+};
+
+#endif
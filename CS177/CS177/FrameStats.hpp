@@ -0,0 +1,151 @@
+#ifndef CS177_FRAME_STATS_HPP
+#define CS177_FRAME_STATS_HPP
+
+#include "Utility.hpp"
+#include <chrono>
+
+/********************
+ *
+ * GPU frame timing with ARB_timer_query.
+ *
+ * A small ring of GL_TIME_ELAPSED queries is kept in flight so reading a
+ * result never stalls the pipeline: poll() returns the oldest finished
+ * measurement, usually from a frame or two ago. GL_TIME_ELAPSED queries can't
+ * nest, so only one begin()/end() pair may be open at a time.
+ *
+ ********************/
+class GpuTimer {
+	enum { RING = 4 };
+	GLuint queries[RING];
+	bool pending[RING];
+	unsigned next, oldest;
+	bool active;
+public:
+	GpuTimer() : next(0), oldest(0), active(false) {
+	}
+
+	static bool supported() {
+		return GLEW_ARB_timer_query != 0;
+	}
+
+	void init() {
+		if ( !supported() )
+			return;
+		glGenQueries(RING, queries);
+		for ( int i = 0; i < RING; ++i )
+			pending[i] = false;
+		active = true;
+	}
+
+	//starts timing; skipped when every query in the ring is still waiting for a result
+	void begin() {
+		if ( !active || pending[next] )
+			return;
+		glBeginQuery(GL_TIME_ELAPSED, queries[next]);
+	}
+
+	void end() {
+		if ( !active || pending[next] )
+			return;
+		glEndQuery(GL_TIME_ELAPSED);
+		pending[next] = true;
+		next = (next + 1) % RING;
+	}
+
+	//true and the elapsed GPU time in ms if the oldest outstanding query has finished
+	bool poll(double &ms) {
+		if ( !active || !pending[oldest] )
+			return false;
+		GLint available = 0;
+		glGetQueryObjectiv(queries[oldest], GL_QUERY_RESULT_AVAILABLE, &available);
+		if ( !available )
+			return false;
+		GLuint64 ns = 0;
+		glGetQueryObjectui64v(queries[oldest], GL_QUERY_RESULT, &ns);
+		pending[oldest] = false;
+		oldest = (oldest + 1) % RING;
+		ms = ns / 1e6;
+		return true;
+	}
+
+	void destroy() {
+		if ( active )
+			glDeleteQueries(RING, queries);
+		active = false;
+	}
+};
+
+/********************
+ *
+ * Per-frame samples of one benchmark run, written out as a single JSON
+ * object per line so runs can be collected and diffed by scripts.
+ *
+ ********************/
+struct FrameSamples {
+	vector<double> cpuMs;      //CPU time to update and submit a frame
+	vector<double> wallMs;     //including waiting for the frame to finish
+	vector<double> gpuMs;      //from timer queries; may be shorter than the others
+	vector<double> drawCalls;
+	vector<double> heapAllocs; //per frame, when counted (see AllocationCounter.hpp)
+	vector<double> latencyMs;  //input to present, when pipelined (see FramePipeline.hpp)
+	unsigned pipelineDepth;
+
+	FrameSamples() : pipelineDepth(1) {
+	}
+
+	static void summary(FILE *f, const char *name, vector<double> v) {
+		if ( v.empty() ) {
+			fprintf(f, "\"%s\":null", name);
+			return;
+		}
+		sort(v.begin(), v.end());
+		double sum = 0;
+		for ( size_t i = 0; i < v.size(); ++i )
+			sum += v[i];
+		fprintf(f, "\"%s\":{\"mean\":%.4f,\"min\":%.4f,\"p50\":%.4f,\"p95\":%.4f,\"max\":%.4f}",
+		        name, sum / v.size(), v.front(), v[v.size() / 2], v[(v.size() * 95) / 100], v.back());
+	}
+
+	void clear() {
+		cpuMs.clear();
+		wallMs.clear();
+		gpuMs.clear();
+		drawCalls.clear();
+		heapAllocs.clear();
+		latencyMs.clear();
+	}
+
+	//so recording frames doesn't allocate
+	void reserve(size_t frames) {
+		cpuMs.reserve(frames);
+		wallMs.reserve(frames);
+		gpuMs.reserve(frames);
+		drawCalls.reserve(frames);
+		heapAllocs.reserve(frames);
+		latencyMs.reserve(frames);
+	}
+
+	void writeJson(FILE *f, const char *scene, const char *path, size_t nodes) const {
+		fprintf(f, "{\"scene\":\"%s\",\"path\":\"%s\",\"nodes\":%lu,\"frames\":%lu,\"pipeline_depth\":%u,",
+		        scene, path, (unsigned long) nodes, (unsigned long) cpuMs.size(), pipelineDepth);
+		summary(f, "cpu_ms", cpuMs);
+		fputc(',', f);
+		summary(f, "wall_ms", wallMs);
+		fputc(',', f);
+		summary(f, "gpu_ms", gpuMs);
+		fputc(',', f);
+		summary(f, "draw_calls", drawCalls);
+		fputc(',', f);
+		summary(f, "heap_allocs", heapAllocs);
+		fputc(',', f);
+		summary(f, "latency_ms", latencyMs);
+		fputs("}\n", f);
+		fflush(f);
+	}
+};
+
+inline double elapsedMs(const chrono::high_resolution_clock::time_point &since) {
+	return chrono::duration<double, milli>(chrono::high_resolution_clock::now() - since).count();
+}
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef CS177_HEADLESS_CONTEXT_HPP
+#define CS177_HEADLESS_CONTEXT_HPP
+
+#include "Utility.hpp"
+#include <GL/osmesa.h>
+
+/********************
+ *
+ * Offscreen OpenGL context on Mesa's software rasterizer (OSMesa), for
+ * running the renderer without a window or display, e.g. on CI boxes.
+ *
+ * GLEW has to be built with GLEW_OSMESA so glewInit() resolves entry points
+ * through OSMesaGetProcAddress. Rendering goes into a client-side RGBA buffer
+ * that pixels() exposes (bottom row first, like glReadPixels); there is no
+ * vsync, so frames run as fast as the rasterizer allows.
+ *
+ ********************/
+class HeadlessContext {
+	OSMesaContext ctx;
+	vector<GLubyte> buffer;
+	int w, h;
+public:
+	HeadlessContext() : ctx(0), w(0), h(0) {
+	}
+
+	bool create(int width, int height) {
+		w = width;
+		h = height;
+#ifdef OSMESA_CONTEXT_MAJOR_VERSION
+		//ask for a 3.3 compatibility profile so VAOs, instancing and timer queries are available
+		const int attribs[] = {
+			OSMESA_FORMAT, OSMESA_RGBA,
+			OSMESA_DEPTH_BITS, 24,
+			OSMESA_PROFILE, OSMESA_COMPAT_PROFILE,
+			OSMESA_CONTEXT_MAJOR_VERSION, 3,
+			OSMESA_CONTEXT_MINOR_VERSION, 3,
+			0
+		};
+		ctx = OSMesaCreateContextAttribs(attribs, NULL);
+#endif
+		if ( !ctx )
+			ctx = OSMesaCreateContextExt(OSMESA_RGBA, 24, 0, 0, NULL);
+		if ( !ctx ) {
+			cerr << "Unable to create OSMesa context!\n";
+			return false;
+		}
+		buffer.resize(w * h * 4);
+		if ( !OSMesaMakeCurrent(ctx, &buffer[0], GL_UNSIGNED_BYTE, w, h) ) {
+			cerr << "Unable to make OSMesa context current!\n";
+			destroy();
+			return false;
+		}
+		if ( glewInit() != GLEW_OK ) {
+			cerr << "Unable to hook OpenGL extensions!\n";
+			destroy();
+			return false;
+		}
+		cerr << "Headless renderer: " << glGetString(GL_RENDERER) << " (" << glGetString(GL_VERSION) << ")\n";
+		return true;
+	}
+
+	void destroy() {
+		if ( ctx )
+			OSMesaDestroyContext(ctx);
+		ctx = 0;
+	}
+
+	int width() const {
+		return w;
+	}
+
+	int height() const {
+		return h;
+	}
+
+	//makes sure all queued GL work has landed in the buffer
+	const GLubyte *pixels() {
+		glFinish();
+		return &buffer[0];
+	}
+
+	~HeadlessContext() {
+		destroy();
+	}
+};
+
+#endif
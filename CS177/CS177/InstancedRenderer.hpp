@@ -0,0 +1,181 @@
+#ifndef CS177_INSTANCED_RENDERER_HPP
+#define CS177_INSTANCED_RENDERER_HPP
+
+#include "FlatScene.hpp"
+#include "ShaderReloader.hpp"
+
+/********************
+ *
+ * Instanced drawing of a FlatScene.
+ *
+ * build() groups the scene's MeshNode entries by (mesh, primitive, line
+ * width), so every occurrence of the same geometry - e.g. the
+ * CoordinateFrameNode shared by five parents in createScene - lands in one
+ * group. upload() packs the world matrices of each group back to back into a
+ * per-instance attribute buffer, and draw() then issues one
+ * glDrawArraysInstanced per group for a viewport, with the model matrix read
+ * from the instanceTransform attribute of 2d_instanced.vsh. With a visibility
+ * mask from FlatScene::cull() only the visible instances are packed, so
+ * culling needs an upload per viewport.
+ *
+ * Groups are submitted in the order of their last occurrence in the scene, so
+ * repeated markers still end up on top of the nodes they are attached to.
+ * Needs ARB_instanced_arrays and ARB_draw_instanced; check supported().
+ *
+ ********************/
+class InstancedRenderer {
+	struct Group {
+		MeshNode *node;          //first occurrence, supplies the mesh and state
+		vector<size_t> entries;  //FlatScene entries drawn by this group
+		size_t lastEntry;
+		size_t firstInstance;    //offset into the instance buffer
+		size_t instanceCount;    //entries packed by the last upload()
+	};
+
+	static bool byLastEntry(const Group &a, const Group &b) {
+		return a.lastEntry < b.lastEntry;
+	}
+
+	GLuint program;
+	GLint uniformView;
+	GLuint instanceVbo;
+	vector<Group> groups;
+	vector<GLfloat> instanceData;
+	size_t drawCalls;
+
+public:
+	InstancedRenderer() : program(0), uniformView(-1), instanceVbo(0), drawCalls(0) {
+	}
+
+	static bool supported() {
+		return GLEW_ARB_instanced_arrays && GLEW_ARB_draw_instanced;
+	}
+
+	bool init(const char *vtxPath, const char *fragPath) {
+		if ( !supported() )
+			return false;
+		program = linkProgram(vtxPath, fragPath);
+		if ( !program )
+			return false;
+		uniformView = glGetUniformLocation(program, "viewTransform");
+		glGenBuffers(1, &instanceVbo);
+		return true;
+	}
+
+	bool ready() const {
+		return program != 0;
+	}
+
+	//reloads the program when its sources change
+	void watchShaders(ShaderReloader &reloader, const char *vtxPath, const char *fragPath) {
+		reloader.watchUniform(reloader.watch(program, vtxPath, fragPath), uniformView, "viewTransform");
+	}
+
+	//regroup after the scene's topology changed
+	void build(const FlatScene &scene) {
+		groups.clear();
+		map< pair< pair<Mesh*, GLenum>, GLfloat >, size_t > lookup;
+		for ( size_t i = 0; i < scene.size(); ++i ) {
+			MeshNode *node = dynamic_cast<MeshNode*>(scene.nodes[i]);
+			if ( !node )
+				continue;
+			const pair< pair<Mesh*, GLenum>, GLfloat > key(make_pair(node->getMesh(), node->primitive()), node->getLineWidth());
+			map< pair< pair<Mesh*, GLenum>, GLfloat >, size_t >::iterator it = lookup.find(key);
+			if ( it == lookup.end() ) {
+				it = lookup.insert(make_pair(key, groups.size())).first;
+				groups.push_back(Group());
+				groups.back().node = node;
+			}
+			groups[it->second].entries.push_back(i);
+			groups[it->second].lastEntry = i;
+		}
+		sort(groups.begin(), groups.end(), byLastEntry);
+
+		size_t instances = 0;
+		for ( size_t g = 0; g < groups.size(); ++g ) {
+			groups[g].firstInstance = instances;
+			groups[g].instanceCount = 0;
+			instances += groups[g].entries.size();
+		}
+		instanceData.resize(16 * instances);
+	}
+
+	//gathers the current world matrices of all entries, or only those marked in visible, and only of entries
+	//[begin, end) with a range; call after FlatScene::updateWorld and before each draw() whose visibility differs
+	void upload(const FlatScene &scene, const char *visible = 0, size_t begin = 0, size_t end = (size_t) -1) {
+		GLfloat *out = instanceData.empty() ? 0 : &instanceData[0];
+		size_t instances = 0;
+		for ( size_t g = 0; g < groups.size(); ++g ) {
+			const vector<size_t> &entries = groups[g].entries;
+			groups[g].firstInstance = instances;
+			size_t count = 0;
+			//entries were collected in scene order
+			const size_t last = lower_bound(entries.begin(), entries.end(), end) - entries.begin();
+			for ( size_t e = lower_bound(entries.begin(), entries.end(), begin) - entries.begin(); e < last; ++e ) {
+				if ( visible && !visible[entries[e]] )
+					continue;
+				memcpy(out, scene.world(entries[e]), sizeof(GLfloat) * 16);
+				out += 16;
+				++count;
+			}
+			groups[g].instanceCount = count;
+			instances += count;
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, instanceVbo);
+		//orphan the old storage so the driver doesn't wait on earlier draws
+		glBufferData(GL_ARRAY_BUFFER, instanceData.size() * sizeof(GLfloat), NULL, GL_STREAM_DRAW);
+		if ( instances )
+			glBufferSubData(GL_ARRAY_BUFFER, 0, 16 * instances * sizeof(GLfloat), &instanceData[0]);
+	}
+
+	//draws every group for one viewport; leaves the instanced program bound
+	void draw(const GLMatrix4 &viewTransform) {
+		glUseProgram(program);
+		glUniformMatrix4fv(uniformView, 1, false, viewTransform.mat);
+		drawCalls = 0;
+		for ( size_t g = 0; g < groups.size(); ++g ) {
+			const Group &group = groups[g];
+			if ( !group.instanceCount )
+				continue;
+			PROFILE_NODE(group.node->typeName());
+			Mesh *mesh = group.node->getMesh();
+			group.node->applyState();
+			mesh->bind();
+
+			glBindBuffer(GL_ARRAY_BUFFER, instanceVbo);
+			for ( int c = 0; c < 4; ++c ) {
+				const size_t offset = (16 * group.firstInstance + 4 * c) * sizeof(GLfloat);
+				glEnableVertexAttribArray(ATTRIB_MODEL + c);
+				glVertexAttribPointer(ATTRIB_MODEL + c, 4, GL_FLOAT, GL_FALSE, 16 * sizeof(GLfloat), (const GLvoid*) offset);
+				glVertexAttribDivisorARB(ATTRIB_MODEL + c, 1);
+			}
+			glDrawArraysInstancedARB(group.node->primitive(), 0, mesh->count, (GLsizei) group.instanceCount);
+			++drawCalls;
+
+			//keep the instance slots from leaking into non-instanced draws sharing this state
+			for ( int c = 0; c < 4; ++c ) {
+				glVertexAttribDivisorARB(ATTRIB_MODEL + c, 0);
+				glDisableVertexAttribArray(ATTRIB_MODEL + c);
+			}
+		}
+	}
+
+	size_t groupCount() const {
+		return groups.size();
+	}
+
+	size_t lastDrawCalls() const {
+		return drawCalls;
+	}
+
+	void destroy() {
+		if ( instanceVbo )
+			glDeleteBuffers(1, &instanceVbo);
+		if ( program )
+			glDeleteProgram(program);
+		instanceVbo = 0;
+		program = 0;
+	}
+};
+
+#endif
@@ -0,0 +1,209 @@
+#ifndef CS177_JOB_SYSTEM_HPP
+#define CS177_JOB_SYSTEM_HPP
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <cassert>
+
+/********************
+ *
+ * Work-stealing job system.
+ *
+ * ThreadPool runs one flat loop at a time. Scene updates instead produce
+ * jobs as they go (a subtree is split only once its root is done), so every
+ * thread here owns a queue: run() pushes onto the calling thread's queue, a
+ * thread pops its own newest job first and, when it runs dry, steals the
+ * oldest job of another thread. wait(group) doesn't block while the group
+ * has work queued anywhere; the waiting thread runs jobs itself.
+ *
+ * A job is a plain function pointer with a context and a range, and the
+ * queues are fixed-size rings, so scheduling never allocates. When a ring is
+ * full the job simply runs inline.
+ *
+ * threadIndex() is 0 on the thread that created the system (and on any
+ * thread that isn't a worker) and 1..size()-1 on the workers, so per-thread
+ * data can be kept in an array of size() entries. Only one thread may call
+ * run() and wait() from outside a job, normally the one that created the
+ * system; two threads that each need jobs at once need a system each.
+ *
+ ********************/
+struct JobGroup {
+	std::atomic<size_t> pending;
+
+	JobGroup() : pending(0) {
+	}
+};
+
+class JobSystem {
+public:
+	typedef void (*JobFunction)(void *context, size_t begin, size_t end);
+
+private:
+	struct Job {
+		JobFunction fn;
+		void *context;
+		size_t begin, end;
+		JobGroup *group;
+	};
+
+	enum { QUEUE_SIZE = 4096 };
+
+	struct Queue {
+		std::mutex lock;
+		Job jobs[QUEUE_SIZE];
+		size_t head, tail;       //the owner pushes and pops at tail, thieves take from head
+
+		Queue() : head(0), tail(0) {
+		}
+	};
+
+	std::vector<Queue*> queues;
+	std::vector<std::thread> workers;
+	std::atomic<size_t> queued;
+	std::atomic<size_t> steals;
+	std::mutex sleepLock;
+	std::condition_variable wake;
+	bool stopping;
+
+	static int &currentIndex() {
+		static thread_local int index = 0;
+		return index;
+	}
+
+	bool pop(size_t q, Job &job) {
+		Queue &queue = *queues[q];
+		std::lock_guard<std::mutex> guard(queue.lock);
+		if ( queue.head == queue.tail )
+			return false;
+		job = queue.jobs[--queue.tail % QUEUE_SIZE];
+		return true;
+	}
+
+	bool steal(size_t q, Job &job) {
+		Queue &queue = *queues[q];
+		std::lock_guard<std::mutex> guard(queue.lock);
+		if ( queue.head == queue.tail )
+			return false;
+		job = queue.jobs[queue.head++ % QUEUE_SIZE];
+		return true;
+	}
+
+	static void execute(const Job &job) {
+		job.fn(job.context, job.begin, job.end);
+		job.group->pending.fetch_sub(1, std::memory_order_release);
+	}
+
+	//runs one job from this thread's queue or, failing that, from another's
+	bool runOne() {
+		if ( queued.load(std::memory_order_acquire) == 0 )
+			return false;
+		const size_t self = (size_t) threadIndex();
+		Job job;
+		bool found = pop(self, job);
+		for ( size_t i = 1; !found && i < queues.size(); ++i )
+			if ( steal((self + i) % queues.size(), job) ) {
+				found = true;
+				steals.fetch_add(1, std::memory_order_relaxed);
+			}
+		if ( !found )
+			return false;
+		queued.fetch_sub(1, std::memory_order_relaxed);
+		execute(job);
+		return true;
+	}
+
+	void workerLoop(int index) {
+		currentIndex() = index;
+		for ( ;; ) {
+			if ( runOne() )
+				continue;
+			std::unique_lock<std::mutex> guard(sleepLock);
+			wake.wait(guard, [&] { return stopping || queued.load() > 0; });
+			if ( stopping )
+				return;
+		}
+	}
+
+	JobSystem(const JobSystem &);
+	JobSystem &operator=(const JobSystem &);
+
+public:
+	//threads counts the calling thread; 0 picks the hardware concurrency
+	explicit JobSystem(unsigned threads = 0) : queued(0), steals(0), stopping(false) {
+		if ( threads == 0 )
+			threads = std::max(1u, std::thread::hardware_concurrency());
+		for ( unsigned i = 0; i < threads; ++i )
+			queues.push_back(new Queue);
+		for ( unsigned i = 1; i < threads; ++i )
+			workers.push_back(std::thread(&JobSystem::workerLoop, this, (int) i));
+	}
+
+	~JobSystem() {
+		{
+			std::lock_guard<std::mutex> guard(sleepLock);
+			stopping = true;
+		}
+		wake.notify_all();
+		for ( size_t i = 0; i < workers.size(); ++i )
+			workers[i].join();
+		for ( size_t i = 0; i < queues.size(); ++i )
+			delete queues[i];
+	}
+
+	unsigned size() const {
+		return (unsigned) queues.size();
+	}
+
+	static int threadIndex() {
+		return currentIndex();
+	}
+
+	//queues fn(context, begin, end) as part of group
+	void run(JobGroup &group, JobFunction fn, void *context, size_t begin, size_t end) {
+		group.pending.fetch_add(1, std::memory_order_relaxed);
+		Job job = { fn, context, begin, end, &group };
+		if ( workers.empty() ) {
+			execute(job);
+			return;
+		}
+		{
+			//counted first and under the lock, so a worker can't see an empty system and go to sleep
+			//while the job is being pushed; a worker that wakes early just retries
+			std::lock_guard<std::mutex> guard(sleepLock);
+			queued.fetch_add(1, std::memory_order_release);
+		}
+		bool pushed = false;
+		{
+			Queue &queue = *queues[threadIndex()];
+			std::lock_guard<std::mutex> guard(queue.lock);
+			if ( queue.tail - queue.head < QUEUE_SIZE ) {
+				queue.jobs[queue.tail++ % QUEUE_SIZE] = job;
+				pushed = true;
+			}
+		}
+		if ( !pushed ) {
+			queued.fetch_sub(1, std::memory_order_relaxed);
+			execute(job);
+			return;
+		}
+		wake.notify_one();
+	}
+
+	//returns once every job of the group has finished, running queued jobs meanwhile
+	void wait(JobGroup &group) {
+		while ( group.pending.load(std::memory_order_acquire) != 0 )
+			if ( !runOne() )
+				std::this_thread::yield();
+	}
+
+	//jobs taken from another thread's queue since the system started
+	size_t stealCount() const {
+		return steals.load(std::memory_order_relaxed);
+	}
+};
+
+#endif
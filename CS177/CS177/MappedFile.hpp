@@ -0,0 +1,148 @@
+#ifndef CS177_MAPPED_FILE_HPP
+#define CS177_MAPPED_FILE_HPP
+
+#include <cstddef>
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/********************
+ *
+ * Read-only memory-mapped file.
+ *
+ * open() maps the whole file and data()/size() give the bytes in place, with
+ * no read() into a heap buffer; pages are only loaded when touched. The data
+ * is not NUL terminated. An empty file opens fine with size() 0 and data()
+ * 0. The mapping goes away with close() or the destructor. release() drops
+ * pages that were read and won't be needed soon (a no-op on Windows).
+ *
+ ********************/
+class MappedFile {
+	const char *bytes;
+	size_t length;
+#ifdef _WIN32
+	HANDLE file, mapping;
+#endif
+
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+
+public:
+#ifdef _WIN32
+	MappedFile() : bytes(0), length(0), file(INVALID_HANDLE_VALUE), mapping(0) {
+	}
+#else
+	MappedFile() : bytes(0), length(0) {
+	}
+#endif
+
+	explicit MappedFile(const char *path) : bytes(0), length(0) {
+#ifdef _WIN32
+		file = INVALID_HANDLE_VALUE;
+		mapping = 0;
+#endif
+		open(path);
+	}
+
+	~MappedFile() {
+		close();
+	}
+
+	//false if the file can't be opened or mapped
+	bool open(const char *path) {
+		close();
+#ifdef _WIN32
+		file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if ( file == INVALID_HANDLE_VALUE )
+			return false;
+		LARGE_INTEGER size;
+		if ( !GetFileSizeEx(file, &size) ) {
+			close();
+			return false;
+		}
+		length = (size_t) size.QuadPart;
+		if ( length ) {
+			mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if ( mapping )
+				bytes = (const char*) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			if ( !bytes ) {
+				close();
+				return false;
+			}
+		}
+		return true;
+#else
+		const int fd = ::open(path, O_RDONLY);
+		if ( fd < 0 )
+			return false;
+		struct stat st;
+		if ( fstat(fd, &st) != 0 ) {
+			::close(fd);
+			return false;
+		}
+		length = (size_t) st.st_size;
+		if ( length ) {
+			void *p = mmap(0, length, PROT_READ, MAP_PRIVATE, fd, 0);
+			if ( p == MAP_FAILED ) {
+				::close(fd);
+				length = 0;
+				return false;
+			}
+			bytes = (const char*) p;
+		}
+		//the mapping keeps the file alive
+		::close(fd);
+		return true;
+#endif
+	}
+
+	void close() {
+#ifdef _WIN32
+		if ( bytes )
+			UnmapViewOfFile(bytes);
+		if ( mapping )
+			CloseHandle(mapping);
+		if ( file != INVALID_HANDLE_VALUE )
+			CloseHandle(file);
+		mapping = 0;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if ( bytes )
+			munmap((void*) bytes, length);
+#endif
+		bytes = 0;
+		length = 0;
+	}
+
+	//lets the system drop the pages fully inside [offset, offset + size) from memory; the data stays readable
+	void release(size_t offset, size_t size) {
+#ifndef _WIN32
+		const size_t page = (size_t) sysconf(_SC_PAGESIZE);
+		const size_t last = offset + size < length ? offset + size : length;
+		const size_t begin = (offset + page - 1) / page * page, end = last / page * page;
+		if ( bytes && begin < end )
+			madvise((void*) (bytes + begin), end - begin, MADV_DONTNEED);
+#endif
+	}
+
+	const char *data() const {
+		return bytes;
+	}
+
+	size_t size() const {
+		return length;
+	}
+};
+
+#endif
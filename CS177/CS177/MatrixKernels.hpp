@@ -0,0 +1,110 @@
+#ifndef CS177_MATRIX_KERNELS_HPP
+#define CS177_MATRIX_KERNELS_HPP
+
+#include <cstddef>
+
+/********************
+ *
+ * 4x4 matrix product kernels.
+ *
+ * All matrices are 16 floats in OpenGL (column-major) order and the product is
+ * out = a * b, exactly like GLMatrix4::operator*. The SIMD paths accumulate
+ * every element in the same order as the scalar path
+ * ((a0*b0 + a1*b1) + a2*b2) + a3*b3, so with FMA contraction disabled the
+ * results are bit-for-bit identical.
+ *
+ * Define CS177_NO_SIMD to force the scalar path.
+ *
+ ********************/
+
+#if !defined(CS177_NO_SIMD)
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define CS177_USE_SSE 1
+#include <xmmintrin.h>
+#endif
+#if defined(__AVX__)
+#define CS177_USE_AVX 1
+#include <immintrin.h>
+#endif
+#endif
+
+inline void mat4MultiplyScalar(const float *a, const float *b, float *out) {
+	for ( int i = 0; i < 16; ++i ) {
+		const int r = i % 4, c = (i / 4) * 4;
+		out[i] = a[r]*b[c] + a[r+4]*b[c+1] + a[r+8]*b[c+2] + a[r+12]*b[c+3];
+	}
+}
+
+#ifdef CS177_USE_SSE
+inline void mat4MultiplySSE(const float *a, const float *b, float *out) {
+	const __m128 a0 = _mm_loadu_ps(a), a1 = _mm_loadu_ps(a + 4),
+	             a2 = _mm_loadu_ps(a + 8), a3 = _mm_loadu_ps(a + 12);
+	//out may alias a or b, so every column is computed before anything is stored
+	__m128 col[4];
+	for ( int c = 0; c < 4; ++c ) {
+		__m128 r = _mm_mul_ps(a0, _mm_set1_ps(b[4*c]));
+		r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(b[4*c+1])));
+		r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(b[4*c+2])));
+		r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(b[4*c+3])));
+		col[c] = r;
+	}
+	for ( int c = 0; c < 4; ++c )
+		_mm_storeu_ps(out + 4*c, col[c]);
+}
+#endif
+
+#ifdef CS177_USE_AVX
+//two output columns per instruction: the low lane holds column c, the high lane column c+1
+inline void mat4MultiplyAVX(const float *a, const float *b, float *out) {
+	const __m256 a0 = _mm256_broadcast_ps((const __m128*) a),
+	             a1 = _mm256_broadcast_ps((const __m128*) (a + 4)),
+	             a2 = _mm256_broadcast_ps((const __m128*) (a + 8)),
+	             a3 = _mm256_broadcast_ps((const __m128*) (a + 12));
+	const __m256 b01 = _mm256_loadu_ps(b), b23 = _mm256_loadu_ps(b + 8);
+
+	__m256 lo = _mm256_mul_ps(a0, _mm256_shuffle_ps(b01, b01, _MM_SHUFFLE(0,0,0,0)));
+	lo = _mm256_add_ps(lo, _mm256_mul_ps(a1, _mm256_shuffle_ps(b01, b01, _MM_SHUFFLE(1,1,1,1))));
+	lo = _mm256_add_ps(lo, _mm256_mul_ps(a2, _mm256_shuffle_ps(b01, b01, _MM_SHUFFLE(2,2,2,2))));
+	lo = _mm256_add_ps(lo, _mm256_mul_ps(a3, _mm256_shuffle_ps(b01, b01, _MM_SHUFFLE(3,3,3,3))));
+
+	__m256 hi = _mm256_mul_ps(a0, _mm256_shuffle_ps(b23, b23, _MM_SHUFFLE(0,0,0,0)));
+	hi = _mm256_add_ps(hi, _mm256_mul_ps(a1, _mm256_shuffle_ps(b23, b23, _MM_SHUFFLE(1,1,1,1))));
+	hi = _mm256_add_ps(hi, _mm256_mul_ps(a2, _mm256_shuffle_ps(b23, b23, _MM_SHUFFLE(2,2,2,2))));
+	hi = _mm256_add_ps(hi, _mm256_mul_ps(a3, _mm256_shuffle_ps(b23, b23, _MM_SHUFFLE(3,3,3,3))));
+
+	_mm256_storeu_ps(out, lo);
+	_mm256_storeu_ps(out + 8, hi);
+}
+#endif
+
+//out = a * b using the widest kernel available; out may alias a or b
+inline void mat4Multiply(const float *a, const float *b, float *out) {
+#if defined(CS177_USE_AVX)
+	mat4MultiplyAVX(a, b, out);
+#elif defined(CS177_USE_SSE)
+	mat4MultiplySSE(a, b, out);
+#else
+	float tmp[16];
+	mat4MultiplyScalar(a, b, tmp);
+	for ( int i = 0; i < 16; ++i )
+		out[i] = tmp[i];
+#endif
+}
+
+/********************
+ *
+ * Batch composition: out[i] = parents[i] * locals[i] for i in [0, n).
+ * Each array holds n tightly packed 16-float matrices.
+ *
+ ********************/
+inline void mat4MultiplyBatch(const float *parents, const float *locals, float *out, size_t n) {
+	for ( size_t i = 0; i < n; ++i )
+		mat4Multiply(parents + 16*i, locals + 16*i, out + 16*i);
+}
+
+inline void mat4MultiplyBatchScalar(const float *parents, const float *locals, float *out, size_t n) {
+	for ( size_t i = 0; i < n; ++i )
+		mat4MultiplyScalar(parents + 16*i, locals + 16*i, out + 16*i);
+}
+
+#endif
@@ -0,0 +1,290 @@
+#ifndef CS177_PARTICLE_FOUNTAIN_HPP
+#define CS177_PARTICLE_FOUNTAIN_HPP
+
+#include "Utility.hpp"
+#include "ShaderReloader.hpp"
+#include "FountainParticle.hpp"
+#include <deque>
+#include <chrono>
+#include <cstdlib>
+
+/********************
+ *
+ * Host side of the stateless particle fountain in fountain.vsh/fountain.fsh.
+ *
+ * The shader computes every particle's position from its start time and
+ * initial velocity, so a particle never has to be touched again once it is
+ * written. Particles therefore live in a fixed-capacity ring buffer in one
+ * VBO: update() only writes the slice spawned this frame (at most two ranges
+ * when it wraps), through glMapBufferRange when available and glBufferSubData
+ * otherwise. With a million live particles the per-frame cost is only the
+ * spawn bandwidth.
+ *
+ * Particles are spawned in time order, so the live ones are always the most
+ * recent ones before the head; draw() only draws that window. If
+ * rate * lifetime exceeds the capacity the oldest particles are recycled
+ * early.
+ *
+ * The particle attributes live in the fountain's own vertex array object, so
+ * drawing leaves the mesh VAOs alone; without ARB_vertex_array_object the
+ * ATTRIB_POS/ATTRIB_COLOR arrays the other paths expect are enabled again.
+ *
+ * beginStream()/endStream() let an external producer (see ParticleSim.hpp)
+ * replace the whole buffer each frame instead; don't mix them with update().
+ *
+ ********************/
+struct FountainStats {
+	size_t spawned;          //particles written in the last update()
+	size_t live;             //particles drawn
+	size_t bytesUploaded;    //in the last update()
+	double updateMs;         //CPU time of the last update(), generation plus upload
+};
+
+class ParticleFountain {
+	GLuint program, vbo, vao;
+	GLint uniformAccel, uniformT, uniformLifetime;
+	GLint attribStart, attribVelocity, attribColor;
+
+	size_t cap, head;
+	double rate, lifetime, spawnDebt, lastTime;
+	GLfloat accel[3];
+	deque< pair<double, size_t> > batches;   //(spawn time, count) per update, oldest first
+	size_t queued;                           //sum of the batch counts, may exceed the capacity
+	size_t live;
+	vector<FountainParticle> staging;
+	bool mappedStream;
+
+	void emit(FountainParticle &p, GLfloat startTime) {
+		const GLfloat rx = rand() / (GLfloat) RAND_MAX, ry = rand() / (GLfloat) RAND_MAX, rz = rand() / (GLfloat) RAND_MAX;
+		p.startTime = startTime;
+		p.velocity[0] = (rx - 0.5f) * 0.5f;
+		p.velocity[1] = 1.0f + ry * 0.5f;
+		p.velocity[2] = (rz - 0.5f) * 2.0f;
+		p.color = 0xFF000000 | (rand() & 0xFFFFFF);
+	}
+
+	void writeRange(size_t first, const FountainParticle *src, size_t count) {
+		const GLintptr offset = first * sizeof(FountainParticle);
+		const GLsizeiptr size = count * sizeof(FountainParticle);
+		if ( GLEW_ARB_map_buffer_range ) {
+			void *dst = glMapBufferRange(GL_ARRAY_BUFFER, offset, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+			if ( dst ) {
+				memcpy(dst, src, size);
+				glUnmapBuffer(GL_ARRAY_BUFFER);
+				return;
+			}
+		}
+		glBufferSubData(GL_ARRAY_BUFFER, offset, size, src);
+	}
+
+	void setAttribPointers(size_t first) const {
+		const size_t base = first * sizeof(FountainParticle);
+		glVertexAttribPointer(attribStart, 1, GL_FLOAT, GL_FALSE, sizeof(FountainParticle), (const GLvoid*) (base + offsetof(FountainParticle, startTime)));
+		glVertexAttribPointer(attribVelocity, 3, GL_FLOAT, GL_FALSE, sizeof(FountainParticle), (const GLvoid*) (base + offsetof(FountainParticle, velocity)));
+		glVertexAttribPointer(attribColor, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(FountainParticle), (const GLvoid*) (base + offsetof(FountainParticle, color)));
+	}
+
+public:
+	FountainStats stats;
+
+	ParticleFountain() : program(0), vbo(0), vao(0), cap(0), head(0), rate(10000), lifetime(2), spawnDebt(0), lastTime(-1), queued(0), live(0), mappedStream(false) {
+		accel[0] = 0, accel[1] = -1.5f, accel[2] = 0;
+		memset(&stats, 0, sizeof(stats));
+	}
+
+	bool init(size_t capacity, const char *vtxPath, const char *fragPath) {
+		program = linkProgram(vtxPath, fragPath);
+		if ( !program )
+			return false;
+		uniformAccel = glGetUniformLocation(program, "accel");
+		uniformT = glGetUniformLocation(program, "t");
+		uniformLifetime = glGetUniformLocation(program, "lifetime");
+		attribStart = glGetAttribLocation(program, "startTime");
+		attribVelocity = glGetAttribLocation(program, "initialVelocity");
+		attribColor = glGetAttribLocation(program, "color");
+
+		cap = capacity;
+		head = 0;
+		queued = 0;
+		live = 0;
+		lastTime = -1;
+		spawnDebt = 0;
+		batches.clear();
+		glGenBuffers(1, &vbo);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBufferData(GL_ARRAY_BUFFER, cap * sizeof(FountainParticle), NULL, GL_DYNAMIC_DRAW);
+		if ( GLEW_ARB_vertex_array_object )
+			glGenVertexArrays(1, &vao);
+		return true;
+	}
+
+	//reloads the program when its sources change
+	void watchShaders(ShaderReloader &reloader, const char *vtxPath, const char *fragPath) {
+		const size_t id = reloader.watch(program, vtxPath, fragPath);
+		reloader.watchUniform(id, uniformAccel, "accel");
+		reloader.watchUniform(id, uniformT, "t");
+		reloader.watchUniform(id, uniformLifetime, "lifetime");
+		reloader.watchAttribute(id, attribStart, "startTime");
+		reloader.watchAttribute(id, attribVelocity, "initialVelocity");
+		reloader.watchAttribute(id, attribColor, "color");
+	}
+
+	void setEmissionRate(double particlesPerSecond) {
+		rate = particlesPerSecond;
+	}
+
+	void setLifetime(double seconds) {
+		lifetime = seconds;
+	}
+
+	void setAcceleration(GLfloat x, GLfloat y, GLfloat z) {
+		accel[0] = x, accel[1] = y, accel[2] = z;
+	}
+
+	size_t capacity() const {
+		return cap;
+	}
+
+	double emissionRate() const {
+		return rate;
+	}
+
+	//spawns the particles due since the last call and uploads only those
+	void update(double now) {
+		const chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		if ( lastTime < 0 )
+			lastTime = now;
+		const double dt = now - lastTime;
+		spawnDebt += rate * dt;
+		size_t count = (size_t) spawnDebt;
+		spawnDebt -= count;
+		count = min(count, cap);
+
+		//spread the start times over the frame so emission doesn't come out in pulses
+		staging.resize(count);
+		for ( size_t i = 0; i < count; ++i )
+			emit(staging[i], (GLfloat) (lastTime + dt * (i + 1) / count));
+
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		const size_t firstPart = min(count, cap - head);
+		if ( firstPart )
+			writeRange(head, &staging[0], firstPart);
+		if ( count > firstPart )
+			writeRange(0, &staging[firstPart], count - firstPart);
+		head = (head + count) % cap;
+
+		if ( count )
+			batches.push_back(make_pair(now, count));
+		queued += count;
+		//retire whole batches once their newest particle is older than the lifetime
+		while ( !batches.empty() && now - batches.front().first > lifetime ) {
+			queued -= batches.front().second;
+			batches.pop_front();
+		}
+		live = min(queued, cap);
+		lastTime = now;
+
+		stats.spawned = count;
+		stats.live = live;
+		stats.bytesUploaded = count * sizeof(FountainParticle);
+		stats.updateMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+	}
+
+	//returns storage for count particles, mapped straight from the VBO when possible
+	FountainParticle *beginStream(size_t count) {
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		if ( count > cap ) {
+			cap = count;
+			glBufferData(GL_ARRAY_BUFFER, cap * sizeof(FountainParticle), NULL, GL_DYNAMIC_DRAW);
+		}
+		if ( GLEW_ARB_map_buffer_range && count ) {
+			void *dst = glMapBufferRange(GL_ARRAY_BUFFER, 0, count * sizeof(FountainParticle), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+			if ( dst ) {
+				mappedStream = true;
+				return (FountainParticle*) dst;
+			}
+		}
+		mappedStream = false;
+		staging.resize(max<size_t>(count, 1));
+		return &staging[0];
+	}
+
+	//makes the count particles written since beginStream() the live set
+	void endStream(size_t count) {
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		if ( mappedStream )
+			glUnmapBuffer(GL_ARRAY_BUFFER);
+		else if ( count )
+			glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(FountainParticle), &staging[0]);
+		mappedStream = false;
+		batches.clear();
+		head = cap ? count % cap : 0;
+		queued = live = count;
+
+		stats.spawned = count;
+		stats.live = live;
+		stats.bytesUploaded = count * sizeof(FountainParticle);
+	}
+
+	const GLfloat *acceleration() const {
+		return accel;
+	}
+
+	void draw(double now) {
+		if ( !live )
+			return;
+		glUseProgram(program);
+		glUniform3fv(uniformAccel, 1, accel);
+		glUniform1f(uniformT, (GLfloat) now);
+		glUniform1f(uniformLifetime, (GLfloat) lifetime);
+
+		glEnable(GL_VERTEX_PROGRAM_POINT_SIZE);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+
+		if ( vao )
+			glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glEnableVertexAttribArray(attribStart);
+		glEnableVertexAttribArray(attribVelocity);
+		glEnableVertexAttribArray(attribColor);
+		//the live window ends at head and may wrap around the end of the buffer
+		const size_t oldest = (head + cap - live) % cap;
+		if ( oldest < head || head == 0 ) {
+			setAttribPointers(oldest);
+			glDrawArrays(GL_POINTS, 0, live);
+		} else {
+			setAttribPointers(oldest);
+			glDrawArrays(GL_POINTS, 0, cap - oldest);
+			setAttribPointers(0);
+			glDrawArrays(GL_POINTS, 0, head);
+		}
+		glDisableVertexAttribArray(attribStart);
+		glDisableVertexAttribArray(attribVelocity);
+		glDisableVertexAttribArray(attribColor);
+		if ( vao ) {
+			glBindVertexArray(0);
+		} else {
+			//attribColor is ATTRIB_COLOR, and the meshes draw from the default state
+			glEnableVertexAttribArray(ATTRIB_POS);
+			glEnableVertexAttribArray(ATTRIB_COLOR);
+		}
+
+		glDisable(GL_BLEND);
+		glDisable(GL_VERTEX_PROGRAM_POINT_SIZE);
+	}
+
+	void destroy() {
+		if ( vbo )
+			glDeleteBuffers(1, &vbo);
+		if ( vao )
+			glDeleteVertexArrays(1, &vao);
+		if ( program )
+			glDeleteProgram(program);
+		vbo = 0;
+		vao = 0;
+		program = 0;
+	}
+};
+
+#endif
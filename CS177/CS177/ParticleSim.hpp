@@ -0,0 +1,162 @@
+#ifndef CS177_PARTICLE_SIM_HPP
+#define CS177_PARTICLE_SIM_HPP
+
+#include "FountainParticle.hpp"
+#include "MatrixKernels.hpp"
+#include "ThreadPool.hpp"
+
+/********************
+ *
+ * CPU particle simulation, for effects the closed-form motion in
+ * fountain.vsh can't express: per-particle drag and bouncing off a floor.
+ *
+ * Particles are stored as structure-of-arrays (one array per component) and
+ * integrated four at a time with SSE (scalar elsewhere) in chunks spread over
+ * a ThreadPool. The particle count is fixed: a particle that outlives its
+ * lifetime is re-emitted at the origin.
+ *
+ * writeFountainLayout() streams the state into FountainParticle records that
+ * the unmodified fountain shader reproduces exactly: with age = t - startTime
+ * it draws age * (0.5 * age * accel + v), so the velocity is written as
+ * pos / age - 0.5 * age * accel. Fading and point size then behave as for the
+ * GPU-only fountain.
+ *
+ ********************/
+class ParticleSim {
+	std::vector<float> px, py, pz;
+	std::vector<float> vx, vy, vz;
+	std::vector<float> drag;          //per-particle linear drag coefficient
+	std::vector<float> startTime;
+	std::vector<unsigned> color;
+
+	static unsigned xorshift(unsigned &state) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+
+	static float unit(unsigned &state) {
+		return (xorshift(state) & 0xFFFFFF) / (float) 0x1000000;
+	}
+
+	void emit(size_t i, float now, unsigned &rng) {
+		px[i] = py[i] = pz[i] = 0;
+		vx[i] = (unit(rng) - 0.5f) * 0.5f;
+		vy[i] = 1.0f + unit(rng) * 0.5f;
+		vz[i] = (unit(rng) - 0.5f) * 2.0f;
+		drag[i] = unit(rng) * 0.8f;
+		startTime[i] = now;
+		color[i] = 0xFF000000 | (xorshift(rng) & 0xFFFFFF);
+	}
+
+	//the same expressions as the SSE lanes, so both paths give the same particles
+	void integrateScalar(size_t i, float dt) {
+		const float kd = drag[i] * dt;
+		vx[i] += gravity[0] * dt - kd * vx[i];
+		vy[i] += gravity[1] * dt - kd * vy[i];
+		vz[i] += gravity[2] * dt - kd * vz[i];
+		px[i] += vx[i] * dt;
+		py[i] += vy[i] * dt;
+		pz[i] += vz[i] * dt;
+		if ( py[i] < floorY ) {
+			py[i] = floorY + (floorY - py[i]) * restitution;
+			vy[i] = -vy[i] * restitution;
+		}
+	}
+
+	void stepRange(size_t begin, size_t end, float now, float dt) {
+		//re-emit expired particles first; the seed only depends on the range and time
+		unsigned rng = (unsigned) (begin * 2654435761u) ^ (unsigned) (now * 1000) ^ 0x9E3779B9u;
+		if ( !rng ) rng = 1;
+		for ( size_t i = begin; i < end; ++i )
+			if ( now - startTime[i] > lifetime )
+				emit(i, now, rng);
+
+		size_t i = begin;
+#ifdef CS177_USE_SSE
+		const __m128 vdt = _mm_set1_ps(dt), gx = _mm_set1_ps(gravity[0] * dt),
+		             gy = _mm_set1_ps(gravity[1] * dt), gz = _mm_set1_ps(gravity[2] * dt),
+		             vfloor = _mm_set1_ps(floorY), vrest = _mm_set1_ps(restitution),
+		             sign = _mm_set1_ps(-0.0f);
+		for ( ; i + 4 <= end; i += 4 ) {
+			const __m128 kd = _mm_mul_ps(_mm_loadu_ps(&drag[i]), vdt);
+			__m128 x = _mm_loadu_ps(&vx[i]), y = _mm_loadu_ps(&vy[i]), z = _mm_loadu_ps(&vz[i]);
+			x = _mm_add_ps(x, _mm_sub_ps(gx, _mm_mul_ps(kd, x)));
+			y = _mm_add_ps(y, _mm_sub_ps(gy, _mm_mul_ps(kd, y)));
+			z = _mm_add_ps(z, _mm_sub_ps(gz, _mm_mul_ps(kd, z)));
+			const __m128 nx = _mm_add_ps(_mm_loadu_ps(&px[i]), _mm_mul_ps(x, vdt));
+			__m128 ny = _mm_add_ps(_mm_loadu_ps(&py[i]), _mm_mul_ps(y, vdt));
+			const __m128 nz = _mm_add_ps(_mm_loadu_ps(&pz[i]), _mm_mul_ps(z, vdt));
+
+			//lanes below the floor are reflected back up and lose energy
+			const __m128 below = _mm_cmplt_ps(ny, vfloor);
+			const __m128 bouncedY = _mm_add_ps(vfloor, _mm_mul_ps(_mm_sub_ps(vfloor, ny), vrest));
+			const __m128 bouncedV = _mm_xor_ps(_mm_mul_ps(y, vrest), sign);
+			ny = _mm_or_ps(_mm_and_ps(below, bouncedY), _mm_andnot_ps(below, ny));
+			y = _mm_or_ps(_mm_and_ps(below, bouncedV), _mm_andnot_ps(below, y));
+
+			_mm_storeu_ps(&vx[i], x);
+			_mm_storeu_ps(&vy[i], y);
+			_mm_storeu_ps(&vz[i], z);
+			_mm_storeu_ps(&px[i], nx);
+			_mm_storeu_ps(&py[i], ny);
+			_mm_storeu_ps(&pz[i], nz);
+		}
+#endif
+		for ( ; i < end; ++i )
+			integrateScalar(i, dt);
+	}
+
+public:
+	float gravity[3];
+	float floorY;
+	float restitution;
+	float lifetime;
+	size_t grain;                //particles per parallel chunk
+
+	ParticleSim() : floorY(-0.8f), restitution(0.6f), lifetime(3), grain(16384) {
+		gravity[0] = 0, gravity[1] = -1.5f, gravity[2] = 0;
+	}
+
+	//count particles with start times staggered over one lifetime so they don't expire together
+	void init(size_t count, float now) {
+		px.assign(count, 0); py.assign(count, 0); pz.assign(count, 0);
+		vx.assign(count, 0); vy.assign(count, 0); vz.assign(count, 0);
+		drag.assign(count, 0);
+		startTime.assign(count, 0);
+		color.assign(count, 0);
+		unsigned rng = 12345;
+		for ( size_t i = 0; i < count; ++i ) {
+			emit(i, now, rng);
+			startTime[i] = now - lifetime * i / (float) count;
+		}
+	}
+
+	size_t size() const {
+		return px.size();
+	}
+
+	void step(ThreadPool &pool, float now, float dt) {
+		pool.parallelFor(size(), grain, [&](size_t begin, size_t end) {
+			stepRange(begin, end, now, dt);
+		});
+	}
+
+	//accel must match the accel uniform the fountain program is drawn with
+	void writeFountainLayout(ThreadPool &pool, FountainParticle *out, float now, const float accel[3]) const {
+		pool.parallelFor(size(), grain, [&](size_t begin, size_t end) {
+			for ( size_t i = begin; i < end; ++i ) {
+				const float age = std::max(now - startTime[i], 1e-3f);
+				const float k = 0.5f * age;
+				out[i].startTime = now - age;
+				out[i].velocity[0] = px[i] / age - k * accel[0];
+				out[i].velocity[1] = py[i] / age - k * accel[1];
+				out[i].velocity[2] = pz[i] / age - k * accel[2];
+				out[i].color = color[i];
+			}
+		});
+	}
+};
+
+#endif
@@ -0,0 +1,307 @@
+#ifndef CS177_PROFILER_HPP
+#define CS177_PROFILER_HPP
+
+/********************
+ *
+ * Scoped-zone frame profiler.
+ *
+ * Compiled in only with CS177_PROFILE defined; otherwise every PROFILE_*
+ * macro expands to nothing (macro arguments aren't even evaluated), so the
+ * instrumentation can stay in the hot paths.
+ *
+ *   PROFILE_ZONE("name")      CPU time of the enclosing scope
+ *   PROFILE_GPU_ZONE("name")  the same plus GPU time, from a pair of
+ *                             GL_TIMESTAMP queries (these nest, unlike
+ *                             GL_TIME_ELAPSED)
+ *   PROFILE_NODE(typeName)    CPU draw time of one node, summed per node
+ *                             type over the frame
+ *   PROFILE_FRAME_END()       once per frame, outside any zone
+ *   PROFILE_WRITE_TRACE(path) Chrome trace-event JSON (chrome://tracing or
+ *                             ui.perfetto.dev)
+ *
+ * Names must be static strings; only the pointer is stored. Memory is fixed:
+ * events go into a ring of EVENT_CAPACITY entries that overwrites the oldest
+ * ones, and at most GPU_ZONES GPU zones wait for their results at a time
+ * (further ones are dropped and counted). GPU results are collected a few
+ * frames late at PROFILE_FRAME_END() so the queries never stall. Zones must
+ * be opened and closed on the thread that owns the GL context.
+ *
+ ********************/
+#ifdef CS177_PROFILE
+
+#include "Utility.hpp"
+#include <chrono>
+
+struct ProfileEvent {
+	const char *name;
+	double start;          //us since the profiler was created
+	double duration;       //us
+	unsigned calls;        //node type totals: draws summed into duration
+	unsigned char kind;
+};
+
+class Profiler {
+public:
+	enum { EVENT_CAPACITY = 1 << 16, MAX_DEPTH = 32, GPU_ZONES = 256 };
+	enum { KIND_CPU, KIND_GPU, KIND_NODE_TYPE };
+
+private:
+	chrono::high_resolution_clock::time_point origin;
+	vector<ProfileEvent> events;   //ring
+	size_t head, count, dropped;
+
+	//open CPU zones
+	const char *openNames[MAX_DEPTH];
+	double openStarts[MAX_DEPTH];
+	int depth;
+
+	//draw time per node type for the current frame
+	struct NodeTypeTime {
+		const char *type;
+		double us;
+		unsigned calls;
+	};
+	vector<NodeTypeTime> nodeTimes;
+	double frameStart;
+
+	//GPU zones waiting for their timestamps, oldest at gpuHead
+	struct GpuZone {
+		const char *name;
+		GLuint queries[2];
+		bool ended;
+	};
+	int gpuState;                  //0 not initialized yet, 1 active, -1 unsupported
+	GpuZone gpuZones[GPU_ZONES];
+	size_t gpuHead, gpuPending, gpuDropped;
+	int gpuOpen[MAX_DEPTH];        //slot of each open GPU zone, -1 if dropped
+	int gpuDepth;
+	GLint64 gpuOrigin;             //GPU timestamp taken at cpuAtGpuOrigin
+	double cpuAtGpuOrigin;
+
+	Profiler() : head(0), count(0), dropped(0), depth(0), frameStart(0), gpuState(0), gpuHead(0), gpuPending(0), gpuDropped(0), gpuDepth(0), gpuOrigin(0), cpuAtGpuOrigin(0) {
+		origin = chrono::high_resolution_clock::now();
+		events.resize(EVENT_CAPACITY);
+	}
+
+	void push(const char *name, double start, double duration, unsigned calls, unsigned char kind) {
+		ProfileEvent &e = events[(head + count) % EVENT_CAPACITY];
+		if ( count == EVENT_CAPACITY ) {
+			head = (head + 1) % EVENT_CAPACITY;
+			++dropped;
+		} else
+			++count;
+		e.name = name;
+		e.start = start;
+		e.duration = duration;
+		e.calls = calls;
+		e.kind = kind;
+	}
+
+	bool gpuReady() {
+		if ( gpuState == 0 ) {
+			gpuState = GLEW_ARB_timer_query ? 1 : -1;
+			if ( gpuState > 0 ) {
+				for ( int i = 0; i < GPU_ZONES; ++i )
+					glGenQueries(2, gpuZones[i].queries);
+				//line the GPU clock up with ours once; drift over a run is negligible
+				glGetInteger64v(GL_TIMESTAMP, &gpuOrigin);
+				cpuAtGpuOrigin = now();
+			}
+		}
+		return gpuState > 0;
+	}
+
+	//turns finished GPU zones into events, oldest first; waits for them if block is set
+	void resolveGpu(bool block) {
+		while ( gpuPending ) {
+			GpuZone &zone = gpuZones[gpuHead];
+			if ( !zone.ended )
+				return;
+			GLint available = 1;
+			if ( !block )
+				glGetQueryObjectiv(zone.queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+			if ( !available )
+				return;
+			GLuint64 begin = 0, end = 0;
+			glGetQueryObjectui64v(zone.queries[0], GL_QUERY_RESULT, &begin);
+			glGetQueryObjectui64v(zone.queries[1], GL_QUERY_RESULT, &end);
+			push(zone.name, cpuAtGpuOrigin + ((GLint64) begin - gpuOrigin) / 1000.0, (end - begin) / 1000.0, 0, KIND_GPU);
+			gpuHead = (gpuHead + 1) % GPU_ZONES;
+			--gpuPending;
+		}
+	}
+
+	static void writeName(FILE *f, const char *name) {
+		fputc('"', f);
+		for ( ; *name; ++name ) {
+			if ( *name == '"' || *name == '\\' )
+				fputc('\\', f);
+			fputc(*name, f);
+		}
+		fputc('"', f);
+	}
+
+public:
+	static Profiler &instance() {
+		static Profiler profiler;
+		return profiler;
+	}
+
+	//us since the profiler was created
+	double now() const {
+		return chrono::duration<double, micro>(chrono::high_resolution_clock::now() - origin).count();
+	}
+
+	void beginZone(const char *name) {
+		if ( depth < MAX_DEPTH ) {
+			openNames[depth] = name;
+			openStarts[depth] = now();
+		}
+		++depth;
+	}
+
+	void endZone() {
+		assert(depth > 0);
+		if ( --depth < MAX_DEPTH ) {
+			const double start = openStarts[depth];
+			push(openNames[depth], start, now() - start, 0, KIND_CPU);
+		}
+	}
+
+	void beginGpuZone(const char *name) {
+		int slot = -1;
+		if ( gpuReady() && gpuPending < GPU_ZONES ) {
+			slot = (int) ((gpuHead + gpuPending) % GPU_ZONES);
+			++gpuPending;
+			gpuZones[slot].name = name;
+			gpuZones[slot].ended = false;
+			glQueryCounter(gpuZones[slot].queries[0], GL_TIMESTAMP);
+		} else if ( gpuState > 0 )
+			++gpuDropped;
+		if ( gpuDepth < MAX_DEPTH )
+			gpuOpen[gpuDepth] = slot;
+		++gpuDepth;
+	}
+
+	void endGpuZone() {
+		assert(gpuDepth > 0);
+		if ( --gpuDepth >= MAX_DEPTH || gpuOpen[gpuDepth] < 0 )
+			return;
+		GpuZone &zone = gpuZones[gpuOpen[gpuDepth]];
+		glQueryCounter(zone.queries[1], GL_TIMESTAMP);
+		zone.ended = true;
+	}
+
+	void addNodeTime(const char *type, double us) {
+		//a handful of node types, so a linear search beats a map
+		for ( size_t i = 0; i < nodeTimes.size(); ++i )
+			if ( nodeTimes[i].type == type ) {
+				nodeTimes[i].us += us;
+				++nodeTimes[i].calls;
+				return;
+			}
+		NodeTypeTime t = { type, us, 1 };
+		nodeTimes.push_back(t);
+	}
+
+	//emits the per node type totals and collects whatever GPU results are ready
+	void endFrame() {
+		for ( size_t i = 0; i < nodeTimes.size(); ++i )
+			push(nodeTimes[i].type, frameStart, nodeTimes[i].us, nodeTimes[i].calls, KIND_NODE_TYPE);
+		nodeTimes.clear();
+		if ( gpuState > 0 )
+			resolveGpu(false);
+		frameStart = now();
+	}
+
+	size_t eventCount() const {
+		return count;
+	}
+
+	//events overwritten because the ring was full
+	size_t droppedEvents() const {
+		return dropped;
+	}
+
+	//GPU zones skipped because GPU_ZONES queries were already in flight
+	size_t droppedGpuZones() const {
+		return gpuDropped;
+	}
+
+	//CPU zones on thread 1, GPU zones on thread 2, node type totals as counters
+	bool writeChromeTrace(const char *path) {
+		if ( gpuState > 0 )
+			resolveGpu(true);
+		FILE *f = fopen(path, "w");
+		if ( !f ) {
+			cerr << "Unable to write trace " << path << "\n";
+			return false;
+		}
+		fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", f);
+		fputs("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n", f);
+		fputs("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}", f);
+		for ( size_t i = 0; i < count; ++i ) {
+			const ProfileEvent &e = events[(head + i) % EVENT_CAPACITY];
+			fputs(",\n{\"name\":", f);
+			writeName(f, e.name);
+			if ( e.kind == KIND_NODE_TYPE )
+				fprintf(f, ",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"args\":{\"draw_us\":%.3f,\"draws\":%u}}", e.start, e.duration, e.calls);
+			else
+				fprintf(f, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}", e.start, e.duration, e.kind == KIND_GPU ? 2 : 1);
+		}
+		fprintf(f, "\n],\"otherData\":{\"droppedEvents\":%lu,\"droppedGpuZones\":%lu}}\n", (unsigned long) dropped, (unsigned long) gpuDropped);
+		fclose(f);
+		return true;
+	}
+};
+
+struct ProfileZone {
+	explicit ProfileZone(const char *name) {
+		Profiler::instance().beginZone(name);
+	}
+	~ProfileZone() {
+		Profiler::instance().endZone();
+	}
+};
+
+struct GpuProfileZone {
+	explicit GpuProfileZone(const char *name) {
+		Profiler::instance().beginZone(name);
+		Profiler::instance().beginGpuZone(name);
+	}
+	~GpuProfileZone() {
+		Profiler::instance().endGpuZone();
+		Profiler::instance().endZone();
+	}
+};
+
+struct ProfileNodeScope {
+	const char *type;
+	double start;
+	explicit ProfileNodeScope(const char *type) : type(type), start(Profiler::instance().now()) {
+	}
+	~ProfileNodeScope() {
+		Profiler &p = Profiler::instance();
+		p.addNodeTime(type, p.now() - start);
+	}
+};
+
+#define CS177_PROFILE_CONCAT2(a, b) a##b
+#define CS177_PROFILE_CONCAT(a, b) CS177_PROFILE_CONCAT2(a, b)
+#define PROFILE_ZONE(name) ProfileZone CS177_PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_GPU_ZONE(name) GpuProfileZone CS177_PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_NODE(type) ProfileNodeScope CS177_PROFILE_CONCAT(profileNode, __LINE__)(type)
+#define PROFILE_FRAME_END() Profiler::instance().endFrame()
+#define PROFILE_WRITE_TRACE(path) Profiler::instance().writeChromeTrace(path)
+
+#else
+
+#define PROFILE_ZONE(name) ((void) 0)
+#define PROFILE_GPU_ZONE(name) ((void) 0)
+#define PROFILE_NODE(type) ((void) 0)
+#define PROFILE_FRAME_END() ((void) 0)
+#define PROFILE_WRITE_TRACE(path) ((void) 0)
+
+#endif
+
+#endif
@@ -0,0 +1,196 @@
+#ifndef CS177_QUATERNION_HPP
+#define CS177_QUATERNION_HPP
+
+#include <cmath>
+#include <cstddef>
+#include "MatrixKernels.hpp"
+
+#if defined(CS177_USE_SSE) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define CS177_USE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+/********************
+ *
+ * Batched sine and cosine.
+ *
+ * sincosBatch() evaluates n angles four at a time: reduce to [-pi/4, pi/4]
+ * around the nearest multiple of pi/2 (three-part Cody-Waite, so the error
+ * stays around 1e-7 for |angle| up to a few thousand radians), evaluate the
+ * Cephes minimax polynomials for both functions and swap/negate by quadrant.
+ * There are no branches and no libm calls. The scalar fallback runs the same
+ * steps one angle at a time.
+ *
+ ********************/
+namespace sincos_detail {
+	const float TWO_OVER_PI = 0.636619772367581343f;
+	const float DP1 = 1.5703125f, DP2 = 4.837512969970703125e-4f, DP3 = 7.54978995489188216e-8f;
+	const float S1 = -1.6666654611e-1f, S2 = 8.3321608736e-3f, S3 = -1.9515295891e-4f;
+	const float C1 = 4.166664568298827e-2f, C2 = -1.388731625493765e-3f, C3 = 2.443315711809948e-5f;
+
+	inline void sincosScalar(float angle, float &s, float &c) {
+		const float q = angle * TWO_OVER_PI;
+		const int k = (int) (q < 0 ? q - 0.5f : q + 0.5f);
+		const float r = ((angle - k * DP1) - k * DP2) - k * DP3;
+		const float r2 = r * r;
+		const float ps = r + r * r2 * (S1 + r2 * (S2 + r2 * S3));
+		const float pc = 1 - 0.5f * r2 + r2 * r2 * (C1 + r2 * (C2 + r2 * C3));
+		const bool swap = (k & 1) != 0;
+		s = swap ? pc : ps;
+		c = swap ? ps : pc;
+		if ( k & 2 )
+			s = -s;
+		if ( (k + 1) & 2 )
+			c = -c;
+	}
+}
+
+inline void sincosBatch(const float *angles, float *sines, float *cosines, size_t n) {
+	using namespace sincos_detail;
+	size_t i = 0;
+#ifdef CS177_USE_SSE2
+	const __m128i one = _mm_set1_epi32(1), two = _mm_set1_epi32(2);
+	const __m128 signBit = _mm_set1_ps(-0.0f);
+	for ( ; i + 4 <= n; i += 4 ) {
+		const __m128 x = _mm_loadu_ps(angles + i);
+		//nearest quadrant; the default rounding mode rounds to nearest
+		const __m128i k = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(TWO_OVER_PI)));
+		const __m128 kf = _mm_cvtepi32_ps(k);
+		__m128 r = _mm_sub_ps(x, _mm_mul_ps(kf, _mm_set1_ps(DP1)));
+		r = _mm_sub_ps(r, _mm_mul_ps(kf, _mm_set1_ps(DP2)));
+		r = _mm_sub_ps(r, _mm_mul_ps(kf, _mm_set1_ps(DP3)));
+		const __m128 r2 = _mm_mul_ps(r, r);
+
+		__m128 ps = _mm_add_ps(_mm_set1_ps(S2), _mm_mul_ps(r2, _mm_set1_ps(S3)));
+		ps = _mm_add_ps(_mm_set1_ps(S1), _mm_mul_ps(r2, ps));
+		ps = _mm_add_ps(r, _mm_mul_ps(_mm_mul_ps(r, r2), ps));
+		__m128 pc = _mm_add_ps(_mm_set1_ps(C2), _mm_mul_ps(r2, _mm_set1_ps(C3)));
+		pc = _mm_add_ps(_mm_set1_ps(C1), _mm_mul_ps(r2, pc));
+		pc = _mm_add_ps(_mm_sub_ps(_mm_set1_ps(1), _mm_mul_ps(_mm_set1_ps(0.5f), r2)), _mm_mul_ps(_mm_mul_ps(r2, r2), pc));
+
+		const __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(k, one), one));
+		__m128 s = _mm_or_ps(_mm_and_ps(swap, pc), _mm_andnot_ps(swap, ps));
+		__m128 c = _mm_or_ps(_mm_and_ps(swap, ps), _mm_andnot_ps(swap, pc));
+		const __m128 negateS = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(k, two), two));
+		const __m128 negateC = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_add_epi32(k, one), two), two));
+		s = _mm_xor_ps(s, _mm_and_ps(negateS, signBit));
+		c = _mm_xor_ps(c, _mm_and_ps(negateC, signBit));
+		_mm_storeu_ps(sines + i, s);
+		_mm_storeu_ps(cosines + i, c);
+	}
+#endif
+	for ( ; i < n; ++i )
+		sincosScalar(angles[i], sines[i], cosines[i]);
+}
+
+/********************
+ *
+ * Unit quaternion rotations.
+ *
+ * fromAxisAngle() follows the right-hand rule like GLMatrix4's setRotationX/
+ * Y/Z, and toMatrix() writes the same column-major layout. Composition is
+ * a * b = rotate by b, then by a.
+ *
+ ********************/
+struct Quaternion {
+	float w, x, y, z;
+
+	Quaternion(float w = 1, float x = 0, float y = 0, float z = 0) : w(w), x(x), y(y), z(z) {
+	}
+
+	//the axis doesn't need to be normalized; a zero axis gives the identity
+	static Quaternion fromAxisAngle(float ax, float ay, float az, float theta) {
+		const float length = std::sqrt(ax * ax + ay * ay + az * az);
+		if ( length == 0 )
+			return Quaternion();
+		float s, c;
+		sincos_detail::sincosScalar(theta * 0.5f, s, c);
+		s /= length;
+		return Quaternion(c, ax * s, ay * s, az * s);
+	}
+
+	Quaternion operator*(const Quaternion &q) const {
+		return Quaternion(w * q.w - x * q.x - y * q.y - z * q.z,
+		                  w * q.x + x * q.w + y * q.z - z * q.y,
+		                  w * q.y - x * q.z + y * q.w + z * q.x,
+		                  w * q.z + x * q.y - y * q.x + z * q.w);
+	}
+
+	Quaternion conjugate() const {
+		return Quaternion(w, -x, -y, -z);
+	}
+
+	float dot(const Quaternion &q) const {
+		return w * q.w + x * q.x + y * q.y + z * q.z;
+	}
+
+	Quaternion normalized() const {
+		const float length = std::sqrt(dot(*this));
+		return length > 0 ? Quaternion(w / length, x / length, y / length, z / length) : Quaternion();
+	}
+
+	//column-major 4x4 rotation with no translation
+	void toMatrix(float *mat) const {
+		const float xx = x * x, yy = y * y, zz = z * z;
+		const float xy = x * y, xz = x * z, yz = y * z;
+		const float wx = w * x, wy = w * y, wz = w * z;
+		mat[0] = 1 - 2 * (yy + zz), mat[4] = 2 * (xy - wz), mat[8] = 2 * (xz + wy), mat[12] = 0;
+		mat[1] = 2 * (xy + wz), mat[5] = 1 - 2 * (xx + zz), mat[9] = 2 * (yz - wx), mat[13] = 0;
+		mat[2] = 2 * (xz - wy), mat[6] = 2 * (yz + wx), mat[10] = 1 - 2 * (xx + yy), mat[14] = 0;
+		mat[3] = 0, mat[7] = 0, mat[11] = 0, mat[15] = 1;
+	}
+};
+
+//spherical interpolation along the shorter arc; t=0 gives a, t=1 gives b (or -b)
+inline Quaternion slerp(const Quaternion &a, Quaternion b, float t) {
+	float d = a.dot(b);
+	if ( d < 0 ) {
+		b = Quaternion(-b.w, -b.x, -b.y, -b.z);
+		d = -d;
+	}
+	float wa, wb;
+	if ( d > 0.9995f ) {
+		//nearly the same rotation: sin(theta) is too small to divide by, lerp and normalize instead
+		wa = 1 - t;
+		wb = t;
+		return Quaternion(wa * a.w + wb * b.w, wa * a.x + wb * b.x, wa * a.y + wb * b.y, wa * a.z + wb * b.z).normalized();
+	}
+	const float theta = std::acos(d);
+	float sinTheta, sinA, sinB, unused;
+	sincos_detail::sincosScalar(theta, sinTheta, unused);
+	sincos_detail::sincosScalar((1 - t) * theta, sinA, unused);
+	sincos_detail::sincosScalar(t * theta, sinB, unused);
+	wa = sinA / sinTheta;
+	wb = sinB / sinTheta;
+	return Quaternion(wa * a.w + wb * b.w, wa * a.x + wb * b.x, wa * a.y + wb * b.y, wa * a.z + wb * b.z);
+}
+
+//below this many rotations, one libm sin() and cos() per rotation beats filling the chunks
+//(QuaternionBenchmark's "axisangle" rows break even between 4 and 8)
+const size_t AXIS_ANGLE_BATCH_MIN = 8;
+
+//n rotations at once: axes holds 3 floats per rotation and must be unit length
+inline void axisAngleBatch(const float *axes, const float *angles, Quaternion *out, size_t n) {
+	if ( n < AXIS_ANGLE_BATCH_MIN ) {
+		for ( size_t i = 0; i < n; ++i ) {
+			const float half = angles[i] * 0.5f, s = std::sin(half);
+			const float *axis = axes + 3 * i;
+			out[i] = Quaternion(std::cos(half), axis[0] * s, axis[1] * s, axis[2] * s);
+		}
+		return;
+	}
+	const size_t CHUNK = 64;
+	float half[CHUNK], s[CHUNK], c[CHUNK];
+	for ( size_t first = 0; first < n; first += CHUNK ) {
+		const size_t count = n - first < CHUNK ? n - first : CHUNK;
+		for ( size_t i = 0; i < count; ++i )
+			half[i] = angles[first + i] * 0.5f;
+		sincosBatch(half, s, c, count);
+		for ( size_t i = 0; i < count; ++i ) {
+			const float *axis = axes + 3 * (first + i);
+			out[first + i] = Quaternion(c[i], axis[0] * s[i], axis[1] * s[i], axis[2] * s[i]);
+		}
+	}
+}
+
+#endif
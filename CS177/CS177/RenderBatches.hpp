@@ -0,0 +1,164 @@
+#ifndef CS177_RENDER_BATCHES_HPP
+#define CS177_RENDER_BATCHES_HPP
+
+#include "FlatScene.hpp"
+
+/********************
+ *
+ * Typed render batches: a data-oriented draw path without virtual calls.
+ *
+ * The class hierarchy stays the front end. build() walks a FlatScene once,
+ * asks each MeshNode for its type, mesh and state, and files it into a
+ * homogeneous batch per (node type, primitive, line width), so e.g. all
+ * RegularPolygonNodes end up in one array and the filled and outlined
+ * RectNodes in two. Within a batch the items keep their scene order, so
+ * differently colored nodes of one type overlap as they would node by node.
+ *
+ * draw() then processes one batch at a time in three flat loops over plain
+ * arrays: compact the visible items (branch-free), compute view * world for
+ * each, and submit, binding a mesh only when it differs from the previous
+ * item's. The batch's primitive and line state are set once. Nothing in the
+ * loop looks at a SceneNode, so there is no virtual dispatch and no per-node
+ * type branching.
+ *
+ * Batches are drawn in the order of their last occurrence in the scene, as
+ * in InstancedRenderer. Like FlatScene::draw() it draws with the bound
+ * program and UNIFORM_transfromationMatrix.
+ *
+ ********************/
+class RenderBatches {
+	struct Batch {
+		const char *type;
+		GLenum primitive;
+		GLfloat lineWidth;
+		size_t first, count;     //range in the item arrays
+		size_t lastEntry;
+	};
+
+	static bool byLastEntry(const Batch &a, const Batch &b) {
+		return a.lastEntry < b.lastEntry;
+	}
+
+	struct Item {
+		Mesh *mesh;
+		int entry;
+	};
+
+	vector<Batch> batches;
+	//the items of every batch back to back, one array per field
+	vector<int> entries;
+	vector<Mesh*> meshes;
+	vector<GLsizei> vertexCounts;
+
+	//per draw
+	vector<int> visibleItems;    //one spare slot for the branch-free compaction
+	vector<GLfloat> transforms;  //16 floats per item of the largest batch
+	size_t drawCalls;
+
+public:
+	RenderBatches() : drawCalls(0) {
+	}
+
+	//regroup after the scene's topology changed; uploads meshes, so it needs a GL context
+	void build(const FlatScene &scene) {
+		batches.clear();
+		typedef pair< pair<const char*, GLenum>, GLfloat > Key;
+		map< Key, size_t > lookup;
+		vector< vector<Item> > items;
+		for ( size_t i = 0; i < scene.size(); ++i ) {
+			MeshNode *node = dynamic_cast<MeshNode*>(scene.nodes[i]);
+			if ( !node )
+				continue;
+			const Key key(make_pair(node->typeName(), node->primitive()), node->getLineWidth());
+			map< Key, size_t >::iterator it = lookup.find(key);
+			if ( it == lookup.end() ) {
+				it = lookup.insert(make_pair(key, batches.size())).first;
+				Batch batch = { node->typeName(), node->primitive(), node->getLineWidth(), 0, 0, 0 };
+				batches.push_back(batch);
+				items.push_back(vector<Item>());
+			}
+			//in entry order, which the batch keeps
+			Item item = { node->getMesh(), (int) i };
+			items[it->second].push_back(item);
+			batches[it->second].lastEntry = i;
+		}
+
+		entries.clear();
+		meshes.clear();
+		vertexCounts.clear();
+		size_t largest = 0;
+		for ( size_t b = 0; b < batches.size(); ++b ) {
+			batches[b].first = entries.size();
+			batches[b].count = items[b].size();
+			largest = max(largest, items[b].size());
+			for ( size_t i = 0; i < items[b].size(); ++i ) {
+				entries.push_back(items[b][i].entry);
+				meshes.push_back(items[b][i].mesh);
+				vertexCounts.push_back(items[b][i].mesh->count);
+			}
+		}
+		sort(batches.begin(), batches.end(), byLastEntry);
+		visibleItems.resize(entries.size() + 1);
+		transforms.resize(16 * largest);
+	}
+
+	//draws every batch with viewTransform * world; with visible (from FlatScene::cull()) only the marked entries,
+	//and only entries [begin, end) with a range
+	void draw(const FlatScene &scene, const GLMatrix4 &viewTransform, const char *visible = 0, size_t begin = 0, size_t end = (size_t) -1) {
+		drawCalls = 0;
+		end = min(end, scene.size());
+		for ( size_t b = 0; b < batches.size(); ++b ) {
+			const Batch &batch = batches[b];
+			PROFILE_NODE(batch.type);
+
+			//the items are in scene order, so the range is a contiguous run of them
+			const vector<int>::const_iterator items = entries.begin() + batch.first;
+			const size_t first = lower_bound(items, items + batch.count, (int) begin) - entries.begin();
+			const size_t last = lower_bound(items, items + batch.count, (int) end) - entries.begin();
+
+			//compact the visible items: always write, only advance past the visible ones
+			int *selected = &visibleItems[batch.first];
+			size_t n = 0;
+			if ( visible ) {
+				for ( size_t i = first; i < last; ++i ) {
+					selected[n] = (int) i;
+					n += visible[entries[i]] != 0;
+				}
+			} else {
+				for ( size_t i = first; i < last; ++i )
+					selected[n++] = (int) i;
+			}
+			if ( !n )
+				continue;
+
+			for ( size_t k = 0; k < n; ++k )
+				mat4Multiply(viewTransform.mat, scene.world(entries[selected[k]]), &transforms[16 * k]);
+
+			if ( batch.lineWidth > 0 ) {
+				glEnable(GL_LINE_SMOOTH);
+				glLineWidth(batch.lineWidth);
+			}
+			Mesh *bound = 0;
+			for ( size_t k = 0; k < n; ++k ) {
+				const int item = selected[k];
+				if ( meshes[item] != bound ) {
+					bound = meshes[item];
+					bound->bind();
+				}
+				glUniformMatrix4fv(UNIFORM_transfromationMatrix, 1, false, &transforms[16 * k]);
+				glDrawArrays(batch.primitive, 0, vertexCounts[item]);
+			}
+			drawCalls += n;
+		}
+	}
+
+	size_t batchCount() const {
+		return batches.size();
+	}
+
+	size_t lastDrawCalls() const {
+		return drawCalls;
+	}
+};
+
+#endif
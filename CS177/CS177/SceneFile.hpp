@@ -0,0 +1,446 @@
+#ifndef CS177_SCENE_FILE_HPP
+#define CS177_SCENE_FILE_HPP
+
+#include "FlatScene.hpp"
+#include "MappedFile.hpp"
+
+/********************
+ *
+ * Binary scene files.
+ *
+ * exportScene() writes a SceneNode tree the way FlatScene lays it out: one
+ * entry per node occurrence in parent-before-child order, with the parent
+ * and subtree end indices and the local matrices as flat arrays. Every
+ * MeshNode entry refers to a mesh record, and the records point into one
+ * packed Vtx array. Occurrences of the same node and nodes with identical
+ * geometry and state share a record. Positions are always stored as x, y, z
+ * (z is 0 for 2D meshes). Other node types only keep their transform.
+ *
+ * SceneFile maps such a file and uses the arrays where they are: open()
+ * checks the header and the section bounds and nothing else, so loading
+ * costs no parsing and no allocation per node, and pages are only read in
+ * when touched. The file layout is the header followed by the sections, each
+ * starting on a SCENE_FILE_SECTION_ALIGN boundary:
+ *
+ *   parents       GLint[nodes]          -1 for the root, always < own index
+ *   subtreeEnds   GLint[nodes]          one past the entry's last descendant
+ *   locals        GLfloat[16 * nodes]   column-major, as GLMatrix4
+ *   nodeMeshes    GLint[nodes]          mesh record, -1 for none
+ *   meshes        SceneFileMesh[meshes]
+ *   vertices      Vtx[vertices]
+ *   pages         SceneFilePage[pages]  in entry order
+ *
+ * The pages split the entries into units that can be loaded on their own
+ * (see SceneStreamer.hpp). A subtree of more than pageNodes entries is
+ * opened up like in FlatScene::updateParallel: its root becomes a pinned
+ * page of one entry, and its children's subtrees are grouped into pages of
+ * about pageNodes entries, big ones opened up in turn. Every entry's parent
+ * is thus either in its own page or pinned. A long chain pins most of itself.
+ *
+ * Numbers are in the writer's byte order, which the header records; a file
+ * from a machine of the other order is refused rather than swapped. Beyond
+ * the section bounds the contents are trusted.
+ *
+ * updateWorld() computes the world matrices into the only array the loader
+ * allocates, upload() copies the vertices straight from the mapping into
+ * one VBO, and draw() draws every mesh entry with the current program, like
+ * FlatScene::draw. destroy() deletes the VBO.
+ *
+ ********************/
+struct SceneFileHeader {
+	char magic[4];                 //"CSSC"
+	GLuint version;
+	GLuint byteOrder;              //BYTE_ORDER_MARK as the writer saw it
+	GLuint nodeCount, meshCount, vertexCount;
+	GLuint pageCount, reserved;
+	unsigned long long parentsOffset, subtreeEndsOffset, localsOffset, nodeMeshesOffset, meshesOffset, verticesOffset, pagesOffset;
+	unsigned long long fileSize;
+};
+
+struct SceneFileMesh {
+	GLuint firstVertex, vertexCount;
+	GLenum mode;
+	GLfloat lineWidth;             //0 leaves the line state alone, as in MeshNode
+	GLfloat box[6];                //local bounds, as SceneNode::localBounds
+};
+
+//entries [first, end); box holds their geometry in the scene root's space
+struct SceneFilePage {
+	GLuint first, end;
+	GLuint flags;
+	GLuint vertexCount;            //vertices of the distinct meshes the page uses
+	GLfloat box[6];
+};
+
+enum { SCENE_PAGE_PINNED = 1 };
+
+enum { SCENE_FILE_VERSION = 2, SCENE_FILE_BYTE_ORDER_MARK = 0x01020304, SCENE_FILE_SECTION_ALIGN = 64 };
+
+//a page over entries [first, end); the box and vertex count are filled in later
+inline SceneFilePage makeScenePage(size_t first, size_t end, GLuint flags) {
+	SceneFilePage page = SceneFilePage();
+	page.first = (GLuint) first;
+	page.end = (GLuint) end;
+	page.flags = flags;
+	return page;
+}
+
+//the box of entries [first, end), whose top-level entries all have the same parent
+inline void scenePageBox(const FlatScene &flat, size_t first, size_t end, GLfloat box[6]) {
+	boxSetEmpty(box);
+	for ( size_t i = first; i < end; i = flat.subtreeEnds[i] )
+		boxMerge(box, flat.subtreeBox(i));
+}
+
+//writes the tree under root to path, paged into about pageNodes entries; false if the file can't be written
+inline bool exportScene(SceneNode &root, const char *path, size_t pageNodes = 4096) {
+	FlatScene flat;
+	flat.build(root);
+	GLMatrix4 identity;
+	identity.setIdentity();
+	flat.updateWorld(identity);
+	const size_t n = flat.size();
+
+	vector<GLint> nodeMeshes(n, -1);
+	vector<SceneFileMesh> meshes;
+	vector<Vtx> vertices;
+	map<const MeshNode*, GLint> byNode;
+	multimap<unsigned, GLint> byContent;   //FNV-1a of the vertices and state, as in MeshCache
+	for ( size_t i = 0; i < n; ++i ) {
+		const MeshNode *node = dynamic_cast<const MeshNode*>(flat.nodes[i]);
+		if ( !node || node->getVertices().empty() )
+			continue;
+		map<const MeshNode*, GLint>::iterator known = byNode.find(node);
+		if ( known != byNode.end() ) {
+			nodeMeshes[i] = known->second;
+			continue;
+		}
+
+		SceneFileMesh mesh;
+		mesh.vertexCount = (GLuint) node->getVertices().size();
+		mesh.mode = node->primitive();
+		mesh.lineWidth = node->getLineWidth();
+		node->localBounds(mesh.box);
+		vector<Vtx> packed(node->getVertices());
+		if ( node->getPosComponents() < 3 )
+			for ( size_t v = 0; v < packed.size(); ++v )
+				packed[v].z = 0;
+		unsigned h = 2166136261u;
+		const unsigned char *bytes = (const unsigned char*) &packed[0];
+		for ( size_t b = 0; b < packed.size() * sizeof(Vtx); ++b )
+			h = (h ^ bytes[b]) * 16777619u;
+		h = (h ^ mesh.mode) * 16777619u;
+
+		GLint index = -1;
+		typedef multimap<unsigned, GLint>::iterator Iter;
+		pair<Iter, Iter> range = byContent.equal_range(h);
+		for ( Iter it = range.first; it != range.second && index < 0; ++it ) {
+			const SceneFileMesh &m = meshes[it->second];
+			if ( m.vertexCount == mesh.vertexCount && m.mode == mesh.mode && m.lineWidth == mesh.lineWidth &&
+			     memcmp(&vertices[m.firstVertex], &packed[0], packed.size() * sizeof(Vtx)) == 0 )
+				index = it->second;
+		}
+		if ( index < 0 ) {
+			index = (GLint) meshes.size();
+			mesh.firstVertex = (GLuint) vertices.size();
+			vertices.insert(vertices.end(), packed.begin(), packed.end());
+			meshes.push_back(mesh);
+			byContent.insert(make_pair(h, index));
+		}
+		byNode[node] = index;
+		nodeMeshes[i] = index;
+	}
+
+	vector<SceneFilePage> pages;
+	vector<int> open(1, 0);
+	while ( !open.empty() ) {
+		const int i = open.back();
+		open.pop_back();
+		SceneFilePage pinned = makeScenePage(i, i + 1, SCENE_PAGE_PINNED);
+		memcpy(pinned.box, flat.box(i), sizeof(pinned.box));
+		pages.push_back(pinned);
+		size_t first = i + 1;
+		for ( int child = i + 1; child < flat.subtreeEnds[i]; child = flat.subtreeEnds[child] ) {
+			const bool big = (size_t) (flat.subtreeEnds[child] - child) > pageNodes;
+			const size_t end = big ? child : flat.subtreeEnds[child];
+			if ( big || end - first >= pageNodes ) {
+				if ( first < end ) {
+					SceneFilePage page = makeScenePage(first, end, 0);
+					scenePageBox(flat, first, end, page.box);
+					pages.push_back(page);
+				}
+				first = flat.subtreeEnds[child];
+			}
+			if ( big )
+				open.push_back(child);
+		}
+		if ( first < (size_t) flat.subtreeEnds[i] ) {
+			SceneFilePage page = makeScenePage(first, flat.subtreeEnds[i], 0);
+			scenePageBox(flat, first, page.end, page.box);
+			pages.push_back(page);
+		}
+	}
+	for ( size_t p = 0; p < pages.size(); ++p ) {
+		vector<GLint> used;
+		for ( size_t i = pages[p].first; i < pages[p].end; ++i )
+			if ( nodeMeshes[i] >= 0 )
+				used.push_back(nodeMeshes[i]);
+		sort(used.begin(), used.end());
+		used.erase(unique(used.begin(), used.end()), used.end());
+		for ( size_t m = 0; m < used.size(); ++m )
+			pages[p].vertexCount += meshes[used[m]].vertexCount;
+	}
+	struct ByFirst {
+		bool operator()(const SceneFilePage &a, const SceneFilePage &b) const {
+			return a.first < b.first;
+		}
+	};
+	sort(pages.begin(), pages.end(), ByFirst());
+
+	SceneFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "CSSC", 4);
+	header.version = SCENE_FILE_VERSION;
+	header.byteOrder = SCENE_FILE_BYTE_ORDER_MARK;
+	header.nodeCount = (GLuint) n;
+	header.meshCount = (GLuint) meshes.size();
+	header.vertexCount = (GLuint) vertices.size();
+	header.pageCount = (GLuint) pages.size();
+	const void *sections[7] = { &flat.parents[0], &flat.subtreeEnds[0], &flat.locals[0], &nodeMeshes[0], meshes.empty() ? 0 : &meshes[0], vertices.empty() ? 0 : &vertices[0], &pages[0] };
+	const size_t sizes[7] = { n * sizeof(GLint), n * sizeof(GLint), n * 16 * sizeof(GLfloat), n * sizeof(GLint), meshes.size() * sizeof(SceneFileMesh), vertices.size() * sizeof(Vtx), pages.size() * sizeof(SceneFilePage) };
+	unsigned long long *offsets[7] = { &header.parentsOffset, &header.subtreeEndsOffset, &header.localsOffset, &header.nodeMeshesOffset, &header.meshesOffset, &header.verticesOffset, &header.pagesOffset };
+	unsigned long long end = sizeof(header);
+	for ( int s = 0; s < 7; ++s ) {
+		end = (end + SCENE_FILE_SECTION_ALIGN - 1) / SCENE_FILE_SECTION_ALIGN * SCENE_FILE_SECTION_ALIGN;
+		*offsets[s] = end;
+		end += sizes[s];
+	}
+	header.fileSize = end;
+
+	FILE *file = fopen(path, "wb");
+	if ( !file )
+		return false;
+	static const char padding[SCENE_FILE_SECTION_ALIGN] = { 0 };
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	unsigned long long written = sizeof(header);
+	for ( int s = 0; s < 7 && ok; ++s ) {
+		ok = fwrite(padding, 1, (size_t) (*offsets[s] - written), file) == *offsets[s] - written;
+		if ( ok && sizes[s] )
+			ok = fwrite(sections[s], sizes[s], 1, file) == 1;
+		written = *offsets[s] + sizes[s];
+	}
+	ok = fclose(file) == 0 && ok;
+	return ok;
+}
+
+class SceneFile {
+	MappedFile file;
+	const SceneFileHeader *header;
+	const GLint *parentArray, *subtreeEndArray, *nodeMeshArray;
+	const GLfloat *localArray;
+	const SceneFileMesh *meshArray;
+	const Vtx *vertexArray;
+	const SceneFilePage *pageArray;
+	vector<GLfloat> worlds;        //16 floats per entry
+	GLuint vbo;
+	size_t drawCalls;
+
+	template<class T>
+	const T *section(unsigned long long offset, size_t count) const {
+		return count ? reinterpret_cast<const T*>(file.data() + offset) : 0;
+	}
+
+	SceneFile(const SceneFile &);
+	SceneFile &operator=(const SceneFile &);
+
+public:
+	SceneFile() : header(0), parentArray(0), subtreeEndArray(0), nodeMeshArray(0), localArray(0), meshArray(0), vertexArray(0), pageArray(0), vbo(0), drawCalls(0) {
+	}
+
+	//no GL calls here, as with MeshCache; destroy() the buffer while the context is current
+	~SceneFile() {
+	}
+
+	//maps a file written by exportScene(); false, with a message, if it isn't one
+	bool open(const char *path) {
+		close();
+		if ( !file.open(path) ) {
+			cerr << "Cannot open scene file: " << path << '\n';
+			return false;
+		}
+		const SceneFileHeader *h = reinterpret_cast<const SceneFileHeader*>(file.data());
+		if ( file.size() < sizeof(SceneFileHeader) || memcmp(h->magic, "CSSC", 4) != 0 || h->version != SCENE_FILE_VERSION ||
+		     h->byteOrder != SCENE_FILE_BYTE_ORDER_MARK || h->fileSize != file.size() ) {
+			cerr << "Not a scene file of this version and byte order: " << path << '\n';
+			file.close();
+			return false;
+		}
+		const unsigned long long offsets[7] = { h->parentsOffset, h->subtreeEndsOffset, h->localsOffset, h->nodeMeshesOffset, h->meshesOffset, h->verticesOffset, h->pagesOffset };
+		const unsigned long long sizes[7] = { h->nodeCount * 4ull, h->nodeCount * 4ull, h->nodeCount * 64ull, h->nodeCount * 4ull,
+		                                      h->meshCount * (unsigned long long) sizeof(SceneFileMesh), h->vertexCount * (unsigned long long) sizeof(Vtx),
+		                                      h->pageCount * (unsigned long long) sizeof(SceneFilePage) };
+		for ( int s = 0; s < 7; ++s )
+			if ( offsets[s] % SCENE_FILE_SECTION_ALIGN || offsets[s] > file.size() || sizes[s] > file.size() - offsets[s] ) {
+				cerr << "Scene file sections out of bounds: " << path << '\n';
+				file.close();
+				return false;
+			}
+		header = h;
+		parentArray = section<GLint>(h->parentsOffset, h->nodeCount);
+		subtreeEndArray = section<GLint>(h->subtreeEndsOffset, h->nodeCount);
+		localArray = section<GLfloat>(h->localsOffset, h->nodeCount);
+		nodeMeshArray = section<GLint>(h->nodeMeshesOffset, h->nodeCount);
+		meshArray = section<SceneFileMesh>(h->meshesOffset, h->meshCount);
+		vertexArray = section<Vtx>(h->verticesOffset, h->vertexCount);
+		pageArray = section<SceneFilePage>(h->pagesOffset, h->pageCount);
+		return true;
+	}
+
+	bool isOpen() const {
+		return header != 0;
+	}
+
+	size_t size() const {
+		return header ? header->nodeCount : 0;
+	}
+
+	size_t meshCount() const {
+		return header ? header->meshCount : 0;
+	}
+
+	size_t vertexCount() const {
+		return header ? header->vertexCount : 0;
+	}
+
+	size_t fileSize() const {
+		return file.size();
+	}
+
+	size_t pageCount() const {
+		return header ? header->pageCount : 0;
+	}
+
+	const SceneFilePage &page(size_t p) const {
+		return pageArray[p];
+	}
+
+	const SceneFileMesh &meshRecord(size_t m) const {
+		return meshArray[m];
+	}
+
+	//the entry's mesh record index, -1 if it draws nothing
+	int meshIndex(size_t i) const {
+		return nodeMeshArray[i];
+	}
+
+	//gives the file pages holding vertices [first, first + count) back to the system
+	void releaseVertices(size_t first, size_t count) {
+		file.release(header->verticesOffset + first * sizeof(Vtx), count * sizeof(Vtx));
+	}
+
+	//gives the file pages holding entries [first, end) back to the system; they are read in again if touched
+	void releaseEntries(size_t first, size_t end) {
+		file.release(header->parentsOffset + first * 4, (end - first) * 4);
+		file.release(header->subtreeEndsOffset + first * 4, (end - first) * 4);
+		file.release(header->localsOffset + first * 64, (end - first) * 64);
+		file.release(header->nodeMeshesOffset + first * 4, (end - first) * 4);
+	}
+
+	int parent(size_t i) const {
+		return parentArray[i];
+	}
+
+	int subtreeEnd(size_t i) const {
+		return subtreeEndArray[i];
+	}
+
+	const GLfloat *local(size_t i) const {
+		return &localArray[16 * i];
+	}
+
+	//the entry's mesh record, null if it draws nothing
+	const SceneFileMesh *mesh(size_t i) const {
+		return nodeMeshArray[i] < 0 ? 0 : &meshArray[nodeMeshArray[i]];
+	}
+
+	const Vtx *vertices(const SceneFileMesh &m) const {
+		return &vertexArray[m.firstVertex];
+	}
+
+	//world[i] = world[parent[i]] * local[i], world[root] = rootTransform * local[root]
+	void updateWorld(const GLMatrix4 &rootTransform) {
+		worlds.resize(16 * size());
+		for ( size_t i = 0; i < size(); ++i ) {
+			const int p = parentArray[i];
+			mat4Multiply(p < 0 ? rootTransform.mat : &worlds[16 * p], &localArray[16 * i], &worlds[16 * i]);
+		}
+	}
+
+	//valid after updateWorld()
+	const GLfloat *world(size_t i) const {
+		return &worlds[16 * i];
+	}
+
+	//copies the packed vertices into one static VBO
+	void upload() {
+		if ( !header || !header->vertexCount )
+			return;
+		if ( !vbo )
+			glGenBuffers(1, &vbo);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBufferData(GL_ARRAY_BUFFER, header->vertexCount * sizeof(Vtx), vertexArray, GL_STATIC_DRAW);
+	}
+
+	//draws every mesh entry with viewTransform * world through the current program; after upload() and updateWorld()
+	void draw(const GLMatrix4 &viewTransform) {
+		drawCalls = 0;
+		if ( !vbo )
+			return;
+		//every mesh lives in the one buffer, so the attributes are set up once
+		if ( GLEW_ARB_vertex_array_object )
+			glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glVertexAttribPointer(ATTRIB_POS, 3, GL_FLOAT, GL_FALSE, sizeof(Vtx), (const GLvoid*) offsetof(Vtx, x));
+		glVertexAttribPointer(ATTRIB_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vtx), (const GLvoid*) offsetof(Vtx, color));
+		GLMatrix4 t;
+		GLfloat boundLineWidth = -1;
+		for ( size_t i = 0; i < size(); ++i ) {
+			const SceneFileMesh *m = mesh(i);
+			if ( !m )
+				continue;
+			if ( m->lineWidth > 0 && m->lineWidth != boundLineWidth ) {
+				glEnable(GL_LINE_SMOOTH);
+				glLineWidth(m->lineWidth);
+				boundLineWidth = m->lineWidth;
+			}
+			mat4Multiply(viewTransform.mat, &worlds[16 * i], t.mat);
+			glUniformMatrix4fv(UNIFORM_transfromationMatrix, 1, false, t.mat);
+			glDrawArrays(m->mode, m->firstVertex, m->vertexCount);
+			++drawCalls;
+		}
+	}
+
+	size_t lastDrawCalls() const {
+		return drawCalls;
+	}
+
+	void destroy() {
+		if ( vbo )
+			glDeleteBuffers(1, &vbo);
+		vbo = 0;
+	}
+
+	//unmaps the file; the uploaded buffer stays until destroy()
+	void close() {
+		file.close();
+		header = 0;
+		parentArray = subtreeEndArray = nodeMeshArray = 0;
+		localArray = 0;
+		meshArray = 0;
+		vertexArray = 0;
+		pageArray = 0;
+		vector<GLfloat>().swap(worlds);
+	}
+};
+
+#endif
@@ -0,0 +1,460 @@
+#ifndef CS177_SCENE_STREAMER_HPP
+#define CS177_SCENE_STREAMER_HPP
+
+#include "SceneFile.hpp"
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+
+/********************
+ *
+ * Streaming a scene file page by page.
+ *
+ * For scenes too big to keep in memory. The file's pages (see SceneFile.hpp)
+ * are loaded on a background I/O thread when their box comes within the
+ * given radius of the focus point, and pages beyond EVICT_FACTOR times the
+ * radius are dropped. When a page wouldn't fit into the memory budget, the
+ * resident pages farther away than it are evicted, farthest first; if that
+ * isn't enough it waits. Pinned pages are loaded first and always stay.
+ *
+ * Loading a page reads its entries out of the mapping (the page faults
+ * happen on the I/O thread), computes their world matrices with the root at
+ * identity, packs the vertices of the meshes it uses and hands the page back
+ * to the mapping with MappedFile::release(). The scene is static.
+ *
+ * update() runs once per frame on the render thread. It picks up the pages
+ * the I/O thread finished (uploading their vertices when the streamer owns a
+ * VBO per page), evicts, and replaces the queue of requests, nearest first.
+ * The two threads only share the request queue and the finished list, each
+ * under a lock held for a few pointer moves, so the render thread never waits
+ * on I/O, and draw() only ever sees complete pages.
+ *
+ * stats() counts resident pages, nodes and bytes, the bytes paged in and out
+ * and the latency from a page's request to it being drawable.
+ *
+ ********************/
+
+//latencies in power-of-two buckets: bucket b holds samples below 0.25 * 2^b ms, the last one the rest
+struct LatencyHistogram {
+	enum { BUCKETS = 16 };
+	size_t counts[BUCKETS];
+
+	LatencyHistogram() {
+		clear();
+	}
+
+	void clear() {
+		memset(counts, 0, sizeof(counts));
+	}
+
+	static double bucketLimit(int b) {
+		return 0.25 * (1 << b);
+	}
+
+	void add(double ms) {
+		int b = 0;
+		while ( b + 1 < BUCKETS && ms >= bucketLimit(b) )
+			++b;
+		++counts[b];
+	}
+
+	size_t total() const {
+		size_t n = 0;
+		for ( int b = 0; b < BUCKETS; ++b )
+			n += counts[b];
+		return n;
+	}
+
+	//the upper limit of the bucket that reaches the given fraction of the samples
+	double percentile(double fraction) const {
+		const size_t wanted = (size_t) ceil(total() * fraction);
+		size_t n = 0;
+		for ( int b = 0; b + 1 < BUCKETS; ++b )
+			if ( (n += counts[b]) >= wanted )
+				return bucketLimit(b);
+		return HUGE_VAL;
+	}
+
+	void print(FILE *f) const {
+		for ( int b = 0; b < BUCKETS; ++b ) {
+			if ( !counts[b] )
+				continue;
+			if ( b + 1 < BUCKETS )
+				fprintf(f, "  < %8.2f ms %8lu\n", bucketLimit(b), (unsigned long) counts[b]);
+			else
+				fprintf(f, "  >=%8.2f ms %8lu\n", bucketLimit(b - 1), (unsigned long) counts[b]);
+		}
+	}
+};
+
+struct StreamingStats {
+	size_t residentPages, residentNodes, residentBytes;
+	size_t pendingPages;                 //requested and not drawable yet
+	unsigned long long bytesPagedIn, bytesPagedOut;
+	size_t pagesLoaded, pagesEvicted;
+	LatencyHistogram latency;            //request to drawable, per page
+
+	StreamingStats() : residentPages(0), residentNodes(0), residentBytes(0), pendingPages(0), bytesPagedIn(0), bytesPagedOut(0), pagesLoaded(0), pagesEvicted(0) {
+	}
+};
+
+class SceneStreamer {
+	enum { PAGE_OUT, PAGE_DROPPED, PAGE_QUEUED, PAGE_RESIDENT };
+
+	struct DrawItem {
+		GLuint entry;                    //within the page
+		GLuint firstVertex, vertexCount; //within the page's vertices
+		GLenum mode;
+		GLfloat lineWidth;
+	};
+
+	//built on the I/O thread, then owned by the render thread
+	struct PageData {
+		size_t page;
+		vector<GLfloat> worlds;          //16 floats per entry
+		vector<DrawItem> items;
+		vector<Vtx> vertices;            //emptied once uploaded
+		size_t bytes;                    //worlds, items and vertices, in a VBO or not
+		GLuint vbo;
+	};
+
+	typedef chrono::high_resolution_clock Clock;
+
+	SceneFile file;
+	size_t budget;
+	bool uploads;
+	//render thread
+	vector<char> states;
+	vector<PageData*> loaded;
+	vector<size_t> estimates;            //bytes a page will take, for the budget
+	vector<Clock::time_point> requestTimes;
+	vector<float> distances;
+	vector< pair<float, size_t> > candidates;
+	vector<PageData*> arrived;
+	size_t pendingBytes;
+	StreamingStats statistics;
+	size_t drawCalls;
+	//I/O thread
+	vector<GLuint> pinnedEntries;
+	vector<GLfloat> pinnedWorlds;
+	//shared, under lock
+	std::mutex lock;
+	std::condition_variable wakeup;
+	deque<size_t> requests;
+	vector<PageData*> finished;
+	std::atomic<bool> stopping;
+	std::thread io;
+
+	static float distanceToBox(const GLfloat box[6], GLfloat x, GLfloat y) {
+		if ( boxIsEmpty(box) )
+			return HUGE_VALF;
+		const float dx = max(0.0f, max(box[0] - x, x - box[3])), dy = max(0.0f, max(box[1] - y, y - box[4]));
+		return sqrt(dx * dx + dy * dy);
+	}
+
+	bool pinned(size_t p) const {
+		return (file.page(p).flags & SCENE_PAGE_PINNED) != 0;
+	}
+
+	const GLfloat *pinnedWorld(int entry) const {
+		const vector<GLuint>::const_iterator it = lower_bound(pinnedEntries.begin(), pinnedEntries.end(), (GLuint) entry);
+		assert(it != pinnedEntries.end() && *it == (GLuint) entry);
+		return &pinnedWorlds[16 * (it - pinnedEntries.begin())];
+	}
+
+	//I/O thread: reads page p out of the file
+	PageData *load(size_t p) {
+		static const GLfloat identity[16] = { 1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1 };
+		const SceneFilePage &page = file.page(p);
+		const size_t first = page.first, count = page.end - page.first;
+		PageData *data = new PageData;
+		data->page = p;
+		data->vbo = 0;
+		data->worlds.resize(16 * count);
+		data->vertices.reserve(page.vertexCount);
+		map<int, GLuint> placed;         //mesh record to first vertex within the page
+		size_t vertexBegin = (size_t) -1, vertexEnd = 0;
+		for ( size_t k = 0; k < count; ++k ) {
+			const int parent = file.parent(first + k);
+			const GLfloat *parentWorld = parent < 0 ? identity : (size_t) parent >= first ? &data->worlds[16 * (parent - first)] : pinnedWorld(parent);
+			mat4Multiply(parentWorld, file.local(first + k), &data->worlds[16 * k]);
+			const int m = file.meshIndex(first + k);
+			if ( m < 0 )
+				continue;
+			const SceneFileMesh &mesh = file.meshRecord(m);
+			map<int, GLuint>::iterator it = placed.find(m);
+			if ( it == placed.end() ) {
+				it = placed.insert(make_pair(m, (GLuint) data->vertices.size())).first;
+				const Vtx *v = file.vertices(mesh);
+				data->vertices.insert(data->vertices.end(), v, v + mesh.vertexCount);
+				vertexBegin = min(vertexBegin, (size_t) mesh.firstVertex);
+				vertexEnd = max(vertexEnd, (size_t) mesh.firstVertex + mesh.vertexCount);
+			}
+			const DrawItem item = { (GLuint) k, it->second, mesh.vertexCount, mesh.mode, mesh.lineWidth };
+			data->items.push_back(item);
+		}
+		if ( page.flags & SCENE_PAGE_PINNED ) {
+			pinnedEntries.push_back((GLuint) first);
+			pinnedWorlds.insert(pinnedWorlds.end(), data->worlds.begin(), data->worlds.end());
+		}
+		file.releaseEntries(first, page.end);
+		if ( vertexBegin < vertexEnd )
+			file.releaseVertices(vertexBegin, vertexEnd - vertexBegin);
+		data->bytes = data->worlds.size() * sizeof(GLfloat) + data->items.size() * sizeof(DrawItem) + data->vertices.size() * sizeof(Vtx);
+		return data;
+	}
+
+	void ioLoop() {
+		//pinned pages first: every other page's top-level parents are among them, and pages come in entry order
+		for ( size_t p = 0; p < file.pageCount() && !stopping; ++p ) {
+			if ( !pinned(p) )
+				continue;
+			PageData *data = load(p);
+			std::lock_guard<std::mutex> guard(lock);
+			finished.push_back(data);
+		}
+		for ( ;; ) {
+			size_t p;
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				while ( !stopping && requests.empty() )
+					wakeup.wait(guard);
+				if ( stopping )
+					return;
+				p = requests.front();
+				requests.pop_front();
+			}
+			PageData *data = load(p);
+			std::lock_guard<std::mutex> guard(lock);
+			finished.push_back(data);
+		}
+	}
+
+	void evict(size_t p) {
+		PageData *data = loaded[p];
+		if ( data->vbo )
+			glDeleteBuffers(1, &data->vbo);
+		statistics.residentBytes -= data->bytes;
+		statistics.bytesPagedOut += data->bytes;
+		statistics.residentNodes -= file.page(p).end - file.page(p).first;
+		--statistics.residentPages;
+		++statistics.pagesEvicted;
+		delete data;
+		loaded[p] = 0;
+		states[p] = PAGE_OUT;
+	}
+
+	//the resident, unpinned page farthest from the focus beyond distance; -1 if none
+	int farthestResident(float beyond) const {
+		int farthest = -1;
+		for ( size_t p = 0; p < states.size(); ++p )
+			if ( states[p] == PAGE_RESIDENT && !pinned(p) && distances[p] > beyond && (farthest < 0 || distances[p] > distances[farthest]) )
+				farthest = (int) p;
+		return farthest;
+	}
+
+	void stop() {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+		}
+		wakeup.notify_all();
+		if ( io.joinable() )
+			io.join();
+	}
+
+	SceneStreamer(const SceneStreamer &);
+	SceneStreamer &operator=(const SceneStreamer &);
+
+public:
+	enum { EVICT_FACTOR = 2 };
+
+	SceneStreamer() : budget(0), uploads(true), pendingBytes(0), drawCalls(0), stopping(false) {
+	}
+
+	//no GL calls here; destroy() the buffers while the context is current
+	~SceneStreamer() {
+		stop();
+		for ( size_t p = 0; p < loaded.size(); ++p )
+			delete loaded[p];
+		for ( size_t i = 0; i < finished.size(); ++i )
+			delete finished[i];
+	}
+
+	//maps the file and starts loading its pinned pages; with upload false the pages are only kept in memory
+	//(for tools and benchmarks without a GL context) and draw() does nothing
+	bool open(const char *path, size_t budgetBytes, bool upload = true) {
+		assert(!io.joinable());
+		if ( !file.open(path) )
+			return false;
+		budget = budgetBytes;
+		uploads = upload;
+		const size_t pages = file.pageCount();
+		states.assign(pages, PAGE_OUT);
+		loaded.assign(pages, (PageData*) 0);
+		estimates.resize(pages);
+		requestTimes.assign(pages, Clock::now());
+		distances.resize(pages);
+		candidates.reserve(pages);
+		arrived.reserve(pages);
+		for ( size_t p = 0; p < pages; ++p ) {
+			const SceneFilePage &page = file.page(p);
+			estimates[p] = (page.end - page.first) * (16 * sizeof(GLfloat) + sizeof(DrawItem)) + page.vertexCount * sizeof(Vtx);
+			if ( pinned(p) ) {
+				states[p] = PAGE_QUEUED;
+				pendingBytes += estimates[p];
+				++statistics.pendingPages;
+			}
+		}
+		io = std::thread(&SceneStreamer::ioLoop, this);
+		return true;
+	}
+
+	bool isOpen() const {
+		return file.isOpen();
+	}
+
+	//entries in the whole file
+	size_t size() const {
+		return file.size();
+	}
+
+	size_t pageCount() const {
+		return file.pageCount();
+	}
+
+	void setBudget(size_t budgetBytes) {
+		budget = budgetBytes;
+	}
+
+	//takes in the finished pages and requests those within radius of (x, y); once per frame on the render thread
+	void update(GLfloat x, GLfloat y, GLfloat radius) {
+		//take back the requests the I/O thread hasn't started, and the pages it finished
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			for ( size_t i = 0; i < requests.size(); ++i ) {
+				states[requests[i]] = PAGE_DROPPED;
+				pendingBytes -= estimates[requests[i]];
+				--statistics.pendingPages;
+			}
+			requests.clear();
+			arrived.swap(finished);
+		}
+		const Clock::time_point now = Clock::now();
+		for ( size_t i = 0; i < arrived.size(); ++i ) {
+			PageData *data = arrived[i];
+			const size_t p = data->page;
+			if ( uploads && !data->vertices.empty() ) {
+				glGenBuffers(1, &data->vbo);
+				glBindBuffer(GL_ARRAY_BUFFER, data->vbo);
+				glBufferData(GL_ARRAY_BUFFER, data->vertices.size() * sizeof(Vtx), &data->vertices[0], GL_STATIC_DRAW);
+				vector<Vtx>().swap(data->vertices);
+			}
+			loaded[p] = data;
+			states[p] = PAGE_RESIDENT;
+			pendingBytes -= estimates[p];
+			--statistics.pendingPages;
+			statistics.residentBytes += data->bytes;
+			statistics.bytesPagedIn += data->bytes;
+			statistics.residentNodes += file.page(p).end - file.page(p).first;
+			++statistics.residentPages;
+			++statistics.pagesLoaded;
+			statistics.latency.add(chrono::duration<double, milli>(now - requestTimes[p]).count());
+		}
+		arrived.clear();
+
+		candidates.clear();
+		for ( size_t p = 0; p < states.size(); ++p ) {
+			distances[p] = distanceToBox(file.page(p).box, x, y);
+			if ( pinned(p) )
+				continue;
+			if ( states[p] == PAGE_RESIDENT && distances[p] > EVICT_FACTOR * radius )
+				evict(p);
+			else if ( (states[p] == PAGE_OUT || states[p] == PAGE_DROPPED) && distances[p] <= radius )
+				candidates.push_back(make_pair(distances[p], p));
+		}
+		sort(candidates.begin(), candidates.end());
+
+		size_t accepted = 0;
+		for ( ; accepted < candidates.size(); ++accepted ) {
+			const size_t p = candidates[accepted].second;
+			bool fits = true;
+			while ( fits && statistics.residentBytes + pendingBytes + estimates[p] > budget ) {
+				const int victim = farthestResident(candidates[accepted].first);
+				if ( victim < 0 )
+					fits = false;
+				else
+					evict(victim);
+			}
+			if ( !fits )
+				break;
+			if ( states[p] == PAGE_OUT )
+				requestTimes[p] = now;
+			states[p] = PAGE_QUEUED;
+			pendingBytes += estimates[p];
+			++statistics.pendingPages;
+		}
+		for ( size_t p = 0; p < states.size(); ++p )
+			if ( states[p] == PAGE_DROPPED )
+				states[p] = PAGE_OUT;
+		if ( accepted ) {
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				for ( size_t i = 0; i < accepted; ++i )
+					requests.push_back(candidates[i].second);
+			}
+			wakeup.notify_one();
+		}
+	}
+
+	//draws the resident pages that may be visible through viewTransform with the current program
+	void draw(const GLMatrix4 &viewTransform) {
+		drawCalls = 0;
+		const Frustum frustum(viewTransform);
+		GLMatrix4 t;
+		GLfloat boundLineWidth = -1;
+		if ( GLEW_ARB_vertex_array_object )
+			glBindVertexArray(0);
+		for ( size_t p = 0; p < loaded.size(); ++p ) {
+			const PageData *data = loaded[p];
+			if ( !data || !data->vbo || !frustum.intersects(file.page(p).box) )
+				continue;
+			glBindBuffer(GL_ARRAY_BUFFER, data->vbo);
+			glVertexAttribPointer(ATTRIB_POS, 3, GL_FLOAT, GL_FALSE, sizeof(Vtx), (const GLvoid*) offsetof(Vtx, x));
+			glVertexAttribPointer(ATTRIB_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vtx), (const GLvoid*) offsetof(Vtx, color));
+			for ( size_t i = 0; i < data->items.size(); ++i ) {
+				const DrawItem &item = data->items[i];
+				if ( item.lineWidth > 0 && item.lineWidth != boundLineWidth ) {
+					glEnable(GL_LINE_SMOOTH);
+					glLineWidth(item.lineWidth);
+					boundLineWidth = item.lineWidth;
+				}
+				mat4Multiply(viewTransform.mat, &data->worlds[16 * item.entry], t.mat);
+				glUniformMatrix4fv(UNIFORM_transfromationMatrix, 1, false, t.mat);
+				glDrawArrays(item.mode, item.firstVertex, item.vertexCount);
+				++drawCalls;
+			}
+		}
+	}
+
+	size_t lastDrawCalls() const {
+		return drawCalls;
+	}
+
+	const StreamingStats &stats() const {
+		return statistics;
+	}
+
+	void destroy() {
+		for ( size_t p = 0; p < loaded.size(); ++p )
+			if ( loaded[p] && loaded[p]->vbo ) {
+				glDeleteBuffers(1, &loaded[p]->vbo);
+				loaded[p]->vbo = 0;
+			}
+	}
+};
+
+#endif
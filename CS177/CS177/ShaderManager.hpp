@@ -0,0 +1,386 @@
+#ifndef CS177_SHADER_MANAGER_HPP
+#define CS177_SHADER_MANAGER_HPP
+
+#include <GL/glew.h>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "MappedFile.hpp"
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+//the attribute locations every program is linked with;
+//ATTRIB_MODEL is a per-instance mat4 and takes four consecutive locations
+enum { ATTRIB_POS, ATTRIB_COLOR, ATTRIB_MODEL };
+
+/********************
+ *
+ * Shader program loading with a program binary cache.
+ *
+ * request() queues a vertex/fragment pair and start() issues the work for
+ * everything queued without waiting on the driver: the sources are read
+ * straight out of a file mapping, and with KHR_parallel_shader_compile the
+ * driver compiles and links on its own threads while the caller goes on (the
+ * demo builds its scene meanwhile). finish() is the only place that blocks
+ * on the results. link() hands a program over to the caller, finishing it
+ * first if needed or building it on the spot if it was never requested;
+ * linkProgram() in Utility.hpp goes through globalShaderManager() this way.
+ *
+ * With ARB_get_program_binary and a cache directory, every linked program is
+ * saved with glGetProgramBinary under a key hashed from both sources and the
+ * GL vendor, renderer and version strings, and the next start() loads it
+ * with glProgramBinary instead of compiling. A binary the driver refuses
+ * (e.g. after a driver update that kept the version string) is simply
+ * rebuilt and overwritten. Cache files are written to a temporary name and
+ * renamed, so a crash never leaves a torn binary behind.
+ *
+ * busyMs() is the time callers spent blocked in start(), finish() and link();
+ * cacheHits() and cacheMisses() count the programs loaded from the cache and
+ * those that had to be compiled. Programs that were never taken are left to
+ * the GL context.
+ *
+ ********************/
+class ShaderManager {
+	struct Entry {
+		std::string vtxPath, fragPath;
+		GLuint program, vtx, frag;
+		unsigned long long key;
+		bool started, finished, fromCache, taken;
+	};
+
+	std::vector<Entry> entries;
+	std::string cacheDir;       //empty: no cache
+	std::string driver;         //vendor, renderer and version, filled in by the first start()
+	bool binaries;
+	double busy;
+	size_t hits, misses;
+
+	struct CacheHeader {
+		char magic[4];
+		unsigned version;
+		unsigned long long key;
+		GLenum format;
+		GLint length;
+	};
+	enum { CACHE_VERSION = 1 };
+
+	typedef std::chrono::high_resolution_clock Clock;
+
+	static double since(const Clock::time_point &start) {
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	//64-bit FNV-1a
+	static void hash(unsigned long long &h, const char *data, size_t size) {
+		for ( size_t i = 0; i < size; ++i ) {
+			h ^= (unsigned char) data[i];
+			h *= 1099511628211ull;
+		}
+	}
+
+	//the cache key of a pair of sources on this driver
+	unsigned long long programKey(const MappedFile &vtxSource, const MappedFile &fragSource) const {
+		unsigned long long key = 14695981039346656037ull;
+		hash(key, driver.c_str(), driver.size());
+		hash(key, vtxSource.data(), vtxSource.size());
+		hash(key, "", 1);
+		hash(key, fragSource.data(), fragSource.size());
+		return key;
+	}
+
+	std::string cachePath(unsigned long long key) const {
+		char name[32];
+		sprintf(name, "/%016llx.bin", key);
+		return cacheDir + name;
+	}
+
+	void queryDriver() {
+		if ( !driver.empty() )
+			return;
+		const GLenum names[3] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+		for ( int i = 0; i < 3; ++i ) {
+			const GLubyte *s = glGetString(names[i]);
+			driver += s ? (const char*) s : "?";
+			driver += '\n';
+		}
+		GLint formats = 0;
+		if ( GLEW_ARB_get_program_binary )
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		binaries = binaries && formats > 0;
+		if ( binaries ) {
+#ifdef _WIN32
+			_mkdir(cacheDir.c_str());
+#else
+			mkdir(cacheDir.c_str(), 0755);
+#endif
+		}
+		if ( GLEW_KHR_parallel_shader_compile )
+			glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+	}
+
+	bool loadCached(Entry &e) {
+		MappedFile file;
+		if ( !file.open(cachePath(e.key).c_str()) || file.size() < sizeof(CacheHeader) )
+			return false;
+		CacheHeader header;
+		memcpy(&header, file.data(), sizeof(header));
+		if ( memcmp(header.magic, "CSPB", 4) != 0 || header.version != CACHE_VERSION || header.key != e.key ||
+		     header.length <= 0 || sizeof(header) + header.length > file.size() )
+			return false;
+		GLuint program = glCreateProgram();
+		glProgramBinary(program, header.format, file.data() + sizeof(header), header.length);
+		GLint linked = 0;
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		if ( !linked ) {
+			glDeleteProgram(program);
+			return false;
+		}
+		e.program = program;
+		return true;
+	}
+
+	void storeCached(const Entry &e) {
+		GLint length = 0;
+		glGetProgramiv(e.program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if ( length <= 0 )
+			return;
+		std::vector<char> data(sizeof(CacheHeader) + length);
+		CacheHeader header;
+		memcpy(header.magic, "CSPB", 4);
+		header.version = CACHE_VERSION;
+		header.key = e.key;
+		glGetProgramBinary(e.program, length, &header.length, &header.format, &data[sizeof(header)]);
+		memcpy(&data[0], &header, sizeof(header));
+		const std::string path = cachePath(e.key), temp = path + ".tmp";
+		FILE *f = fopen(temp.c_str(), "wb");
+		if ( !f )
+			return;
+		const bool written = fwrite(&data[0], 1, sizeof(header) + header.length, f) == sizeof(header) + header.length;
+		if ( fclose(f) != 0 || !written ) {
+			remove(temp.c_str());
+			return;
+		}
+		//rename() won't replace an existing file on Windows
+		remove(path.c_str());
+		if ( rename(temp.c_str(), path.c_str()) != 0 )
+			remove(temp.c_str());
+	}
+
+	void start(Entry &e) {
+		e.started = true;
+		MappedFile vtxSource, fragSource;
+		const bool vtxFound = vtxSource.open(e.vtxPath.c_str());
+		if ( !vtxFound || !fragSource.open(e.fragPath.c_str()) ) {
+			std::cerr << "Cannot find file: " << (vtxFound ? e.fragPath : e.vtxPath) << '\n';
+			e.finished = true;
+			return;
+		}
+		e.key = programKey(vtxSource, fragSource);
+		if ( binaries ) {
+			if ( loadCached(e) ) {
+				e.fromCache = true;
+				e.finished = true;
+				++hits;
+				return;
+			}
+			++misses;
+		}
+		//the driver keeps its own copy of the source, so the mappings can go right away
+		e.vtx = compile(GL_VERTEX_SHADER, vtxSource.data(), vtxSource.size());
+		e.frag = compile(GL_FRAGMENT_SHADER, fragSource.data(), fragSource.size());
+		e.program = linkShaders(e.vtx, e.frag, binaries);
+	}
+
+	void finish(Entry &e) {
+		if ( e.finished )
+			return;
+		e.finished = true;
+		const bool compiled = checkShader(e.vtx) & checkShader(e.frag);
+		const bool linked = compiled && checkProgram(e.program);
+		glDeleteShader(e.vtx);
+		glDeleteShader(e.frag);
+		e.vtx = e.frag = 0;
+		if ( !linked ) {
+			glDeleteProgram(e.program);
+			e.program = 0;
+			return;
+		}
+		if ( binaries )
+			storeCached(e);
+	}
+
+	ShaderManager(const ShaderManager &);
+	ShaderManager &operator=(const ShaderManager &);
+
+public:
+	//cacheDirectory 0 turns the binary cache off
+	explicit ShaderManager(const char *cacheDirectory = "shader_cache")
+		: cacheDir(cacheDirectory ? cacheDirectory : ""), binaries(cacheDirectory != 0), busy(0), hits(0), misses(0) {
+	}
+
+	//the driver compiles and links on threads of its own
+	static bool parallelCompileSupported() {
+		return GLEW_KHR_parallel_shader_compile != 0;
+	}
+
+	//issues the compile of one shader; the source needn't be NUL terminated
+	static GLuint compile(GLenum type, const char *source, size_t size) {
+		GLuint shader = glCreateShader(type);
+		const GLchar *text = source;
+		const GLint length = (GLint) size;
+		glShaderSource(shader, 1, &text, &length);
+		glCompileShader(shader);
+		return shader;
+	}
+
+	//issues the link of a vertex/fragment pair with the standard attribute locations
+	static GLuint linkShaders(GLuint vtx, GLuint frag, bool retrievable) {
+		GLuint program = glCreateProgram();
+		glAttachShader(program, vtx);
+		glAttachShader(program, frag);
+		glBindAttribLocation(program, ATTRIB_POS, "pos");
+		glBindAttribLocation(program, ATTRIB_COLOR, "color");
+		glBindAttribLocation(program, ATTRIB_MODEL, "instanceTransform");
+		if ( retrievable )
+			glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glLinkProgram(program);
+		return program;
+	}
+
+	//true once the program's compile and link can be checked without waiting;
+	//always true without KHR_parallel_shader_compile
+	static bool completed(GLuint program) {
+		if ( !parallelCompileSupported() )
+			return true;
+		GLint done = 0;
+		glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &done);
+		return done != 0;
+	}
+
+	//the compile log, if any, and whether it compiled
+	static bool checkShader(GLuint shader) {
+		GLint logLength = 0;
+		glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logLength);
+		if ( logLength > 0 ) {
+			std::vector<GLchar> log(logLength);
+			glGetShaderInfoLog(shader, logLength, &logLength, &log[0]);
+			std::cout << "Shader Compile Log:\n" << &log[0] << std::endl;
+		}
+		GLint compiled = 0;
+		glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+		return compiled != 0;
+	}
+
+	static bool checkProgram(GLuint program) {
+		GLint logLength = 0;
+		glGetProgramiv(program, GL_INFO_LOG_LENGTH, &logLength);
+		if ( logLength > 0 ) {
+			std::vector<GLchar> log(logLength);
+			glGetProgramInfoLog(program, logLength, &logLength, &log[0]);
+			std::cout << "Program Compile Log:\n" << &log[0] << std::endl;
+		}
+		GLint linked = 0;
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		return linked != 0;
+	}
+
+	//queues a program for the next start(); asking twice for the same pair queues it once
+	void request(const char *vtxPath, const char *fragPath) {
+		for ( size_t i = 0; i < entries.size(); ++i )
+			if ( !entries[i].taken && entries[i].vtxPath == vtxPath && entries[i].fragPath == fragPath )
+				return;
+		Entry e;
+		e.vtxPath = vtxPath;
+		e.fragPath = fragPath;
+		e.program = e.vtx = e.frag = 0;
+		e.key = 0;
+		e.started = e.finished = e.fromCache = e.taken = false;
+		entries.push_back(e);
+	}
+
+	//issues compile and link (or the cache load) for everything requested; needs a current context
+	void start() {
+		const Clock::time_point t = Clock::now();
+		queryDriver();
+		for ( size_t i = 0; i < entries.size(); ++i )
+			if ( !entries[i].started )
+				start(entries[i]);
+		busy += since(t);
+	}
+
+	//true once the program can be finished without waiting; always true without KHR_parallel_shader_compile
+	bool ready(const char *vtxPath, const char *fragPath) const {
+		for ( size_t i = 0; i < entries.size(); ++i ) {
+			const Entry &e = entries[i];
+			if ( e.taken || e.vtxPath != vtxPath || e.fragPath != fragPath )
+				continue;
+			return e.finished || completed(e.program);
+		}
+		return false;
+	}
+
+	//waits for everything started, prints the logs and saves the new binaries
+	void finish() {
+		const Clock::time_point t = Clock::now();
+		for ( size_t i = 0; i < entries.size(); ++i )
+			if ( entries[i].started )
+				finish(entries[i]);
+		busy += since(t);
+	}
+
+	//hands the linked program over to the caller, who deletes it; 0 on failure
+	GLuint link(const char *vtxPath, const char *fragPath) {
+		request(vtxPath, fragPath);
+		const Clock::time_point t = Clock::now();
+		queryDriver();
+		for ( size_t i = 0; i < entries.size(); ++i ) {
+			Entry &e = entries[i];
+			if ( e.taken || e.vtxPath != vtxPath || e.fragPath != fragPath )
+				continue;
+			if ( !e.started )
+				start(e);
+			finish(e);
+			e.taken = true;
+			busy += since(t);
+			return e.program;
+		}
+		return 0;
+	}
+
+	//removes the cached binaries of the requested programs, so the next start() compiles them
+	void discardCache() {
+		queryDriver();
+		for ( size_t i = 0; i < entries.size(); ++i ) {
+			const Entry &e = entries[i];
+			MappedFile vtxSource(e.vtxPath.c_str()), fragSource(e.fragPath.c_str());
+			remove(cachePath(programKey(vtxSource, fragSource)).c_str());
+		}
+	}
+
+	bool cacheEnabled() const {
+		return binaries;
+	}
+
+	double busyMs() const {
+		return busy;
+	}
+
+	size_t cacheHits() const {
+		return hits;
+	}
+
+	size_t cacheMisses() const {
+		return misses;
+	}
+};
+
+inline ShaderManager &globalShaderManager() {
+	static ShaderManager manager;
+	return manager;
+}
+
+#endif
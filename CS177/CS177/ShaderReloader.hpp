@@ -0,0 +1,314 @@
+#ifndef CS177_SHADER_RELOADER_HPP
+#define CS177_SHADER_RELOADER_HPP
+
+#include "ShaderManager.hpp"
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#endif
+
+/********************
+ *
+ * Hot reload of shader programs.
+ *
+ * watch() registers a program variable with its two source files, and
+ * watchUniform(), watchAttribute() and watchBlock() the locations and block
+ * bindings that go with it. After start(), a thread waits for changes to the
+ * sources (inotify on the directories holding them, since editors often
+ * save by renaming a new file into place; a 250 ms poll elsewhere), reads
+ * them and hands over whatever really changed. The reads share the files
+ * for writing and deleting and hold no mapping, so an editor saving in the
+ * middle of a poll is never refused (Windows won't truncate or replace a
+ * mapped file).
+ *
+ * update(), called on the GL thread between frames, issues the compile and
+ * link of the new sources and returns at once; a later update() that finds
+ * the driver done (KHR_parallel_shader_compile's completion status, or
+ * right away without it) checks the result. On success the new program is
+ * written into the watched variable, the registered locations are looked up
+ * again and the old program is deleted, so a frame only ever sees one
+ * program or the other. On a compile or link error the log is printed and
+ * the previous program stays in use.
+ *
+ * GLFW 2 has no shared contexts, so the GL calls themselves can't leave the
+ * GL thread: without KHR_parallel_shader_compile the driver may compile
+ * inside update(). Reloaded programs don't go through the binary cache.
+ *
+ ********************/
+class ShaderReloader {
+	enum { LOCATION_UNIFORM, LOCATION_ATTRIBUTE, LOCATION_BLOCK };
+
+	struct Binding {
+		int kind;
+		std::string name;
+		GLint *location;        //uniforms and attributes
+		GLuint blockBinding;    //blocks
+	};
+
+	struct Watched {
+		GLuint *program;
+		std::string vtxPath, fragPath;
+		std::vector<Binding> bindings;
+		unsigned long long sourceHash;   //watcher thread: the sources last handed over
+		//from the watcher thread to update(), under lock
+		bool pending;
+		std::string vtxSource, fragSource;
+		//GL thread: a build in flight
+		GLuint building, vtx, frag;
+	};
+
+	std::vector<Watched*> watched;
+	std::vector<std::string> directories;
+	std::thread watcher;
+	std::mutex lock;
+	std::atomic<bool> stopping;
+	size_t reloads, failures;
+#ifdef __linux__
+	int notify;
+#endif
+
+	static unsigned long long sourceHash(const std::string &vtx, const std::string &frag) {
+		unsigned long long h = 14695981039346656037ull;
+		const std::string *files[2] = { &vtx, &frag };
+		for ( int f = 0; f < 2; ++f ) {
+			for ( size_t i = 0; i < files[f]->size(); ++i ) {
+				h ^= (unsigned char) (*files[f])[i];
+				h *= 1099511628211ull;
+			}
+			h ^= 0xFF;
+			h *= 1099511628211ull;
+		}
+		return h;
+	}
+
+	//reads a whole file while letting others write, truncate or rename over it; false if it can't be read
+	static bool readSource(const std::string &path, std::string &out) {
+		char buffer[4096];
+		out.clear();
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+		                          OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if ( file == INVALID_HANDLE_VALUE )
+			return false;
+		DWORD got = 0;
+		bool ok;
+		while ( (ok = ReadFile(file, buffer, sizeof(buffer), &got, NULL) != 0) && got )
+			out.append(buffer, got);
+		CloseHandle(file);
+		return ok;
+#else
+		FILE *file = fopen(path.c_str(), "rb");
+		if ( !file )
+			return false;
+		size_t got;
+		while ( (got = fread(buffer, 1, sizeof(buffer), file)) > 0 )
+			out.append(buffer, got);
+		const bool ok = !ferror(file);
+		fclose(file);
+		return ok;
+#endif
+	}
+
+	static std::string directoryOf(const std::string &path) {
+		const size_t slash = path.find_last_of("/\\");
+		return slash == std::string::npos ? "." : path.substr(0, slash);
+	}
+
+	//reads every watched pair and hands over those whose contents changed
+	void scan() {
+		for ( size_t i = 0; i < watched.size(); ++i ) {
+			Watched &w = *watched[i];
+			std::string vtx, frag;
+			//a file that is missing or empty for a moment is being saved; the next event brings it back
+			if ( !readSource(w.vtxPath, vtx) || !readSource(w.fragPath, frag) || vtx.empty() || frag.empty() )
+				continue;
+			const unsigned long long h = sourceHash(vtx, frag);
+			if ( h == w.sourceHash )
+				continue;
+			w.sourceHash = h;
+			std::lock_guard<std::mutex> guard(lock);
+			w.vtxSource.swap(vtx);
+			w.fragSource.swap(frag);
+			w.pending = true;
+		}
+	}
+
+	void watchLoop() {
+		while ( !stopping ) {
+#ifdef __linux__
+			pollfd p = { notify, POLLIN, 0 };
+			if ( poll(&p, 1, 100) <= 0 )
+				continue;
+			char events[4096];
+			while ( read(notify, events, sizeof(events)) > 0 ) {
+			}
+			//editors save in several steps; let them finish and drop the events raised meanwhile
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			while ( read(notify, events, sizeof(events)) > 0 ) {
+			}
+#else
+			std::this_thread::sleep_for(std::chrono::milliseconds(250));
+#endif
+			scan();
+		}
+	}
+
+	void resolve(Watched &w) {
+		for ( size_t i = 0; i < w.bindings.size(); ++i ) {
+			const Binding &b = w.bindings[i];
+			if ( b.kind == LOCATION_UNIFORM )
+				*b.location = glGetUniformLocation(*w.program, b.name.c_str());
+			else if ( b.kind == LOCATION_ATTRIBUTE )
+				*b.location = glGetAttribLocation(*w.program, b.name.c_str());
+			else {
+				const GLuint index = glGetUniformBlockIndex(*w.program, b.name.c_str());
+				if ( index != GL_INVALID_INDEX )
+					glUniformBlockBinding(*w.program, index, b.blockBinding);
+			}
+		}
+	}
+
+	void finishBuild(Watched &w) {
+		const bool compiled = ShaderManager::checkShader(w.vtx) & ShaderManager::checkShader(w.frag);
+		const bool linked = compiled && ShaderManager::checkProgram(w.building);
+		glDeleteShader(w.vtx);
+		glDeleteShader(w.frag);
+		if ( linked ) {
+			const GLuint old = *w.program;
+			*w.program = w.building;
+			resolve(w);
+			glDeleteProgram(old);
+			++reloads;
+			std::cout << "Reloaded " << w.vtxPath << " + " << w.fragPath << '\n';
+		} else {
+			glDeleteProgram(w.building);
+			++failures;
+			std::cout << "Keeping the previous " << w.vtxPath << " + " << w.fragPath << '\n';
+		}
+		w.building = w.vtx = w.frag = 0;
+	}
+
+	ShaderReloader(const ShaderReloader &);
+	ShaderReloader &operator=(const ShaderReloader &);
+
+public:
+	ShaderReloader() : stopping(false), reloads(0), failures(0) {
+#ifdef __linux__
+		notify = -1;
+#endif
+	}
+
+	~ShaderReloader() {
+		stopping = true;
+		if ( watcher.joinable() )
+			watcher.join();
+#ifdef __linux__
+		if ( notify >= 0 )
+			close(notify);
+#endif
+		for ( size_t i = 0; i < watched.size(); ++i ) {
+			Watched &w = *watched[i];
+			if ( w.building ) {
+				glDeleteShader(w.vtx);
+				glDeleteShader(w.frag);
+				glDeleteProgram(w.building);
+			}
+			delete watched[i];
+		}
+	}
+
+	//reloads program from the two files whenever they change; returns the id for the watch*() calls below.
+	//program must stay where it is for as long as the reloader runs; register everything before start()
+	size_t watch(GLuint &program, const char *vtxPath, const char *fragPath) {
+		assert(!watcher.joinable());
+		Watched *w = new Watched;
+		w->program = &program;
+		w->vtxPath = vtxPath;
+		w->fragPath = fragPath;
+		std::string vtx, frag;
+		readSource(w->vtxPath, vtx);
+		readSource(w->fragPath, frag);
+		w->sourceHash = sourceHash(vtx, frag);
+		w->pending = false;
+		w->building = w->vtx = w->frag = 0;
+		watched.push_back(w);
+		const std::string dirs[2] = { directoryOf(w->vtxPath), directoryOf(w->fragPath) };
+		for ( int i = 0; i < 2; ++i )
+			if ( find(directories.begin(), directories.end(), dirs[i]) == directories.end() )
+				directories.push_back(dirs[i]);
+		return watched.size() - 1;
+	}
+
+	//location is looked up again in every reloaded program
+	void watchUniform(size_t id, GLint &location, const char *name) {
+		Binding b = { LOCATION_UNIFORM, name, &location, 0 };
+		watched[id]->bindings.push_back(b);
+	}
+
+	void watchAttribute(size_t id, GLint &location, const char *name) {
+		Binding b = { LOCATION_ATTRIBUTE, name, &location, 0 };
+		watched[id]->bindings.push_back(b);
+	}
+
+	//the uniform block is bound to binding again in every reloaded program
+	void watchBlock(size_t id, const char *name, GLuint binding) {
+		Binding b = { LOCATION_BLOCK, name, 0, binding };
+		watched[id]->bindings.push_back(b);
+	}
+
+	//starts watching the files; false if the file system can't be watched
+	bool start() {
+#ifdef __linux__
+		notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if ( notify < 0 )
+			return false;
+		for ( size_t i = 0; i < directories.size(); ++i )
+			inotify_add_watch(notify, directories[i].c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+#endif
+		watcher = std::thread(&ShaderReloader::watchLoop, this);
+		return true;
+	}
+
+	//issues the builds of changed sources and swaps in those that finished; between frames on the GL thread
+	void update() {
+		for ( size_t i = 0; i < watched.size(); ++i ) {
+			Watched &w = *watched[i];
+			if ( w.building ) {
+				if ( !ShaderManager::completed(w.building) )
+					continue;
+				finishBuild(w);
+			}
+			std::string vtxSource, fragSource;
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				if ( !w.pending )
+					continue;
+				w.pending = false;
+				vtxSource.swap(w.vtxSource);
+				fragSource.swap(w.fragSource);
+			}
+			w.vtx = ShaderManager::compile(GL_VERTEX_SHADER, vtxSource.data(), vtxSource.size());
+			w.frag = ShaderManager::compile(GL_FRAGMENT_SHADER, fragSource.data(), fragSource.size());
+			w.building = ShaderManager::linkShaders(w.vtx, w.frag, false);
+		}
+	}
+
+	//programs swapped in, and builds that failed and kept the previous program
+	size_t reloadCount() const {
+		return reloads;
+	}
+
+	size_t failureCount() const {
+		return failures;
+	}
+};
+
+#endif
@@ -0,0 +1,385 @@
+#ifndef CS177_STATIC_BATCHES_HPP
+#define CS177_STATIC_BATCHES_HPP
+
+#include "FlatScene.hpp"
+
+/********************
+ *
+ * Static batching: subtrees marked SceneNode::staticSubtree baked into
+ * shared pre-transformed meshes.
+ *
+ * build() takes the outermost marked subtrees of a FlatScene (the scene
+ * root itself can't be one) and transforms the vertices of every MeshNode in
+ * them into the space of the subtree root's parent. Fans, strips and loops
+ * are turned into indexed GL_TRIANGLES, GL_LINES or GL_POINTS, so each
+ * material (primitive and line width) gets one vertex and one index buffer.
+ * A batch is a run of meshes in scene order with the same material under the
+ * same parent, a contiguous range drawn with one glDrawElements and the
+ * parent's world matrix: a parent that moves costs nothing, and e.g. ten
+ * thousand static children of the root are a handful of draws. A batch is
+ * closed once it holds MAX_BATCH_VERTICES, so culling and re-baking stay
+ * local.
+ *
+ * The batches keep their place in the scene. Any other entry drawing
+ * something closes the batch before it, and the batches between two such
+ * entries form a stop, drawn in front of the entry its first subtree starts
+ * at. The caller draws the regular path up to stopEntry(s), then
+ * drawStop(s), and so on, with the baked entries cleared from the mask by
+ * hide(); the picture is the same as drawing node by node. Scenes that mark
+ * whole blocks of subtrees get a few stops, one that alternates static and
+ * dynamic siblings gets one per static sibling and saves nothing.
+ *
+ * refresh() runs once per frame before drawing. A subtree whose transforms
+ * changed anyway (FlatScene's revisions moved) gets the batches it feeds
+ * baked again from the scene's locals, and only those ranges are sent with
+ * glBufferSubData. Geometry may not change; after a topology change call
+ * build() again.
+ *
+ * drawStop() uses the bound program and UNIFORM_transfromationMatrix, like
+ * FlatScene::draw, and skips batches whose subtrees are out of view.
+ *
+ * build() and refresh() need no GL context until upload() created the
+ * buffers.
+ *
+ ********************/
+class StaticBatches {
+	struct Material {
+		GLenum primitive;
+		GLfloat lineWidth;
+		vector<Vtx> vertices;
+		vector<GLuint> indices;
+		GLuint vbo, ibo;
+	};
+
+	struct Batch {
+		int parent;                  //entry the vertices are relative to
+		size_t material;
+		vector<size_t> roots;        //into staticRoots
+		vector<int> items;           //entries with a mesh of this material, in scene order
+		size_t firstVertex, vertexCount;
+		size_t firstIndex, indexCount;
+	};
+
+	//batches [firstBatch, next stop's firstBatch) go in front of entry
+	struct Stop {
+		int entry;
+		size_t firstBatch;
+	};
+
+	vector<Material> materials;
+	vector<Batch> batches;
+	vector<Stop> stops;
+	vector<int> staticRoots;             //outermost marked entries
+	vector<unsigned> bakedRevisions;     //per scene entry, the revision the bake used
+	vector<char> rootChanged;
+	vector<GLfloat> relative;            //16 floats per entry of the subtree being baked
+	size_t batchedEntries, drawCalls, rebuilt;
+
+	static GLenum materialPrimitive(GLenum mode) {
+		if ( mode == GL_TRIANGLES || mode == GL_TRIANGLE_FAN || mode == GL_TRIANGLE_STRIP )
+			return GL_TRIANGLES;
+		if ( mode == GL_LINES || mode == GL_LINE_LOOP || mode == GL_LINE_STRIP )
+			return GL_LINES;
+		return GL_POINTS;
+	}
+
+	//the indices drawing count vertices starting at base with mode as materialPrimitive(mode)
+	static void appendIndices(GLenum mode, GLuint base, GLuint count, vector<GLuint> &out) {
+		if ( mode == GL_TRIANGLE_FAN ) {
+			for ( GLuint i = 1; i + 1 < count; ++i ) {
+				out.push_back(base);
+				out.push_back(base + i);
+				out.push_back(base + i + 1);
+			}
+		} else if ( mode == GL_TRIANGLE_STRIP ) {
+			for ( GLuint i = 0; i + 2 < count; ++i ) {
+				//every other triangle is flipped to keep the winding
+				out.push_back(base + i + (i & 1));
+				out.push_back(base + i + 1 - (i & 1));
+				out.push_back(base + i + 2);
+			}
+		} else if ( mode == GL_LINE_LOOP || mode == GL_LINE_STRIP ) {
+			for ( GLuint i = 0; i + 1 < count; ++i ) {
+				out.push_back(base + i);
+				out.push_back(base + i + 1);
+			}
+			if ( mode == GL_LINE_LOOP && count > 2 ) {
+				out.push_back(base + count - 1);
+				out.push_back(base);
+			}
+		} else {
+			for ( GLuint i = 0; i < count; ++i )
+				out.push_back(base + i);
+		}
+	}
+
+	size_t findMaterial(GLenum primitive, GLfloat lineWidth) {
+		//line width only matters for lines
+		if ( primitive != GL_LINES )
+			lineWidth = 0;
+		for ( size_t m = 0; m < materials.size(); ++m )
+			if ( materials[m].primitive == primitive && materials[m].lineWidth == lineWidth )
+				return m;
+		Material material;
+		material.primitive = primitive;
+		material.lineWidth = lineWidth;
+		material.vbo = material.ibo = 0;
+		materials.push_back(material);
+		return materials.size() - 1;
+	}
+
+	//writes batch b's vertices, in the space of its parent, to out
+	void bakeVertices(const FlatScene &scene, const Batch &b, Vtx *out) {
+		size_t item = 0;
+		for ( size_t r = 0; r < b.roots.size(); ++r ) {
+			const int root = staticRoots[b.roots[r]], end = scene.subtreeEnds[root];
+			relative.resize(16 * (end - root));
+			for ( int e = root; e < end; ++e ) {
+				GLfloat *m = &relative[16 * (e - root)];
+				if ( e == root )
+					memcpy(m, scene.local(root), sizeof(GLfloat) * 16);
+				else
+					mat4Multiply(&relative[16 * (scene.parents[e] - root)], scene.local(e), m);
+			}
+			for ( ; item < b.items.size() && b.items[item] < end; ++item ) {
+				const int e = b.items[item];
+				const GLfloat *m = &relative[16 * (e - root)];
+				const MeshNode *node = static_cast<const MeshNode*>(scene.nodes[e]);
+				const vector<Vtx> &vertices = node->getVertices();
+				const bool flat = node->getPosComponents() < 3;
+				for ( size_t v = 0; v < vertices.size(); ++v, ++out ) {
+					const Vtx &in = vertices[v];
+					const GLfloat z = flat ? 0 : in.z;
+					out->x = m[0] * in.x + m[4] * in.y + m[8] * z + m[12];
+					out->y = m[1] * in.x + m[5] * in.y + m[9] * z + m[13];
+					out->z = m[2] * in.x + m[6] * in.y + m[10] * z + m[14];
+					out->color = in.color;
+				}
+			}
+		}
+	}
+
+	void uploadBatch(const Batch &b) {
+		const Material &material = materials[b.material];
+		glBindBuffer(GL_ARRAY_BUFFER, material.vbo);
+		glBufferSubData(GL_ARRAY_BUFFER, b.firstVertex * sizeof(Vtx), b.vertexCount * sizeof(Vtx), &material.vertices[b.firstVertex]);
+	}
+
+public:
+	enum { MAX_BATCH_VERTICES = 16384 };
+
+	StaticBatches() : batchedEntries(0), drawCalls(0), rebuilt(0) {
+	}
+
+	//bakes every marked subtree of scene; the buffers need upload() again afterwards
+	void build(const FlatScene &scene) {
+		destroy();
+		materials.clear();
+		batches.clear();
+		stops.clear();
+		staticRoots.clear();
+		batchedEntries = 0;
+		bakedRevisions.assign(scene.revisions.begin(), scene.revisions.end());
+
+		//another entry drawing something in between keeps the batches on either side of it apart
+		bool split = true;
+		for ( size_t i = 1; i < scene.size(); ) {
+			if ( !scene.nodes[i]->staticSubtree ) {
+				const MeshNode *node = dynamic_cast<const MeshNode*>(scene.nodes[i]);
+				if ( node && !node->getVertices().empty() )
+					split = true;
+				++i;
+				continue;
+			}
+			const size_t root = staticRoots.size();
+			staticRoots.push_back((int) i);
+			const int parent = scene.parents[i];
+			for ( int e = (int) i; e < scene.subtreeEnds[i]; ++e ) {
+				const MeshNode *node = dynamic_cast<const MeshNode*>(scene.nodes[e]);
+				if ( !node || node->getVertices().empty() )
+					continue;
+				const size_t material = findMaterial(materialPrimitive(node->primitive()), node->getLineWidth());
+				//a batch is a run of meshes in scene order, so drawing the batches one after another keeps
+				//the order of the nodes; a full batch is left alone once its last subtree is complete
+				if ( split || batches.back().parent != parent || batches.back().material != material ||
+				     (batches.back().vertexCount >= MAX_BATCH_VERTICES && batches.back().roots.back() != root) ) {
+					if ( split ) {
+						Stop stop = { (int) i, batches.size() };
+						stops.push_back(stop);
+						split = false;
+					}
+					Batch b;
+					b.parent = parent;
+					b.material = material;
+					b.vertexCount = 0;
+					batches.push_back(b);
+				}
+				Batch &b = batches.back();
+				if ( b.roots.empty() || b.roots.back() != root )
+					b.roots.push_back(root);
+				b.items.push_back(e);
+				b.vertexCount += node->getVertices().size();
+				++batchedEntries;
+			}
+			i = scene.subtreeEnds[i];
+		}
+		rootChanged.assign(staticRoots.size(), 0);
+
+		//every batch is a contiguous range of its material's buffers
+		for ( size_t k = 0; k < batches.size(); ++k ) {
+			Batch &b = batches[k];
+			Material &material = materials[b.material];
+			b.firstVertex = material.vertices.size();
+			b.firstIndex = material.indices.size();
+			for ( size_t i = 0; i < b.items.size(); ++i ) {
+				const MeshNode *node = static_cast<const MeshNode*>(scene.nodes[b.items[i]]);
+				const GLuint count = (GLuint) node->getVertices().size();
+				appendIndices(node->primitive(), (GLuint) material.vertices.size(), count, material.indices);
+				material.vertices.resize(material.vertices.size() + count);
+			}
+			b.vertexCount = material.vertices.size() - b.firstVertex;
+			b.indexCount = material.indices.size() - b.firstIndex;
+			bakeVertices(scene, b, &material.vertices[b.firstVertex]);
+		}
+	}
+
+	//creates the buffers and sends everything baked so far
+	void upload() {
+		for ( size_t m = 0; m < materials.size(); ++m ) {
+			Material &material = materials[m];
+			if ( !material.vbo ) {
+				glGenBuffers(1, &material.vbo);
+				glGenBuffers(1, &material.ibo);
+			}
+			glBindBuffer(GL_ARRAY_BUFFER, material.vbo);
+			glBufferData(GL_ARRAY_BUFFER, material.vertices.size() * sizeof(Vtx), &material.vertices[0], GL_STATIC_DRAW);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, material.ibo);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, material.indices.size() * sizeof(GLuint), &material.indices[0], GL_STATIC_DRAW);
+		}
+	}
+
+	bool uploaded() const {
+		return !materials.empty() && materials[0].vbo != 0;
+	}
+
+	//bakes again the batches fed by a static subtree that changed since the last bake; once per frame
+	void refresh(const FlatScene &scene) {
+		rebuilt = 0;
+		bool any = false;
+		for ( size_t r = 0; r < staticRoots.size(); ++r ) {
+			rootChanged[r] = 0;
+			for ( int e = staticRoots[r]; e < scene.subtreeEnds[staticRoots[r]]; ++e )
+				if ( scene.revisions[e] != bakedRevisions[e] ) {
+					bakedRevisions[e] = scene.revisions[e];
+					rootChanged[r] = 1;
+					any = true;
+				}
+		}
+		if ( !any )
+			return;
+		const bool gl = uploaded();
+		for ( size_t k = 0; k < batches.size(); ++k ) {
+			Batch &b = batches[k];
+			bool changed = false;
+			for ( size_t r = 0; r < b.roots.size() && !changed; ++r )
+				changed = rootChanged[b.roots[r]] != 0;
+			if ( !changed )
+				continue;
+			bakeVertices(scene, b, &materials[b.material].vertices[b.firstVertex]);
+			if ( gl )
+				uploadBatch(b);
+			++rebuilt;
+		}
+	}
+
+	//clears every baked entry in visible (from FlatScene::cull), so the regular path passed the same mask skips
+	//them, and starts counting the draw calls of a viewport; before its first drawStop()
+	void hide(const FlatScene &scene, char *visible) {
+		drawCalls = 0;
+		for ( size_t r = 0; r < staticRoots.size(); ++r )
+			memset(visible + staticRoots[r], 0, scene.subtreeEnds[staticRoots[r]] - staticRoots[r]);
+	}
+
+	size_t stopCount() const {
+		return stops.size();
+	}
+
+	//the entry stop s is drawn in front of: the regular path draws the entries before it first
+	size_t stopEntry(size_t s) const {
+		return stops[s].entry;
+	}
+
+	//draws the batches of stop s whose subtrees may be visible through viewTransform; with no mask all of them
+	void drawStop(size_t s, const FlatScene &scene, const GLMatrix4 &viewTransform, const char *visible = 0) {
+		if ( !uploaded() )
+			return;
+		const Frustum frustum(viewTransform);
+		GLMatrix4 t;
+		if ( GLEW_ARB_vertex_array_object )
+			glBindVertexArray(0);
+		size_t boundMaterial = (size_t) -1;
+		const size_t end = s + 1 < stops.size() ? stops[s + 1].firstBatch : batches.size();
+		for ( size_t k = stops[s].firstBatch; k < end; ++k ) {
+			const Batch &b = batches[k];
+			bool inView = !visible;
+			for ( size_t r = 0; r < b.roots.size() && !inView; ++r )
+				inView = frustum.intersects(scene.subtreeBox(staticRoots[b.roots[r]]));
+			if ( !inView )
+				continue;
+			const Material &material = materials[b.material];
+			if ( b.material != boundMaterial ) {
+				glBindBuffer(GL_ARRAY_BUFFER, material.vbo);
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, material.ibo);
+				glVertexAttribPointer(ATTRIB_POS, 3, GL_FLOAT, GL_FALSE, sizeof(Vtx), (const GLvoid*) offsetof(Vtx, x));
+				glVertexAttribPointer(ATTRIB_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vtx), (const GLvoid*) offsetof(Vtx, color));
+				if ( material.lineWidth > 0 ) {
+					glEnable(GL_LINE_SMOOTH);
+					glLineWidth(material.lineWidth);
+				}
+				boundMaterial = b.material;
+			}
+			mat4Multiply(viewTransform.mat, scene.world(b.parent), t.mat);
+			glUniformMatrix4fv(UNIFORM_transfromationMatrix, 1, false, t.mat);
+			glDrawElements(material.primitive, (GLsizei) b.indexCount, GL_UNSIGNED_INT, (const GLvoid*) (b.firstIndex * sizeof(GLuint)));
+			++drawCalls;
+		}
+	}
+
+	size_t batchCount() const {
+		return batches.size();
+	}
+
+	//mesh entries baked into the batches
+	size_t entryCount() const {
+		return batchedEntries;
+	}
+
+	//draw calls since the last hide()
+	size_t lastDrawCalls() const {
+		return drawCalls;
+	}
+
+	//batches baked again by the last refresh()
+	size_t lastRebuilt() const {
+		return rebuilt;
+	}
+
+	//vertex and index bytes of all materials
+	size_t bytes() const {
+		size_t total = 0;
+		for ( size_t m = 0; m < materials.size(); ++m )
+			total += materials[m].vertices.size() * sizeof(Vtx) + materials[m].indices.size() * sizeof(GLuint);
+		return total;
+	}
+
+	void destroy() {
+		for ( size_t m = 0; m < materials.size(); ++m )
+			if ( materials[m].vbo ) {
+				glDeleteBuffers(1, &materials[m].vbo);
+				glDeleteBuffers(1, &materials[m].ibo);
+				materials[m].vbo = materials[m].ibo = 0;
+			}
+	}
+};
+
+#endif
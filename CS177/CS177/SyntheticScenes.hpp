@@ -0,0 +1,127 @@
+#ifndef CS177_SYNTHETIC_SCENES_HPP
+#define CS177_SYNTHETIC_SCENES_HPP
+
+#include "Utility.hpp"
+
+/********************
+ *
+ * Synthetic scenes for benchmarking, built with the regular node classes.
+ *
+ * Like createScene, every builder appends the nodes it allocates to nodeList
+ * and the caller deletes them. Everything stays inside the [-1, 1] view.
+ *
+ ********************/
+
+//a single chain of depth small polygons spiralling out from the center
+inline void buildDeepScene(SceneNode &root, vector<SceneNode*> &nodeList, size_t depth) {
+	SceneNode *parent = &root;
+	for ( size_t i = 0; i < depth; ++i ) {
+		SceneNode *node = new RegularPolygonNode(0.02f, 6, 0xFF3080FF);
+		node->transform.setRotationZ(0, 0, 0, 0.1f);
+		node->transform.translate(0.9f / depth, 0, 0);
+		parent->children.push_back(node);
+		nodeList.push_back(node);
+		parent = node;
+	}
+}
+
+//count identical polygons directly under the root, laid out on a grid
+inline void buildWideScene(SceneNode &root, vector<SceneNode*> &nodeList, size_t count) {
+	const size_t side = (size_t) ceil(sqrt((double) count));
+	const GLfloat step = 2.0f / side;
+	for ( size_t i = 0; i < count; ++i ) {
+		SceneNode *node = new RegularPolygonNode(step * 0.4f, 8, 0xFF40C040);
+		node->transform.translate(-1 + step * (i % side + 0.5f), -1 + step * (i / side + 0.5f), 0);
+		root.children.push_back(node);
+		nodeList.push_back(node);
+	}
+}
+
+//count polygons with distinct colors, so no two share a mesh
+inline void buildPolygonScene(SceneNode &root, vector<SceneNode*> &nodeList, size_t count, GLuint sides) {
+	const size_t side = (size_t) ceil(sqrt((double) count));
+	const GLfloat step = 2.0f / side;
+	for ( size_t i = 0; i < count; ++i ) {
+		const GLuint color = 0xFF000000 | ((GLuint) (i * 2654435761u) & 0xFFFFFF);
+		SceneNode *node = new RegularPolygonNode(step * 0.45f, sides, color);
+		node->transform.translate(-1 + step * (i % side + 0.5f), -1 + step * (i / side + 0.5f), 0);
+		root.children.push_back(node);
+		nodeList.push_back(node);
+	}
+}
+
+//count polygons with distinct colors split into tilesPerSide^2 tiles, each a group node over its part of
+//the grid, so every subtree covers one spot of the view (as SceneStreamer.hpp needs to page it)
+inline void buildTiledScene(SceneNode &root, vector<SceneNode*> &nodeList, size_t count, size_t tilesPerSide) {
+	const size_t tiles = tilesPerSide * tilesPerSide;
+	const size_t perTile = (count + tiles - 1) / tiles;
+	const size_t side = (size_t) ceil(sqrt((double) perTile));
+	const GLfloat tileSize = 2.0f / tilesPerSide, step = tileSize / side;
+	size_t made = 0;
+	for ( size_t t = 0; t < tiles && made < count; ++t ) {
+		SceneNode *tile = new SceneNode;
+		tile->transform.translate(-1 + tileSize * (t % tilesPerSide + 0.5f), -1 + tileSize * (t / tilesPerSide + 0.5f), 0);
+		root.children.push_back(tile);
+		nodeList.push_back(tile);
+		for ( size_t i = 0; i < perTile && made < count; ++i, ++made ) {
+			const GLuint color = 0xFF000000 | ((GLuint) (made * 2654435761u) & 0xFFFFFF);
+			SceneNode *node = new RegularPolygonNode(step * 0.45f, 6, color);
+			node->transform.translate(-tileSize / 2 + step * (i % side + 0.5f), -tileSize / 2 + step * (i / side + 0.5f), 0);
+			tile->children.push_back(node);
+			nodeList.push_back(node);
+		}
+	}
+}
+
+//one CoordinateFrameNode shared by count parents, the createScene pattern at scale
+inline void buildMarkerScene(SceneNode &root, vector<SceneNode*> &nodeList, size_t count) {
+	const size_t side = (size_t) ceil(sqrt((double) count));
+	const GLfloat step = 2.0f / side;
+	CoordinateFrameNode *marker = new CoordinateFrameNode(0xFF0000FF, 0xFFFF0000);
+	marker->transform.scale(step * 0.4f, step * 0.4f, 0);
+	nodeList.push_back(marker);
+	for ( size_t i = 0; i < count; ++i ) {
+		SceneNode *node = new SceneNode;
+		node->transform.translate(-1 + step * (i % side + 0.5f), -1 + step * (i / side + 0.5f), 0);
+		node->children.push_back(marker);
+		root.children.push_back(node);
+		nodeList.push_back(node);
+	}
+}
+
+//count HandNodes on a grid, each a group of six rects: small subtrees of several meshes
+inline void buildHandScene(SceneNode &root, vector<SceneNode*> &nodeList, size_t count) {
+	const size_t side = (size_t) ceil(sqrt((double) count));
+	const GLfloat step = 2.0f / side;
+	for ( size_t i = 0; i < count; ++i ) {
+		SceneNode *node = new HandNode(step * 0.3f, step * 0.3f, step * 0.6f, 0xFFC08040, 1);
+		node->transform.translate(-1 + step * (i % side + 0.5f), -1 + step * (i / side + 0.5f), 0);
+		root.children.push_back(node);
+		nodeList.push_back(node);
+	}
+}
+
+//count HandNodes on a grid marked static, as a mostly static level would be, with a polygon in a distinct
+//color left dynamic after every run of them; each polygon covers the hand before it and part of the next,
+//so the baked hands have to be drawn in their place between the polygons
+inline void buildMixedScene(SceneNode &root, vector<SceneNode*> &nodeList, size_t count, size_t run) {
+	const size_t side = (size_t) ceil(sqrt((double) count));
+	const GLfloat step = 2.0f / side;
+	for ( size_t i = 0; i < count; ++i ) {
+		const GLfloat x = -1 + step * (i % side + 0.5f), y = -1 + step * (i / side + 0.5f);
+		SceneNode *hand = new HandNode(step * 0.3f, step * 0.3f, step * 0.6f, 0xFFC08040, 1);
+		hand->transform.translate(x, y, 0);
+		hand->staticSubtree = true;
+		root.children.push_back(hand);
+		nodeList.push_back(hand);
+		if ( (i + 1) % run )
+			continue;
+		const GLuint color = 0xFF000000 | ((GLuint) (i * 2654435761u) & 0xFFFFFF);
+		SceneNode *polygon = new RegularPolygonNode(step * 0.5f, 16, color);
+		polygon->transform.translate(x + step * 0.5f, y, 0);
+		root.children.push_back(polygon);
+		nodeList.push_back(polygon);
+	}
+}
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef CS177_THREAD_POOL_HPP
+#define CS177_THREAD_POOL_HPP
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+
+/********************
+ *
+ * Fixed-size thread pool for data-parallel loops.
+ *
+ * parallelFor(count, grain, fn) splits [0, count) into chunks of grain
+ * elements and calls fn(begin, end) for each chunk on the workers and on the
+ * calling thread, which takes part instead of sleeping. Chunks are handed out
+ * through an atomic counter, so faster threads simply take more of them. The
+ * call returns once every chunk is done. Only one loop runs at a time.
+ *
+ ********************/
+class ThreadPool {
+	std::vector<std::thread> workers;
+	std::mutex lock;
+	std::condition_variable wake, done;
+	unsigned generation;
+	bool stopping;
+
+	//the loop currently being run
+	std::function<void(size_t, size_t)> job;
+	size_t jobCount, jobGrain;
+	std::atomic<size_t> nextChunk;
+	size_t busyWorkers;
+
+	void runChunks() {
+		const size_t chunks = (jobCount + jobGrain - 1) / jobGrain;
+		for ( size_t c = nextChunk++; c < chunks; c = nextChunk++ )
+			job(c * jobGrain, std::min(jobCount, (c + 1) * jobGrain));
+	}
+
+	void workerLoop() {
+		unsigned seen = 0;
+		for ( ;; ) {
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				wake.wait(guard, [&] { return stopping || generation != seen; });
+				if ( stopping )
+					return;
+				seen = generation;
+			}
+			runChunks();
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				if ( --busyWorkers == 0 )
+					done.notify_one();
+			}
+		}
+	}
+
+public:
+	//threads counts the calling thread; 0 picks the hardware concurrency
+	explicit ThreadPool(unsigned threads = 0) : generation(0), stopping(false), jobCount(0), jobGrain(1), nextChunk(0), busyWorkers(0) {
+		if ( threads == 0 )
+			threads = std::max(1u, std::thread::hardware_concurrency());
+		for ( unsigned i = 1; i < threads; ++i )
+			workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+	}
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+		}
+		wake.notify_all();
+		for ( size_t i = 0; i < workers.size(); ++i )
+			workers[i].join();
+	}
+
+	unsigned size() const {
+		return (unsigned) workers.size() + 1;
+	}
+
+	void parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)> &fn) {
+		if ( count == 0 )
+			return;
+		grain = std::max<size_t>(1, grain);
+		//same chunking as the threaded path, so results don't depend on the thread count
+		if ( workers.empty() || count <= grain ) {
+			for ( size_t begin = 0; begin < count; begin += grain )
+				fn(begin, std::min(count, begin + grain));
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			job = fn;
+			jobCount = count;
+			jobGrain = grain;
+			nextChunk = 0;
+			busyWorkers = workers.size();
+			++generation;
+		}
+		wake.notify_all();
+		runChunks();
+		std::unique_lock<std::mutex> guard(lock);
+		done.wait(guard, [&] { return busyWorkers == 0; });
+	}
+};
+
+#endif
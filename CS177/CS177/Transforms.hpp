@@ -0,0 +1,247 @@
+#ifndef CS177_TRANSFORMS_HPP
+#define CS177_TRANSFORMS_HPP
+
+#include <cmath>
+#include <type_traits>
+#include "MatrixKernels.hpp"
+
+/********************
+ *
+ * Specialized transform types.
+ *
+ * GLMatrix4 always pays for a full 4x4 product (64 multiplies, 48 adds), but
+ * most transforms in a 2D scene are pure translations or z=0 affine maps.
+ * These types store only what their kind needs:
+ *
+ *   Translation   x, y, z                                   (rank 0)
+ *   Affine2D      2x2 linear part on xy, translation        (rank 1)
+ *   Affine3D      3x3 linear part, translation, as 3x4 rows (rank 2)
+ *   Projective    full 4x4, column-major like GLMatrix4     (rank 3)
+ *
+ * Composition (a * b, apply b first, same as GLMatrix4) is resolved at
+ * compile time: same-kind and translation products have dedicated overloads,
+ * anything else promotes both sides to the higher rank and multiplies there.
+ * The result type is the cheapest kind that can represent the product, e.g.
+ * Translation * Affine2D is an Affine2D and costs 3 adds.
+ *
+ * Products involving a Translation or an Affine2D are constexpr, so fixed
+ * transforms can be composed by the compiler; Affine3D and Projective products
+ * use SSE at run time instead. Convert to a GLMatrix4 only for upload, through
+ * store() or GLMatrix4::setTransform().
+ *
+ ********************/
+struct Translation {
+	enum { RANK = 0 };
+	float x, y, z;
+
+	constexpr Translation(float x = 0, float y = 0, float z = 0) : x(x), y(y), z(z) {
+	}
+
+	void store(float *mat) const {
+		mat[0] = 1, mat[4] = 0, mat[8] = 0, mat[12] = x;
+		mat[1] = 0, mat[5] = 1, mat[9] = 0, mat[13] = y;
+		mat[2] = 0, mat[6] = 0, mat[10] = 1, mat[14] = z;
+		mat[3] = 0, mat[7] = 0, mat[11] = 0, mat[15] = 1;
+	}
+};
+
+//linear part column-major: x' = a*x + c*y + tx, y' = b*x + d*y + ty, z' = z + tz
+struct Affine2D {
+	enum { RANK = 1 };
+	float a, b, c, d;
+	float tx, ty, tz;
+
+	constexpr Affine2D(float a = 1, float b = 0, float c = 0, float d = 1, float tx = 0, float ty = 0, float tz = 0)
+		: a(a), b(b), c(c), d(d), tx(tx), ty(ty), tz(tz) {
+	}
+
+	constexpr Affine2D(const Translation &t) : a(1), b(0), c(0), d(1), tx(t.x), ty(t.y), tz(t.z) {
+	}
+
+	//counter-clockwise about the z axis
+	static Affine2D rotation(float theta) {
+		const float cs = cos(theta), sn = sin(theta);
+		return Affine2D(cs, sn, -sn, cs);
+	}
+
+	static constexpr Affine2D scaling(float sx, float sy) {
+		return Affine2D(sx, 0, 0, sy);
+	}
+
+	void store(float *mat) const {
+		mat[0] = a, mat[4] = c, mat[8] = 0, mat[12] = tx;
+		mat[1] = b, mat[5] = d, mat[9] = 0, mat[13] = ty;
+		mat[2] = 0, mat[6] = 0, mat[10] = 1, mat[14] = tz;
+		mat[3] = 0, mat[7] = 0, mat[11] = 0, mat[15] = 1;
+	}
+};
+
+//the upper three rows of the 4x4, row-major: row i is m[4i .. 4i+2] of the linear part, then the
+//translation m[4i+3]. Rows rather than columns so a product row is a sum of whole rows of the right
+//hand side, which compilers vectorize
+struct Affine3D {
+	enum { RANK = 2 };
+	float m[12];
+
+	constexpr Affine3D(float m0 = 1, float m1 = 0, float m2 = 0, float m3 = 0,
+	                   float m4 = 0, float m5 = 1, float m6 = 0, float m7 = 0,
+	                   float m8 = 0, float m9 = 0, float m10 = 1, float m11 = 0)
+		: m{ m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11 } {
+	}
+
+	constexpr Affine3D(const Translation &t) : m{ 1, 0, 0, t.x, 0, 1, 0, t.y, 0, 0, 1, t.z } {
+	}
+
+	constexpr Affine3D(const Affine2D &t) : m{ t.a, t.c, 0, t.tx, t.b, t.d, 0, t.ty, 0, 0, 1, t.tz } {
+	}
+
+	//from a column-major 4x4 whose last row is 0 0 0 1
+	static Affine3D fromMatrix(const float *mat) {
+		return Affine3D(mat[0], mat[4], mat[8], mat[12], mat[1], mat[5], mat[9], mat[13], mat[2], mat[6], mat[10], mat[14]);
+	}
+
+	void store(float *mat) const {
+		mat[0] = m[0], mat[4] = m[1], mat[8] = m[2], mat[12] = m[3];
+		mat[1] = m[4], mat[5] = m[5], mat[9] = m[6], mat[13] = m[7];
+		mat[2] = m[8], mat[6] = m[9], mat[10] = m[10], mat[14] = m[11];
+		mat[3] = 0, mat[7] = 0, mat[11] = 0, mat[15] = 1;
+	}
+};
+
+struct Projective {
+	enum { RANK = 3 };
+	float m[16];
+
+	Projective() {
+		Translation().store(m);
+	}
+
+	Projective(const Translation &t) {
+		t.store(m);
+	}
+
+	Projective(const Affine2D &t) {
+		t.store(m);
+	}
+
+	Projective(const Affine3D &t) {
+		t.store(m);
+	}
+
+	static Projective fromMatrix(const float *mat) {
+		Projective p;
+		for ( int i = 0; i < 16; ++i )
+			p.m[i] = mat[i];
+		return p;
+	}
+
+	void store(float *mat) const {
+		for ( int i = 0; i < 16; ++i )
+			mat[i] = m[i];
+	}
+};
+
+//the transform kind for a rank, and the kind two transforms compose into
+template<int Rank> struct TransformOfRank;
+template<> struct TransformOfRank<0> { typedef Translation type; };
+template<> struct TransformOfRank<1> { typedef Affine2D type; };
+template<> struct TransformOfRank<2> { typedef Affine3D type; };
+template<> struct TransformOfRank<3> { typedef Projective type; };
+
+template<class T> struct IsTransform : std::false_type {};
+template<> struct IsTransform<Translation> : std::true_type {};
+template<> struct IsTransform<Affine2D> : std::true_type {};
+template<> struct IsTransform<Affine3D> : std::true_type {};
+template<> struct IsTransform<Projective> : std::true_type {};
+
+//no type unless both are transforms, so the promoting operator* below drops out of overload resolution for anything else
+template<class A, class B, bool = IsTransform<A>::value && IsTransform<B>::value>
+struct TransformProduct {
+};
+
+template<class A, class B>
+struct TransformProduct<A, B, true> {
+	typedef typename TransformOfRank<((int) A::RANK > (int) B::RANK ? (int) A::RANK : (int) B::RANK)>::type type;
+};
+
+/********************
+ *
+ * Dedicated products. Costs are multiplies + adds.
+ *
+ ********************/
+
+//0 + 3
+constexpr Translation operator*(const Translation &a, const Translation &b) {
+	return Translation(a.x + b.x, a.y + b.y, a.z + b.z);
+}
+
+//12 + 9
+constexpr Affine2D operator*(const Affine2D &p, const Affine2D &q) {
+	return Affine2D(p.a * q.a + p.c * q.b, p.b * q.a + p.d * q.b,
+	                p.a * q.c + p.c * q.d, p.b * q.c + p.d * q.d,
+	                p.a * q.tx + p.c * q.ty + p.tx, p.b * q.tx + p.d * q.ty + p.ty, p.tz + q.tz);
+}
+
+//4 + 5
+constexpr Affine2D operator*(const Affine2D &p, const Translation &t) {
+	return Affine2D(p.a, p.b, p.c, p.d, p.a * t.x + p.c * t.y + p.tx, p.b * t.x + p.d * t.y + p.ty, p.tz + t.z);
+}
+
+//0 + 3
+constexpr Affine2D operator*(const Translation &t, const Affine2D &p) {
+	return Affine2D(p.a, p.b, p.c, p.d, p.tx + t.x, p.ty + t.y, p.tz + t.z);
+}
+
+//36 + 27; four-wide on SSE, one output row is a sum of scaled rows of q
+inline Affine3D operator*(const Affine3D &p, const Affine3D &q) {
+	Affine3D r;
+#ifdef CS177_USE_SSE
+	const __m128 q0 = _mm_loadu_ps(q.m), q1 = _mm_loadu_ps(q.m + 4), q2 = _mm_loadu_ps(q.m + 8);
+	for ( int i = 0; i < 3; ++i ) {
+		const float *row = p.m + 4 * i;
+		__m128 sum = _mm_mul_ps(_mm_set1_ps(row[0]), q0);
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(row[1]), q1));
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(row[2]), q2));
+		sum = _mm_add_ps(sum, _mm_set_ps(row[3], 0, 0, 0));
+		_mm_storeu_ps(r.m + 4 * i, sum);
+	}
+#else
+	for ( int i = 0; i < 3; ++i ) {
+		const float *row = p.m + 4 * i;
+		for ( int j = 0; j < 4; ++j )
+			r.m[4 * i + j] = row[0] * q.m[j] + row[1] * q.m[4 + j] + row[2] * q.m[8 + j];
+		r.m[4 * i + 3] += row[3];
+	}
+#endif
+	return r;
+}
+
+//9 + 9
+constexpr Affine3D operator*(const Affine3D &p, const Translation &t) {
+	return Affine3D(p.m[0], p.m[1], p.m[2], p.m[0] * t.x + p.m[1] * t.y + p.m[2] * t.z + p.m[3],
+	                p.m[4], p.m[5], p.m[6], p.m[4] * t.x + p.m[5] * t.y + p.m[6] * t.z + p.m[7],
+	                p.m[8], p.m[9], p.m[10], p.m[8] * t.x + p.m[9] * t.y + p.m[10] * t.z + p.m[11]);
+}
+
+//0 + 3
+constexpr Affine3D operator*(const Translation &t, const Affine3D &p) {
+	return Affine3D(p.m[0], p.m[1], p.m[2], p.m[3] + t.x,
+	                p.m[4], p.m[5], p.m[6], p.m[7] + t.y,
+	                p.m[8], p.m[9], p.m[10], p.m[11] + t.z);
+}
+
+//64 + 48, through the SIMD kernels
+inline Projective operator*(const Projective &p, const Projective &q) {
+	Projective r;
+	mat4Multiply(p.m, q.m, r.m);
+	return r;
+}
+
+//every other pair: promote both sides to the common kind
+template<class A, class B>
+constexpr typename TransformProduct<A, B>::type operator*(const A &a, const B &b) {
+	typedef typename TransformProduct<A, B>::type R;
+	return R(a) * R(b);
+}
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef CS177_UNIFORM_BLOCKS_HPP
+#define CS177_UNIFORM_BLOCKS_HPP
+
+#include "FlatScene.hpp"
+#include "ShaderReloader.hpp"
+
+/********************
+ *
+ * Drawing a FlatScene through uniform buffer objects.
+ *
+ * The plain paths bake the camera into every node's matrix on the CPU and
+ * upload 64 bytes per draw with glUniformMatrix4fv. Here the view and
+ * projection live in the Camera block (binding CAMERA_BINDING), written once
+ * per viewport, and the world matrices of all MeshNode entries go into one
+ * buffer in a single upload per frame, shared by every viewport. The shader
+ * (2d_ubo.vsh) picks its model matrix out of the Models block by a per-draw
+ * int, so a draw costs one glUniform1i and the camera never touches the
+ * model matrices.
+ *
+ * A uniform block is only guaranteed 16KB, so the matrices are stored in
+ * chunks of MODELS_PER_BLOCK, each starting on a multiple of
+ * GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, and draw() moves the Models binding
+ * with glBindBufferRange when it crosses into the next chunk. Entries are
+ * drawn in scene order, like FlatScene::draw, binding a mesh only when it
+ * changes.
+ *
+ * Call upload() once per frame after the update, then setCamera() and draw()
+ * per viewport. Needs ARB_uniform_buffer_object; check supported().
+ *
+ ********************/
+class UniformBlockRenderer {
+public:
+	enum { MODELS_PER_BLOCK = 256, CAMERA_BINDING = 0, MODELS_BINDING = 1 };
+
+private:
+	GLuint program;
+	GLint uniformModelIndex;
+	GLuint cameraUbo, modelUbo;
+	size_t chunkFloats;          //floats from one chunk's start to the next
+	vector<size_t> entries;      //FlatScene entries with a mesh, in scene order
+	vector<MeshNode*> meshNodes;
+	vector<GLfloat> modelData;
+	size_t drawCalls, uniformBytes;
+
+public:
+	UniformBlockRenderer() : program(0), uniformModelIndex(-1), cameraUbo(0), modelUbo(0), chunkFloats(0), drawCalls(0), uniformBytes(0) {
+	}
+
+	static bool supported() {
+		return GLEW_ARB_uniform_buffer_object != 0;
+	}
+
+	bool init(const char *vtxPath, const char *fragPath) {
+		if ( !supported() )
+			return false;
+		program = linkProgram(vtxPath, fragPath);
+		if ( !program )
+			return false;
+		const GLuint cameraBlock = glGetUniformBlockIndex(program, "Camera");
+		const GLuint modelsBlock = glGetUniformBlockIndex(program, "Models");
+		if ( cameraBlock == GL_INVALID_INDEX || modelsBlock == GL_INVALID_INDEX ) {
+			glDeleteProgram(program);
+			program = 0;
+			return false;
+		}
+		glUniformBlockBinding(program, cameraBlock, CAMERA_BINDING);
+		glUniformBlockBinding(program, modelsBlock, MODELS_BINDING);
+		uniformModelIndex = glGetUniformLocation(program, "modelIndex");
+
+		GLint alignment = 256;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		const size_t chunkBytes = MODELS_PER_BLOCK * 16 * sizeof(GLfloat);
+		chunkFloats = (chunkBytes + alignment - 1) / alignment * alignment / sizeof(GLfloat);
+
+		glGenBuffers(1, &cameraUbo);
+		glGenBuffers(1, &modelUbo);
+		glBindBuffer(GL_UNIFORM_BUFFER, cameraUbo);
+		glBufferData(GL_UNIFORM_BUFFER, 32 * sizeof(GLfloat), NULL, GL_DYNAMIC_DRAW);
+		glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_BINDING, cameraUbo);
+		return true;
+	}
+
+	bool ready() const {
+		return program != 0;
+	}
+
+	//reloads the program when its sources change, keeping the block bindings
+	void watchShaders(ShaderReloader &reloader, const char *vtxPath, const char *fragPath) {
+		const size_t id = reloader.watch(program, vtxPath, fragPath);
+		reloader.watchUniform(id, uniformModelIndex, "modelIndex");
+		reloader.watchBlock(id, "Camera", CAMERA_BINDING);
+		reloader.watchBlock(id, "Models", MODELS_BINDING);
+	}
+
+	//collects the drawable entries and uploads their meshes; again after the scene's topology changed
+	void build(const FlatScene &scene) {
+		entries.clear();
+		meshNodes.clear();
+		for ( size_t i = 0; i < scene.size(); ++i ) {
+			MeshNode *node = dynamic_cast<MeshNode*>(scene.nodes[i]);
+			if ( !node )
+				continue;
+			node->getMesh();
+			entries.push_back(i);
+			meshNodes.push_back(node);
+		}
+		const size_t chunks = (entries.size() + MODELS_PER_BLOCK - 1) / MODELS_PER_BLOCK;
+		modelData.assign(chunks * chunkFloats, 0.0f);
+	}
+
+	//uploads the world matrices of every entry in one go; once per frame, after the update
+	void upload(const FlatScene &scene) {
+		uniformBytes = 0;
+		for ( size_t k = 0; k < entries.size(); ++k )
+			memcpy(&modelData[k / MODELS_PER_BLOCK * chunkFloats + k % MODELS_PER_BLOCK * 16], scene.world(entries[k]), sizeof(GLfloat) * 16);
+		if ( modelData.empty() )
+			return;
+		glBindBuffer(GL_UNIFORM_BUFFER, modelUbo);
+		//orphan the old storage so the driver doesn't wait on the previous frame's draws
+		glBufferData(GL_UNIFORM_BUFFER, modelData.size() * sizeof(GLfloat), NULL, GL_STREAM_DRAW);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, modelData.size() * sizeof(GLfloat), &modelData[0]);
+		uniformBytes += modelData.size() * sizeof(GLfloat);
+	}
+
+	//writes the Camera block; once per viewport
+	void setCamera(const GLMatrix4 &view, const GLMatrix4 &projection) {
+		GLfloat camera[32];
+		memcpy(camera, view.mat, sizeof(view.mat));
+		memcpy(camera + 16, projection.mat, sizeof(projection.mat));
+		glBindBuffer(GL_UNIFORM_BUFFER, cameraUbo);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(camera), camera, GL_DYNAMIC_DRAW);
+		glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_BINDING, cameraUbo);
+		uniformBytes += sizeof(camera);
+	}
+
+	//draws every entry, or those marked in visible, with the last setCamera(); only entries [begin, end) with a range.
+	//Leaves the program bound
+	void draw(const char *visible = 0, size_t begin = 0, size_t end = (size_t) -1) {
+		glUseProgram(program);
+		drawCalls = 0;
+		size_t boundChunk = (size_t) -1;
+		Mesh *boundMesh = 0;
+		GLfloat boundLineWidth = -1;
+		const size_t last = lower_bound(entries.begin(), entries.end(), end) - entries.begin();
+		for ( size_t k = lower_bound(entries.begin(), entries.end(), begin) - entries.begin(); k < last; ++k ) {
+			if ( visible && !visible[entries[k]] )
+				continue;
+			const MeshNode &node = *meshNodes[k];
+			PROFILE_NODE(node.typeName());
+			const size_t chunk = k / MODELS_PER_BLOCK;
+			if ( chunk != boundChunk ) {
+				//always the whole block; the last chunk is padded out in modelData
+				glBindBufferRange(GL_UNIFORM_BUFFER, MODELS_BINDING, modelUbo, chunk * chunkFloats * sizeof(GLfloat), MODELS_PER_BLOCK * 16 * sizeof(GLfloat));
+				boundChunk = chunk;
+			}
+			Mesh *mesh = node.uploadedMesh();
+			if ( mesh != boundMesh ) {
+				mesh->bind();
+				boundMesh = mesh;
+			}
+			if ( node.getLineWidth() != boundLineWidth ) {
+				node.applyState();
+				boundLineWidth = node.getLineWidth();
+			}
+			glUniform1i(uniformModelIndex, (GLint) (k % MODELS_PER_BLOCK));
+			glDrawArrays(node.primitive(), 0, mesh->count);
+			uniformBytes += sizeof(GLint);
+			++drawCalls;
+		}
+	}
+
+	size_t lastDrawCalls() const {
+		return drawCalls;
+	}
+
+	//uniform data sent since the last upload(): the models, the cameras and the per-draw indices
+	size_t lastUniformBytes() const {
+		return uniformBytes;
+	}
+
+	void destroy() {
+		if ( program ) {
+			glDeleteBuffers(1, &cameraUbo);
+			glDeleteBuffers(1, &modelUbo);
+			glDeleteProgram(program);
+		}
+		program = 0;
+	}
+};
+
+#endif
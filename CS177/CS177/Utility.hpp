@@ -1,27 +1,267 @@
+#ifndef CS177_UTILITY_HPP
+#define CS177_UTILITY_HPP
+
 #include <GL/glew.h>
 #include <GL/glfw.h>
 #include <iostream>
 #include <cstdio>
+#include <cstring>
 #include <cmath>
 #include <cassert>
 #include <vector>
+#include <algorithm>
+#include <map>
+#include <cstddef>
+#include "MatrixKernels.hpp"
+#include "Quaternion.hpp"
+#include "ShaderManager.hpp"
 
 using namespace std;
 
 const GLfloat PI = 3.14159265358979323846264338327f;
-enum { ATTRIB_POS, ATTRIB_COLOR };
-GLuint UNIFORM_transfromationMatrix;
+static const double MY_PI = 3.14159265358979323846264338327;
+GLint UNIFORM_transfromationMatrix;
 
 struct Vtx {
 	GLfloat x, y, z;
 	GLuint color;
 };
 
+/********************
+ *
+ * GPU mesh resources.
+ *
+ * A Mesh is a Vtx array uploaded once into a static VBO, plus a VAO that
+ * records the attribute layout when the driver supports one. MeshCache hands
+ * out a single Mesh per distinct vertex array, so nodes with identical
+ * geometry share one buffer. Meshes live until MeshCache::clear(), which has
+ * to run while the GL context is still current.
+ *
+ ********************/
+struct Mesh {
+	GLuint vbo, vao;
+	GLint posComponents;
+	GLsizei count;
+	vector<Vtx> vertices;   //CPU copy, used to match identical geometry
+
+	void setAttribPointers() const {
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glVertexAttribPointer(ATTRIB_POS, posComponents, GL_FLOAT, GL_FALSE, sizeof(Vtx), (const GLvoid*) offsetof(Vtx, x));
+		glVertexAttribPointer(ATTRIB_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vtx), (const GLvoid*) offsetof(Vtx, color));
+	}
+
+	void bind() const {
+		if ( vao )
+			glBindVertexArray(vao);
+		else
+			setAttribPointers();
+	}
+};
+
+class MeshCache {
+	multimap<unsigned, Mesh*> meshes;   //keyed by a hash of the vertex data
+	size_t uploadedBytes;
+
+	static unsigned hash(const Vtx *vtx, size_t count, GLint posComponents) {
+		//FNV-1a
+		unsigned h = 2166136261u ^ (unsigned) posComponents;
+		const unsigned char *bytes = (const unsigned char*) vtx;
+		for ( size_t i = 0; i < count * sizeof(Vtx); ++i )
+			h = (h ^ bytes[i]) * 16777619u;
+		return h;
+	}
+
+public:
+	MeshCache() : uploadedBytes(0) {
+	}
+
+	Mesh *acquire(const Vtx *vtx, size_t count, GLint posComponents) {
+		const unsigned h = hash(vtx, count, posComponents);
+		typedef multimap<unsigned, Mesh*>::iterator Iter;
+		pair<Iter, Iter> range = meshes.equal_range(h);
+		for ( Iter it = range.first; it != range.second; ++it ) {
+			Mesh *m = it->second;
+			if ( m->posComponents == posComponents && m->vertices.size() == count &&
+			     memcmp(&m->vertices[0], vtx, count * sizeof(Vtx)) == 0 )
+				return m;
+		}
+
+		Mesh *m = new Mesh;
+		m->posComponents = posComponents;
+		m->count = (GLsizei) count;
+		m->vertices.assign(vtx, vtx + count);
+		glGenBuffers(1, &m->vbo);
+		glBindBuffer(GL_ARRAY_BUFFER, m->vbo);
+		glBufferData(GL_ARRAY_BUFFER, count * sizeof(Vtx), vtx, GL_STATIC_DRAW);
+		uploadedBytes += count * sizeof(Vtx);
+
+		m->vao = 0;
+		if ( GLEW_ARB_vertex_array_object ) {
+			glGenVertexArrays(1, &m->vao);
+			glBindVertexArray(m->vao);
+			glEnableVertexAttribArray(ATTRIB_POS);
+			glEnableVertexAttribArray(ATTRIB_COLOR);
+			m->setAttribPointers();
+			glBindVertexArray(0);
+		}
+		meshes.insert(make_pair(h, m));
+		return m;
+	}
+
+	size_t size() const {
+		return meshes.size();
+	}
+
+	size_t bytesUploaded() const {
+		return uploadedBytes;
+	}
+
+	void clear() {
+		for ( multimap<unsigned, Mesh*>::iterator it = meshes.begin(); it != meshes.end(); ++it ) {
+			Mesh *m = it->second;
+			if ( m->vao )
+				glDeleteVertexArrays(1, &m->vao);
+			glDeleteBuffers(1, &m->vbo);
+			delete m;
+		}
+		meshes.clear();
+		uploadedBytes = 0;
+	}
+
+	//no GL calls here: the context is usually gone by the time statics are destroyed
+	~MeshCache() {
+		for ( multimap<unsigned, Mesh*>::iterator it = meshes.begin(); it != meshes.end(); ++it )
+			delete it->second;
+	}
+};
+
+inline MeshCache &globalMeshCache() {
+	static MeshCache cache;
+	return cache;
+}
+
+struct GLMatrix4;
+
+/********************
+ *
+ * Log of the transforms that changed, so a cache (see FlatScene.hpp) visits
+ * those instead of checking every transform it holds.
+ *
+ * A GLMatrix4 is watched by at most one log, which gives it a slot. Every
+ * mutating member then queues the slot once until the owner calls drained().
+ * A matrix being destroyed leaves its slot empty, and a log going away lets
+ * go of its matrices. Not thread safe: the transforms must change on the
+ * thread that drains the log.
+ *
+ ********************/
+class TransformLog {
+	vector<GLMatrix4*> watched;  //per slot, 0 once the matrix is gone
+	vector<char> queued;
+	vector<unsigned> changed;    //slots changed since the last drained()
+	TransformLog(const TransformLog &);
+	TransformLog &operator=(const TransformLog &);
+public:
+	TransformLog() {
+	}
+
+	~TransformLog() {
+		clear();
+	}
+
+	//returns t's slot, or -1 when another log watches it already
+	inline int watch(GLMatrix4 &t);
+	//lets go of every matrix
+	inline void clear();
+
+	void mark(unsigned slot) {
+		if ( queued[slot] )
+			return;
+		queued[slot] = 1;
+		changed.push_back(slot);
+	}
+
+	void forget(unsigned slot) {
+		watched[slot] = 0;
+	}
+
+	//the matrix in a slot, 0 if it was destroyed
+	GLMatrix4 *matrix(unsigned slot) const {
+		return watched[slot];
+	}
+
+	const vector<unsigned> &changes() const {
+		return changed;
+	}
+
+	void drained() {
+		for ( size_t i = 0; i < changed.size(); ++i )
+			queued[changed[i]] = 0;
+		changed.clear();
+	}
+};
+
+/********************
+ *
+ * 4x4 OpenGL Matrix class
+ *
+ * revision is bumped by every mutating member so caches (see FlatScene.hpp)
+ * can tell that a transform changed without comparing all 16 floats, and a
+ * watching TransformLog hears of it. Writing to mat[] directly bypasses both
+ * until touch() is called. Copies are not watched.
+ *
+ ********************/
 struct GLMatrix4 {
 	GLfloat mat[16];
+	unsigned revision;
+	TransformLog *log;
+	unsigned logSlot;
 
-	void create_rotation_matrix_4x4(GLfloat x, GLfloat y, GLfloat z, GLfloat theta, GLfloat mat[]){
+	GLMatrix4() : revision(0), log(0), logSlot(0) {
+	}
 
+	GLMatrix4(const GLMatrix4 &rhs) : revision(rhs.revision), log(0), logSlot(0) {
+		memcpy(mat, rhs.mat, sizeof(mat));
+	}
+
+	~GLMatrix4() {
+		if ( log )
+			log->forget(logSlot);
+	}
+
+	//call after changing mat[] directly
+	void touch() {
+		++revision;
+		if ( log )
+			log->mark(logSlot);
+	}
+
+	//unlike the X/Y/Z versions, (x, y, z) is the axis here, through the origin
+	void create_rotation_matrix_4x4(GLfloat x, GLfloat y, GLfloat z, GLfloat theta, GLfloat mat[]){
+		Quaternion::fromAxisAngle(x, y, z, theta).toMatrix(mat);
+	}
+	
+	void create_rotation_matrix_4x4Y(GLfloat x, GLfloat y, GLfloat z, GLfloat theta, GLfloat *mat){
+		const GLfloat c = cos(theta), s = sin(theta);
+		mat[0] = c, mat[4] = 0, mat[8] = s,	mat[12] = (x*(1-c))-(z*s);
+		mat[1] = 0, mat[5] = 1, mat[9] = 0,	mat[13] = 0;
+		mat[2] = -1*s, mat[6] = 0, mat[10] = c, mat[14] = (x*s )+ (z*(1-c));
+		mat[3] = 0, mat[7] = 0, mat[11] =0, mat[15] = 1;
+	}
+	
+	void create_rotation_matrix_4x4X(GLfloat x, GLfloat y, GLfloat z, GLfloat theta, GLfloat *mat) {
+		const GLfloat c = cos(theta), s = sin(theta);
+		mat[0] = 1, mat[4] = 0, mat[8] = 0,	mat[12] = 0;
+		mat[1] = 0, mat[5] = c, mat[9] = -1*s,	mat[13] = (s*z)+(y*(1-c));
+		mat[2] = 0, mat[6] = s, mat[10] = c, mat[14] = (-1*y*s)+(z*(1-c));
+		mat[3] = 0, mat[7] = 0, mat[11] =0, mat[15] = 1;
+	}
+	
+	void create_rotation_matrix_4x4Z(GLfloat x, GLfloat y, GLfloat z, GLfloat theta, GLfloat *mat) {
+		const GLfloat c = cos(theta), s = sin(theta);
+		mat[0] = c, mat[4] = -s, mat[8] = 0,	mat[12] = (x*(1-c))+(y*s);
+		mat[1] = s, mat[5] = c, mat[9] = 0,	mat[13] = (y*(1-c))-(-1*s*x);
+		mat[2] = 0, mat[6] = 0, mat[10] = 1, mat[14] = 0;
+		mat[3] = 0, mat[7] = 0, mat[11] =0, mat[15] = 1;
 	}
 	
 	void setIdentity() {
@@ -29,10 +269,27 @@ struct GLMatrix4 {
 		mat[1] = 0, mat[5] = 1, mat[9] = 0, mat[13] = 0;
 		mat[2] = 0, mat[6] = 0, mat[10] = 1, mat[14] = 0;
 		mat[3] = 0, mat[7] = 0, mat[11] = 0, mat[15] = 1;
+		touch();
 	}
 	
 	void setRotation(GLfloat x, GLfloat y, GLfloat z, GLfloat theta) {
 		create_rotation_matrix_4x4(x, y, z, theta, mat);
+		touch();
+	}
+	
+	void setRotationX(GLfloat x, GLfloat y, GLfloat z, GLfloat theta) {
+		create_rotation_matrix_4x4X(x, y, z, theta, mat);
+		touch();
+	}
+	
+	void setRotationY(GLfloat x, GLfloat y, GLfloat z, GLfloat theta) {
+		create_rotation_matrix_4x4Y(x, y, z, theta, mat);
+		touch();
+	}
+	
+	void setRotationZ(GLfloat x, GLfloat y, GLfloat z, GLfloat theta) {
+		create_rotation_matrix_4x4Z(x, y, z, theta, mat);
+		touch();
 	}
 	
 	void setTranslation(GLfloat x, GLfloat y, GLfloat z) {
@@ -40,12 +297,14 @@ struct GLMatrix4 {
 		mat[1] = 0, mat[5] = 1, mat[9] = 0, mat[13] = y;
 		mat[2] = 0, mat[6] = 0, mat[10] = 1, mat[14] = z;
 		mat[3] = 0, mat[7] = 0, mat[11] = 0, mat[15] = 1;
+		touch();
 	}
 
 	void translate(GLfloat x, GLfloat y, GLfloat z) {
 		mat[12] += x;
 		mat[13] += y;
 		mat[14] += z;
+		touch();
 	}
 	
 	void scale(GLfloat sx, GLfloat sy, GLfloat sz) {
@@ -63,6 +322,7 @@ struct GLMatrix4 {
 		mat[6] *= sz;
 		mat[10] *= sz;
 		mat[14] *= sz;
+		touch();
 	}
 	
 	void transpose() {
@@ -72,63 +332,83 @@ struct GLMatrix4 {
 		swap(mat[9],mat[6]);
 		swap(mat[13],mat[7]);
 		swap(mat[14], mat[11]);
+		touch();
 	}
 	
+	//stores one of the specialized transforms from Transforms.hpp
+	template<class Transform>
+	void setTransform(const Transform &t) {
+		t.store(mat);
+		touch();
+	}
+
 	GLMatrix4& operator=(const GLMatrix4 &rhs) {
 		memcpy(mat, rhs.mat, sizeof(mat));
+		touch();
 		return *this;
 	}
 	
 	GLMatrix4 operator*(const GLMatrix4 &rhs) const {
 		GLMatrix4 ret;
-		
-		for(int i = 0; i < 4; ++i){
-			ret.mat[0+i] = mat[0+i]*rhs.mat[0]+mat[4+i]*rhs.mat[1]+mat[8+i]*rhs.mat[2]+mat[12+i]*rhs.mat[3];
-		}
-		for(int i = 0; i < 4; ++i){
-			ret.mat[4+i] = mat[0+i]*rhs.mat[4]+mat[4+i]*rhs.mat[5]+mat[8+i]*rhs.mat[6]+mat[12+i]*rhs.mat[7];
-		}
-		for(int i = 0; i < 4; ++i){
-			ret.mat[8+i] = mat[0+i]*rhs.mat[8]+mat[4+i]*rhs.mat[9]+mat[8+i]*rhs.mat[10]+mat[12+i]*rhs.mat[11];
-		}
-		for(int i = 0; i < 4; ++i){
-			ret.mat[12+i] = mat[0+i]*rhs.mat[12]+mat[4+i]*rhs.mat[13]+mat[8+i]*rhs.mat[14]+mat[12+i]*rhs.mat[15];
-		}
-		
+		mat4Multiply(mat, rhs.mat, ret.mat);
 		return ret;
 	}
 	
 	GLMatrix4& operator*=(const GLMatrix4 &rhs) {
-		GLfloat tmp[16];
-		for(int i = 0; i < 4; ++i){
-			tmp[0+i] = mat[0+i]*rhs.mat[0]+mat[4+i]*rhs.mat[1]+mat[8+i]*rhs.mat[2]+mat[12+i]*rhs.mat[3];
-		}
-		for(int i = 0; i < 4; ++i){
-			tmp[4+i] = mat[0+i]*rhs.mat[4]+mat[4+i]*rhs.mat[5]+mat[8+i]*rhs.mat[6]+mat[12+i]*rhs.mat[7];
-		}
-		for(int i = 0; i < 4; ++i){
-			tmp[8+i] = mat[0+i]*rhs.mat[8]+mat[4+i]*rhs.mat[9]+mat[8+i]*rhs.mat[10]+mat[12+i]*rhs.mat[11];
-		}
-		for(int i = 0; i < 4; ++i){
-			tmp[12+i] = mat[0+i]*rhs.mat[12]+mat[4+i]*rhs.mat[13]+mat[8+i]*rhs.mat[14]+mat[12+i]*rhs.mat[15];
-		}
-		
-		memcpy(mat, tmp, sizeof(mat));
+		mat4Multiply(mat, rhs.mat, mat);
+		touch();
 		return *this;
 	}
 };
 
+int TransformLog::watch(GLMatrix4 &t) {
+	if ( t.log == this )
+		return (int) t.logSlot;
+	if ( t.log )
+		return -1;
+	t.log = this;
+	t.logSlot = (unsigned) watched.size();
+	watched.push_back(&t);
+	queued.push_back(0);
+	return (int) t.logSlot;
+}
+
+void TransformLog::clear() {
+	for ( size_t i = 0; i < watched.size(); ++i )
+		if ( watched[i] )
+			watched[i]->log = 0;
+	watched.clear();
+	queued.clear();
+	changed.clear();
+}
+
+/********************
+ *
+ * Scene Node class used to implement a transformation hierarchy.
+ *
+ * draw() composes the transform and recurses; derived classes only override
+ * drawSelf() to issue their own GL calls for an already composed transform,
+ * which lets other traversals (see FlatScene.hpp) reuse them.
+ *
+ ********************/
 class SceneNode {
 public:
 	GLMatrix4 transform;
 	vector<SceneNode*> children;
+	//nothing under this node moves relative to it, so the subtree may be baked into one mesh (see StaticBatches.hpp)
+	bool staticSubtree;
 
-	SceneNode() {
+	SceneNode() : staticSubtree(false) {
 		transform.setIdentity();
 	}
 
 	virtual void draw(const GLMatrix4 &parentTransform) {
-		drawChildren(parentTransform * transform);
+		const GLMatrix4 &t = parentTransform * transform;
+		drawSelf(t);
+		drawChildren(t);
+	}
+	
+	virtual void drawSelf(const GLMatrix4 &) {
 	}
 	
 	virtual void update(double t) {
@@ -136,6 +416,16 @@ public:
 			children[i]->update(t);
 	}
 	
+	//a static string naming the concrete class, used to group profiling results
+	virtual const char *typeName() const {
+		return "SceneNode";
+	}
+	
+	//box of the node's own geometry in its local space, as in Bounds.hpp; false if it draws nothing itself
+	virtual bool localBounds(GLfloat [6]) const {
+		return false;
+	}
+	
 	void drawChildren(const GLMatrix4 &t) {
 		for ( size_t i = 0; i < children.size(); ++i )
 			children[i]->draw(t);
@@ -145,66 +435,246 @@ public:
 	}
 };
 
-class RectNode : public SceneNode {
-	Vtx vtx[4];
+
+/********************
+ *
+ * Base for nodes that draw one Vtx array as a single primitive.
+ *
+ * The vertices are uploaded through globalMeshCache() the first time the node
+ * is drawn (so nodes can still be built before a context exists) and must not
+ * change afterwards. A lineWidth of 0 leaves the line state alone.
+ *
+ ********************/
+class MeshNode : public SceneNode {
+protected:
+	vector<Vtx> vertices;
+	GLint posComponents;
+	GLenum mode;
 	GLfloat lineWidth;
+	Mesh *mesh;
 public:
-	RectNode(void){
-	
+	MeshNode(size_t vertexCount, GLint posComponents, GLenum mode, GLfloat lineWidth = 0) : vertices(vertexCount), posComponents(posComponents), mode(mode), lineWidth(lineWidth), mesh(0) {
+	}
+
+	Mesh *getMesh() {
+		if ( !mesh )
+			mesh = globalMeshCache().acquire(&vertices[0], vertices.size(), posComponents);
+		return mesh;
 	}
-	RectNode(GLfloat width, GLfloat height, GLuint color, GLfloat lineWidth) : lineWidth(lineWidth) {
-		vtx[0].x = -width/2;
-		vtx[0].y = height/2;
-		vtx[0].z = 0;
-		vtx[0].color = color;
 
-		vtx[1].x = -width/2;
-		vtx[1].y = -height/2;
-		vtx[1].z = 0;
-		vtx[1].color = color;
+	//null until getMesh() ran; safe to call off the GL thread
+	Mesh *uploadedMesh() const {
+		return mesh;
+	}
+
+	GLenum primitive() const {
+		return mode;
+	}
+
+	GLfloat getLineWidth() const {
+		return lineWidth;
+	}
+
+	const vector<Vtx> &getVertices() const {
+		return vertices;
+	}
+
+	GLint getPosComponents() const {
+		return posComponents;
+	}
+
+	//the fixed-function state this node needs besides its mesh
+	void applyState() const {
+		if ( lineWidth > 0 ) {
+			glEnable(GL_LINE_SMOOTH);
+			glLineWidth(lineWidth);
+		}
+	}
+
+	virtual void drawSelf(const GLMatrix4 &t) {
+		applyState();
+		getMesh()->bind();
+		glUniformMatrix4fv(UNIFORM_transfromationMatrix, 1, false, t.mat);
+		glDrawArrays(mode, 0, mesh->count);
+	}
+
+	virtual const char *typeName() const {
+		return "MeshNode";
+	}
+
+	virtual bool localBounds(GLfloat box[6]) const {
+		if ( vertices.empty() )
+			return false;
+		box[0] = box[3] = vertices[0].x;
+		box[1] = box[4] = vertices[0].y;
+		box[2] = box[5] = posComponents > 2 ? vertices[0].z : 0;
+		for ( size_t i = 1; i < vertices.size(); ++i ) {
+			const Vtx &v = vertices[i];
+			box[0] = min(box[0], v.x), box[3] = max(box[3], v.x);
+			box[1] = min(box[1], v.y), box[4] = max(box[4], v.y);
+			if ( posComponents > 2 )
+				box[2] = min(box[2], v.z), box[5] = max(box[5], v.z);
+		}
+		return true;
+	}
+};
+
+
+class RegularPolygonNode : public MeshNode {
+public:
+	virtual const char *typeName() const {
+		return "RegularPolygonNode";
+	}
+
+	RegularPolygonNode(GLfloat radius, GLuint sides, GLuint color) : MeshNode(2 + max(sides,3u), 2, GL_TRIANGLE_FAN) {
+		sides = max(sides,3u);
+		vertices.front().x = vertices.front().y = 0;
+		vertices.front().color = color;
+		
+		for ( size_t i = 0; i < sides; ++i ) {
+			const double angle = 2.0 * i * MY_PI/(double)sides;
+			vertices[i + 1].x = radius * cos(angle);
+			vertices[i + 1].y = radius * sin(angle);
+			vertices[i + 1].color = color;
+		}
+		vertices.back().x = radius;
+		vertices.back().y = 0;
+		vertices.back().color = color;
+	}
+};
+
+
+class CoordinateFrameNode : public MeshNode {
+public:
+	virtual const char *typeName() const {
+		return "CoordinateFrameNode";
+	}
+
+	CoordinateFrameNode(GLuint xColor, GLuint yColor) : MeshNode(9 * 2, 2, GL_TRIANGLES) {
+		const GLfloat lineWidth = 0.03f;
+		//Y-axis
+		//the arrowhead
+		vertices[0].x = 0;
+		vertices[0].y = 1.0f;
+		vertices[0].color = yColor;
+		vertices[1].x = -0.1f;
+		vertices[1].y = 0.9f;
+		vertices[1].color = yColor;
+		vertices[2].x = 0.1f;
+		vertices[2].y = 0.9f;
+		vertices[2].color = yColor;
 		
-		vtx[2].x = width/2;
-		vtx[2].y = -height/2;
-		vtx[2].z = 0;
-		vtx[2].color = color;
+		//the line itself (which is a Rect)
+		vertices[3].x = lineWidth;
+		vertices[3].y = 0.9f;
+		vertices[3].color = yColor;
+		vertices[4].x = -lineWidth;
+		vertices[4].y = 0.9f;
+		vertices[4].color = yColor;
+		vertices[5].x = -lineWidth;
+		vertices[5].y = 0;
+		vertices[5].color = yColor;
+		vertices[6].x = lineWidth;
+		vertices[6].y = 0.9f;
+		vertices[6].color = yColor;
+		vertices[7].x = -lineWidth;
+		vertices[7].y = 0;
+		vertices[7].color = yColor;
+		vertices[8].x = lineWidth;
+		vertices[8].y = 0;
+		vertices[8].color = yColor;
 		
-		vtx[3].x = width/2;
-		vtx[3].y = height/2;
-		vtx[3].z = 0;
-		vtx[3].color = color;
+		//X-axis
+		//the arrowhead
+		vertices[9].y = 0;
+		vertices[9].x = 1.0f;
+		vertices[9].color = xColor;
+		vertices[10].y = 0.1f;
+		vertices[10].x = 0.9f;
+		vertices[10].color = xColor;
+		vertices[11].y = -0.1f;
+		vertices[11].x = 0.9f;
+		vertices[11].color = xColor;
+		
+		//the line itself (which is a Rect)
+		vertices[12].y = -lineWidth;
+		vertices[12].x = 0.9f;
+		vertices[12].color = xColor;
+		vertices[13].y = lineWidth;
+		vertices[13].x = 0.9f;
+		vertices[13].color = xColor;
+		vertices[14].y = lineWidth;
+		vertices[14].x = 0;
+		vertices[14].color = xColor;
+		vertices[15].y = -lineWidth;
+		vertices[15].x = 0.9f;
+		vertices[15].color = xColor;
+		vertices[16].y = lineWidth;
+		vertices[16].x = 0;
+		vertices[16].color = xColor;
+		vertices[17].y = -lineWidth;
+		vertices[17].x = 0;
+		vertices[17].color = xColor;
 	}
-	
-	virtual void draw(const GLMatrix4 &parentTransform) {
+};
 
-		const GLMatrix4 &t = parentTransform * transform;
-		glVertexAttribPointer(ATTRIB_POS, 3, GL_FLOAT, GL_FALSE, sizeof(Vtx), &vtx[0].x);
-		glVertexAttribPointer(ATTRIB_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vtx), &vtx[0].color);
-		glUniformMatrix4fv(UNIFORM_transfromationMatrix, 1, false, t.mat);
+//mode is GL_LINE_LOOP for an outline (the camera frame) or GL_TRIANGLE_FAN for a filled rect
+class RectNode : public MeshNode {
+public:
+	virtual const char *typeName() const {
+		return "RectNode";
+	}
+
+	RectNode(void) : MeshNode(4, 3, GL_LINE_LOOP, 1) {
+	
+	}
+	RectNode(GLfloat width, GLfloat height, GLuint color, GLfloat lineWidth, GLenum mode = GL_LINE_LOOP) : MeshNode(4, 3, mode, lineWidth) {
+		vertices[0].x = -width/2;
+		vertices[0].y = height/2;
+		vertices[0].z = 0;
+		vertices[0].color = color;
 		
-		glEnable(GL_LINE_SMOOTH);
-		glLineWidth(lineWidth);
-		//glDrawArrays(GL_LINE_LOOP, 0, 4);
-		glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-		drawChildren(t);
+		vertices[1].x = -width/2;
+		vertices[1].y = -height/2;
+		vertices[1].z = 0;
+		vertices[1].color = color;
+		
+		vertices[2].x = width/2;
+		vertices[2].y = -height/2;
+		vertices[2].z = 0;
+		vertices[2].color = color;
+		
+		vertices[3].x = width/2;
+		vertices[3].y = height/2;
+		vertices[3].z = 0;
+		vertices[3].color = color;
 	}
 };
 
+//the children point at the members, so a HandNode can't be copied
 class HandNode : public SceneNode {
 	GLfloat lineWidth;
 	RectNode base1,base2,side1,side2,side3,side4;
+	HandNode(const HandNode &);
+	HandNode &operator=(const HandNode &);
 public:
-	HandNode(GLfloat width, GLfloat height, GLfloat length, GLuint color, GLfloat lineWidth) : lineWidth(lineWidth) {
-		base1 = RectNode(width,length,color,lineWidth);
-		base2 = RectNode(width,length,color,lineWidth);
+	virtual const char *typeName() const {
+		return "HandNode";
+	}
+
+	//the parts are built in place rather than copied from temporaries
+	HandNode(GLfloat width, GLfloat height, GLfloat length, GLuint color, GLfloat lineWidth) : lineWidth(lineWidth),
+		base1(width,length,color,lineWidth,GL_TRIANGLE_FAN),
+		base2(width,length,color,lineWidth,GL_TRIANGLE_FAN),
+		side1(width,height,color,lineWidth,GL_TRIANGLE_FAN),
+		side2(width,height,color,lineWidth,GL_TRIANGLE_FAN),
+		side3(width,height,color,lineWidth,GL_TRIANGLE_FAN),
+		side4(width,height,color,lineWidth,GL_TRIANGLE_FAN) {
 		base2.transform.translate(-1,0,0);
 		base2.transform.scale(2,0,0);
-		side1 = RectNode(width,height,color,lineWidth);
 		side1.transform.translate(.5,0,0);
-		side2 = RectNode(width,height,color,lineWidth);
 		side2.transform.translate(-.5,0,0);
-		side3 = RectNode(width,height,color,lineWidth);
 		side3.transform.translate(0,.5,0);
-		side4 = RectNode(width,height,color,lineWidth);
 		side4.transform.translate(0,-.5,0);
 		children.push_back(&base1);
 		children.push_back(&base2);
@@ -213,31 +683,19 @@ public:
 		children.push_back(&side3);
 		children.push_back(&side4);
 	}
-	
-	virtual void draw(const GLMatrix4 &parentTransform) {
-		const GLMatrix4 &t = parentTransform * transform;
-		drawChildren(t);
-	}
 };
 
 bool loadShaderSource(GLuint shader, const char *filePath) {
-	FILE *f = fopen(filePath, "r");
-	if ( !f ) {
+	MappedFile source;
+	if ( !source.open(filePath) ) {
 		cerr << "Cannot find file: " << filePath << '\n';
 		return false;
 	}
-	fseek(f, 0, SEEK_END);
-	const size_t sz = ftell(f) + 1;
-	fseek(f, 0, SEEK_SET);
-	
-	GLchar *buffer = new GLchar[sz];
-	fread(buffer, 1, sz, f);
-	fclose(f);
-	buffer[sz-1] = 0;
-	glShaderSource(shader, 1, (const GLchar**) &buffer, NULL);
+	const GLchar *text = source.data();
+	const GLint length = (GLint) source.size();
+	glShaderSource(shader, 1, &text, &length);
 	
 	glCompileShader(shader);
-	delete [] buffer;
 	
 	GLint logLength;
 	glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logLength);
@@ -250,3 +708,11 @@ bool loadShaderSource(GLuint shader, const char *filePath) {
 	
 	return true;
 }
+
+//compiles and links a vertex/fragment pair with the standard attribute locations, or takes it
+//from the program binary cache or a globalShaderManager().start() already under way; 0 on failure
+GLuint linkProgram(const char *vtxPath, const char *fragPath) {
+	return globalShaderManager().link(vtxPath, fragPath);
+}
+
+#endif
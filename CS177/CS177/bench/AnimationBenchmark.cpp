@@ -0,0 +1,80 @@
+/********************
+ *
+ * Sampling benchmark for KeyframeAnimation (Animation.hpp). No GL context is
+ * needed.
+ *
+ * Build (from CS177/CS177):
+ *   g++ -O2 -std=c++11 -msse2 -I. bench/AnimationBenchmark.cpp -o animation_bench -lGLEW -lGL -lpthread
+ * Run:
+ *   ./animation_bench [tracks...]        (default 1000 10000 100000)
+ *
+ * Every track gets 33 random keys. For each size it reports, per frame and
+ * per track: sample() (SSE) against sampleScalar(), apply() into the node
+ * transforms, and the round trip through AnimationWorker (request + wait with
+ * nothing to overlap, so the thread handoff cost shows). All numbers are the
+ * best of 5 runs of 100 frames.
+ *
+ ********************/
+#include "../Animation.hpp"
+#include <cstdlib>
+
+using namespace std;
+
+typedef chrono::high_resolution_clock Clock;
+
+static float frand() {
+	return rand() / (float) RAND_MAX * 2 - 1;
+}
+
+enum { FRAMES = 100, TRIALS = 5 };
+
+//ms per frame of the fastest trial
+template<class F>
+static double perFrame(F f) {
+	double best = 1e30;
+	for ( int trial = 0; trial < TRIALS; ++trial ) {
+		const Clock::time_point start = Clock::now();
+		for ( int frame = 0; frame < FRAMES; ++frame )
+			f(frame / 60.0);
+		best = min(best, chrono::duration<double, milli>(Clock::now() - start).count() / FRAMES);
+	}
+	return best;
+}
+
+int main(int argc, char **argv) {
+	vector<size_t> sizes;
+	for ( int i = 1; i < argc; ++i )
+		sizes.push_back((size_t) atol(argv[i]));
+	if ( sizes.empty() ) {
+		sizes.push_back(1000);
+		sizes.push_back(10000);
+		sizes.push_back(100000);
+	}
+
+	printf("%8s %10s %10s %8s %10s %10s %12s\n", "tracks", "sse ms", "scalar ms", "speedup", "apply ms", "ns/track", "worker ms");
+	for ( size_t s = 0; s < sizes.size(); ++s ) {
+		srand(1);
+		const size_t tracks = sizes[s], keyCount = 33;
+		KeyframeAnimation animation(tracks, keyCount, 8);
+		vector<SceneNode> nodes(tracks);
+		for ( size_t t = 0; t < tracks; ++t ) {
+			animation.setTarget(t, &nodes[t]);
+			for ( size_t k = 0; k < keyCount; ++k ) {
+				TrackKey key = { { frand(), frand(), 0 }, Quaternion::fromAxisAngle(0, 0, 1, frand() * 3), { 1 + frand() * 0.5f, 1, 1 } };
+				animation.setKey(t, k, key);
+			}
+		}
+
+		const double sseMs = perFrame([&](double time) { animation.sample(time); });
+		const double scalarMs = perFrame([&](double time) { animation.sampleScalar(time); });
+		const double applyMs = perFrame([&](double) { animation.apply(); });
+		AnimationWorker worker(animation);
+		const double workerMs = perFrame([&](double time) {
+			worker.request(time);
+			worker.wait();
+		});
+		printf("%8lu %10.3f %10.3f %7.2fx %10.3f %10.2f %12.3f\n", (unsigned long) tracks, sseMs, scalarMs, scalarMs / sseMs,
+		       applyMs, 1e6 * (sseMs + applyMs) / tracks, workerMs);
+	}
+	return 0;
+}
@@ -0,0 +1,198 @@
+/********************
+ *
+ * Spatial query benchmark for SceneBVH (BVH.hpp). No GL context is needed.
+ *
+ * Build (from CS177/CS177):
+ *   g++ -O2 -std=c++11 -I. bench/BVHBenchmark.cpp -o bvh_bench -lGLEW -lGL
+ * Run:
+ *   ./bvh_bench [nodes...]          (default 10000 100000 1000000)
+ *
+ * Each scene is made of groups scattered randomly over [-1, 1], with 32
+ * small polygons per group. For point, rectangle (1% of the view) and ray
+ * queries it reports the average latency of the BVH against two brute-force
+ * baselines: a linear scan over FlatScene's cached world boxes, and a
+ * recursive walk of SceneNode::children that composes the transforms and
+ * bounds on the fly. Hit counts are compared between the BVH and both
+ * baselines. Queries run on the freshly built tree; build and refit times, and
+ * the SAH cost before and after a refit that moves every fourth group (the
+ * loosening that should eventually trigger a rebuild), are printed too.
+ *
+ ********************/
+#include "../BVH.hpp"
+#include <chrono>
+#include <cstdlib>
+
+using namespace std;
+
+typedef chrono::high_resolution_clock Clock;
+
+static double usSince(const Clock::time_point &start) {
+	return chrono::duration<double, micro>(Clock::now() - start).count();
+}
+
+static float frand() {
+	return rand() / (float) RAND_MAX;
+}
+
+enum { QUERY_POINT, QUERY_RECT, QUERY_RAY, QUERY_KINDS };
+static const char *queryNames[QUERY_KINDS] = { "point", "rect", "ray" };
+
+struct Query {
+	GLfloat point[3];
+	GLfloat rect[6];
+	GLfloat dir[3];
+};
+
+static bool hit(int kind, const Query &q, const GLfloat box[6]) {
+	if ( boxIsEmpty(box) )
+		return false;
+	if ( kind == QUERY_POINT )
+		return q.point[0] >= box[0] && q.point[0] <= box[3] && q.point[1] >= box[1] && q.point[1] <= box[4] && q.point[2] >= box[2] && q.point[2] <= box[5];
+	if ( kind == QUERY_RECT )
+		return q.rect[0] <= box[3] && box[0] <= q.rect[3] && q.rect[1] <= box[4] && box[1] <= q.rect[4] && q.rect[2] <= box[5] && box[2] <= q.rect[5];
+	GLfloat tNear = 0, tFar = FLT_MAX;
+	for ( int a = 0; a < 3; ++a ) {
+		if ( q.dir[a] == 0 ) {
+			if ( q.point[a] < box[a] || q.point[a] > box[a + 3] )
+				return false;
+			continue;
+		}
+		GLfloat t0 = (box[a] - q.point[a]) / q.dir[a], t1 = (box[a + 3] - q.point[a]) / q.dir[a];
+		if ( t0 > t1 )
+			swap(t0, t1);
+		tNear = max(tNear, t0);
+		tFar = min(tFar, t1);
+		if ( tNear > tFar )
+			return false;
+	}
+	return true;
+}
+
+static size_t linearQuery(const FlatScene &scene, int kind, const Query &q) {
+	size_t hits = 0;
+	for ( size_t i = 0; i < scene.size(); ++i )
+		if ( scene.hasGeometry[i] && hit(kind, q, scene.box(i)) )
+			++hits;
+	return hits;
+}
+
+static size_t recursiveQuery(SceneNode *node, const GLMatrix4 &parent, int kind, const Query &q) {
+	const GLMatrix4 world = parent * node->transform;
+	size_t hits = 0;
+	GLfloat local[6], box[6];
+	if ( node->localBounds(local) ) {
+		boxTransform(world.mat, local, box);
+		hits += hit(kind, q, box);
+	}
+	for ( size_t i = 0; i < node->children.size(); ++i )
+		hits += recursiveQuery(node->children[i], world, kind, q);
+	return hits;
+}
+
+static size_t bvhQuery(const SceneBVH &bvh, int kind, const Query &q, vector<size_t> &out) {
+	if ( kind == QUERY_POINT )
+		bvh.queryPoint(q.point, out);
+	else if ( kind == QUERY_RECT )
+		bvh.queryBox(q.rect, out);
+	else
+		bvh.queryRay(q.point, q.dir, out);
+	return out.size();
+}
+
+int main(int argc, char **argv) {
+	vector<size_t> sizes;
+	for ( int i = 1; i < argc; ++i )
+		sizes.push_back((size_t) atol(argv[i]));
+	if ( sizes.empty() ) {
+		sizes.push_back(10000);
+		sizes.push_back(100000);
+		sizes.push_back(1000000);
+	}
+
+	const int groupSize = 32;
+	printf("%10s %6s %12s %12s %14s %10s %8s\n", "nodes", "query", "bvh us", "linear us", "recursive us", "hits", "match");
+	for ( size_t s = 0; s < sizes.size(); ++s ) {
+		srand(1);
+		SceneNode root;
+		vector<SceneNode*> nodeList;
+		const size_t groups = max<size_t>(1, sizes[s] / groupSize);
+		const GLfloat spread = 2.0f / (GLfloat) sqrt((double) groups);
+		for ( size_t g = 0; g < groups; ++g ) {
+			SceneNode *group = new SceneNode;
+			group->transform.translate(frand() * 2 - 1, frand() * 2 - 1, 0);
+			root.children.push_back(group);
+			nodeList.push_back(group);
+			for ( int i = 0; i < groupSize; ++i ) {
+				SceneNode *polygon = new RegularPolygonNode(spread * 0.05f, 3, 0xFFFFFFFF);
+				polygon->transform.translate((frand() - 0.5f) * spread, (frand() - 0.5f) * spread, 0);
+				group->children.push_back(polygon);
+				nodeList.push_back(polygon);
+			}
+		}
+
+		FlatScene scene;
+		scene.build(root);
+		GLMatrix4 ident;
+		ident.setIdentity();
+		scene.syncLocals();
+		scene.updateWorld(ident);
+
+		SceneBVH bvh;
+		Clock::time_point start = Clock::now();
+		bvh.build(scene);
+		const double buildMs = usSince(start) / 1000;
+		const double builtCost = bvh.cost();
+
+		vector<Query> queries(1000);
+		for ( size_t i = 0; i < queries.size(); ++i ) {
+			Query &q = queries[i];
+			q.point[0] = frand() * 2 - 1, q.point[1] = frand() * 2 - 1, q.point[2] = 0;
+			q.rect[0] = q.point[0], q.rect[1] = q.point[1], q.rect[2] = 0;
+			q.rect[3] = q.point[0] + 0.2f, q.rect[4] = q.point[1] + 0.2f, q.rect[5] = 0;
+			const float angle = frand() * 2 * (float) MY_PI;
+			q.dir[0] = cos(angle), q.dir[1] = sin(angle), q.dir[2] = 0;
+		}
+
+		vector<size_t> out;
+		for ( int kind = 0; kind < QUERY_KINDS; ++kind ) {
+			size_t bvhHits = 0, linearHits = 0, recursiveHits = 0;
+			start = Clock::now();
+			for ( size_t i = 0; i < queries.size(); ++i )
+				bvhHits += bvhQuery(bvh, kind, queries[i], out);
+			const double bvhUs = usSince(start) / queries.size();
+
+			//the brute-force baselines get fewer queries on big scenes so a run stays short
+			const size_t slowQueries = max<size_t>(10, min<size_t>(queries.size(), 20000000 / scene.size()));
+			size_t bvhSubset = 0;
+			for ( size_t i = 0; i < slowQueries; ++i )
+				bvhSubset += bvhQuery(bvh, kind, queries[i], out);
+			start = Clock::now();
+			for ( size_t i = 0; i < slowQueries; ++i )
+				linearHits += linearQuery(scene, kind, queries[i]);
+			const double linearUs = usSince(start) / slowQueries;
+			start = Clock::now();
+			for ( size_t i = 0; i < slowQueries; ++i )
+				recursiveHits += recursiveQuery(&root, ident, kind, queries[i]);
+			const double recursiveUs = usSince(start) / slowQueries;
+
+			printf("%10lu %6s %12.2f %12.2f %14.2f %10.1f %8s\n", (unsigned long) scene.size(), queryNames[kind],
+			       bvhUs, linearUs, recursiveUs, bvhHits / (double) queries.size(),
+			       bvhSubset == linearHits && linearHits == recursiveHits ? "yes" : "NO");
+		}
+
+		//move a quarter of the groups and refit
+		for ( size_t g = 0; g < groups; g += 4 )
+			root.children[g]->transform.translate(0.2f, 0.1f, 0);
+		scene.syncLocals();
+		scene.updateWorld(ident);
+		start = Clock::now();
+		bvh.refit();
+		const double refitMs = usSince(start) / 1000;
+		printf("%10lu build %.1f ms, refit %.2f ms, SAH cost %.2f built / %.2f refit\n",
+		       (unsigned long) scene.size(), buildMs, refitMs, builtCost, bvh.cost());
+
+		for ( size_t i = 0; i < nodeList.size(); ++i )
+			delete nodeList[i];
+	}
+	return 0;
+}
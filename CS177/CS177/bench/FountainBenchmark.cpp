@@ -0,0 +1,61 @@
+/********************
+ *
+ * Headless benchmark for the ring-buffer particle fountain (ParticleFountain.hpp).
+ *
+ * Build (from CS177/CS177, GLEW built with GLEW_OSMESA):
+ *   g++ -O2 -I. bench/FountainBenchmark.cpp -o fountain_bench -lGLEW -lOSMesa
+ * Run from CS177/CS177 so the shaders are found:
+ *   ./fountain_bench [capacity] [particles/sec] [frames]
+ *
+ * Simulated time advances 1/60 s per frame. Prints per-frame spawn count,
+ * upload size and CPU update time, and the wall time of each frame including
+ * the software rasterizer.
+ *
+ ********************/
+#include "../HeadlessContext.hpp"
+#include "../ParticleFountain.hpp"
+
+using namespace std;
+
+int main(int argc, char **argv) {
+	const size_t capacity = argc > 1 ? (size_t) atol(argv[1]) : (1 << 20);
+	const double rate = argc > 2 ? atof(argv[2]) : 500000;
+	const int frames = argc > 3 ? atoi(argv[3]) : 300;
+
+	HeadlessContext context;
+	if ( !context.create(640, 640) )
+		return -1;
+
+	ParticleFountain fountain;
+	if ( !fountain.init(capacity, "fountain.vsh", "fountain.fsh") )
+		return -1;
+	fountain.setEmissionRate(rate);
+	fountain.setLifetime(2);
+
+	printf("capacity %lu, rate %.0f/s, %d frames\n", (unsigned long) capacity, rate, frames);
+	printf("%6s %10s %10s %12s %10s %10s\n", "frame", "spawned", "live", "bytes", "update ms", "frame ms");
+	double totalUpdate = 0, totalFrame = 0;
+	size_t totalBytes = 0;
+	for ( int f = 0; f < frames; ++f ) {
+		const chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		const double now = f / 60.0;
+		fountain.update(now);
+		glClear(GL_COLOR_BUFFER_BIT);
+		fountain.draw(now);
+		context.pixels();
+		const double frameMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+
+		totalUpdate += fountain.stats.updateMs;
+		totalFrame += frameMs;
+		totalBytes += fountain.stats.bytesUploaded;
+		if ( f % 30 == 0 || f == frames - 1 )
+			printf("%6d %10lu %10lu %12lu %10.3f %10.3f\n", f, (unsigned long) fountain.stats.spawned,
+			       (unsigned long) fountain.stats.live, (unsigned long) fountain.stats.bytesUploaded,
+			       fountain.stats.updateMs, frameMs);
+	}
+	printf("average: update %.3f ms, frame %.3f ms, upload %.1f KB/frame\n",
+	       totalUpdate / frames, totalFrame / frames, totalBytes / 1024.0 / frames);
+
+	fountain.destroy();
+	return 0;
+}
@@ -0,0 +1,201 @@
+/********************
+ *
+ * Headless frame-time benchmark over synthetic scenes (SyntheticScenes.hpp).
+ *
+ * Build (from CS177/CS177, GLEW built with GLEW_OSMESA):
+ *   g++ -O2 -std=c++11 -I. bench/FrameBenchmark.cpp -o frame_bench -lGLEW -lOSMesa
+ * Run from CS177/CS177 so the shaders are found:
+ *   ./frame_bench [frames] [scale] > results.jsonl
+ *
+ * Every scene is drawn through each render path: "nodes" (FlatScene::draw,
+ * one draw per node), "queue" (sorted DrawQueue), "batches" (RenderBatches,
+ * typed batches without virtual calls), "blocks" (UniformBlockRenderer, model
+ * matrices in one uniform buffer upload, skipped without
+ * ARB_uniform_buffer_object) and "instanced" (InstancedRenderer, skipped
+ * without ARB_instanced_arrays) and "static" (StaticBatches for the subtrees
+ * the scene marks, drawn in their place between the other nodes, which are
+ * drawn per node; only the mixed scenes mark any). The root spins every
+ * frame, so all world matrices are recomputed; the baked subtrees only follow
+ * it through the batch matrices. scale multiplies the scene sizes (default 1:
+ * 1000-deep chain, 10000 wide, 2000 distinct polygons, 10000 shared markers,
+ * 2000 hands, and 2000 static hands with a dynamic polygon after every 50 in
+ * "mixed" and after every one in "alternating").
+ *
+ * stdout gets one JSON object per scene and path with mean/min/p50/p95/max of
+ * the CPU time to update and submit a frame, the wall time including
+ * glFinish, the GPU time from timer queries and the draw calls per frame.
+ * Diagnostics go to stderr.
+ *
+ ********************/
+#include "../HeadlessContext.hpp"
+#include "../FlatScene.hpp"
+#include "../InstancedRenderer.hpp"
+#include "../DrawQueue.hpp"
+#include "../RenderBatches.hpp"
+#include "../UniformBlocks.hpp"
+#include "../StaticBatches.hpp"
+#include "../SyntheticScenes.hpp"
+#include "../FrameStats.hpp"
+
+using namespace std;
+
+enum { PATH_NODES, PATH_QUEUE, PATH_BATCHES, PATH_BLOCKS, PATH_INSTANCED, PATH_STATIC, PATH_COUNT };
+static const char *pathNames[PATH_COUNT] = { "nodes", "queue", "batches", "blocks", "instanced", "static" };
+
+struct BenchScene {
+	const char *name;
+	SceneNode root;
+	vector<SceneNode*> nodeList;
+};
+
+static void runScene(BenchScene &scene, HeadlessContext &context, GLuint program, int frames) {
+	FlatScene flat;
+	flat.build(scene.root);
+	size_t meshNodes = 0;
+	for ( size_t i = 0; i < flat.size(); ++i )
+		if ( dynamic_cast<MeshNode*>(flat.nodes[i]) )
+			++meshNodes;
+
+	InstancedRenderer instanced;
+	const bool instancing = instanced.init("2d_instanced.vsh", "2d.fsh");
+	if ( instancing )
+		instanced.build(flat);
+	DrawQueue queue;
+	RenderBatches batches;
+	batches.build(flat);
+	UniformBlockRenderer blocks;
+	const bool uniformBlocks = blocks.init("2d_ubo.vsh", "2d.fsh");
+	if ( uniformBlocks )
+		blocks.build(flat);
+	StaticBatches statics;
+	statics.build(flat);
+	statics.upload();
+	vector<char> visible(flat.size());
+	GpuTimer gpu;
+	gpu.init();
+
+	GLMatrix4 ident;
+	ident.setIdentity();
+	FrameSamples samples;
+	for ( int path = 0; path < PATH_COUNT; ++path ) {
+		if ( (path == PATH_INSTANCED && !instancing) || (path == PATH_BLOCKS && !uniformBlocks) || (path == PATH_STATIC && !statics.entryCount()) )
+			continue;
+		samples.clear();
+		//the first frames upload meshes and warm the caches; they aren't recorded
+		const int warmup = 10;
+		for ( int frame = -warmup; frame < frames; ++frame ) {
+			const chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+			scene.root.transform.setRotationY(0, 0, 0, frame * 0.01f);
+			flat.syncLocals();
+			flat.updateWorld(ident);
+
+			gpu.begin();
+			glClear(GL_COLOR_BUFFER_BIT);
+			double drawCalls = 0;
+			if ( path == PATH_NODES ) {
+				glUseProgram(program);
+				flat.draw(ident);
+				drawCalls = (double) meshNodes;
+			} else if ( path == PATH_QUEUE ) {
+				queue.beginFrame();
+				queue.recordScene(0, program, UNIFORM_transfromationMatrix, flat, ident);
+				queue.submit();
+				drawCalls = (double) queue.stats.drawCalls;
+			} else if ( path == PATH_BATCHES ) {
+				glUseProgram(program);
+				batches.draw(flat, ident);
+				drawCalls = (double) batches.lastDrawCalls();
+			} else if ( path == PATH_BLOCKS ) {
+				blocks.upload(flat);
+				blocks.setCamera(ident, ident);
+				blocks.draw();
+				drawCalls = (double) blocks.lastDrawCalls();
+			} else if ( path == PATH_INSTANCED ) {
+				instanced.upload(flat);
+				instanced.draw(ident);
+				drawCalls = (double) instanced.lastDrawCalls();
+			} else {
+				glUseProgram(program);
+				statics.refresh(flat);
+				fill(visible.begin(), visible.end(), 1);
+				statics.hide(flat, &visible[0]);
+				size_t begin = 0;
+				for ( size_t s = 0; s < statics.stopCount(); ++s ) {
+					flat.draw(ident, &visible[0], begin, statics.stopEntry(s));
+					statics.drawStop(s, flat, ident, &visible[0]);
+					begin = statics.stopEntry(s);
+				}
+				flat.draw(ident, &visible[0], begin);
+				drawCalls = (double) statics.lastDrawCalls();
+				for ( size_t i = 0; i < flat.size(); ++i )
+					if ( visible[i] && dynamic_cast<MeshNode*>(flat.nodes[i]) )
+						++drawCalls;
+			}
+			gpu.end();
+			const double cpuMs = elapsedMs(start);
+			context.pixels();
+			const double wallMs = elapsedMs(start);
+
+			double gpuMs;
+			const bool gpuReady = gpu.poll(gpuMs);
+			if ( frame < 0 )
+				continue;
+			samples.cpuMs.push_back(cpuMs);
+			samples.wallMs.push_back(wallMs);
+			samples.drawCalls.push_back(drawCalls);
+			if ( gpuReady )
+				samples.gpuMs.push_back(gpuMs);
+		}
+		samples.writeJson(stdout, scene.name, pathNames[path], flat.size());
+	}
+	gpu.destroy();
+	instanced.destroy();
+	blocks.destroy();
+	statics.destroy();
+}
+
+int main(int argc, char **argv) {
+	const int frames = argc > 1 ? atoi(argv[1]) : 200;
+	const size_t scale = argc > 2 ? max(1, atoi(argv[2])) : 1;
+
+	HeadlessContext context;
+	if ( !context.create(640, 640) )
+		return -1;
+	if ( !GpuTimer::supported() )
+		cerr << "ARB_timer_query unavailable, gpu_ms will be null.\n";
+
+	GLuint program = linkProgram("2d.vsh", "2d.fsh");
+	if ( !program )
+		return -1;
+	UNIFORM_transfromationMatrix = glGetUniformLocation(program, "modelTransform");
+	glUseProgram(program);
+	glEnableVertexAttribArray(ATTRIB_POS);
+	glEnableVertexAttribArray(ATTRIB_COLOR);
+	glViewport(0, 0, context.width(), context.height());
+
+	BenchScene scenes[7];
+	scenes[0].name = "deep";
+	buildDeepScene(scenes[0].root, scenes[0].nodeList, 1000 * scale);
+	scenes[1].name = "wide";
+	buildWideScene(scenes[1].root, scenes[1].nodeList, 10000 * scale);
+	scenes[2].name = "polygons";
+	buildPolygonScene(scenes[2].root, scenes[2].nodeList, 2000 * scale, 32);
+	scenes[3].name = "markers";
+	buildMarkerScene(scenes[3].root, scenes[3].nodeList, 10000 * scale);
+	scenes[4].name = "hands";
+	buildHandScene(scenes[4].root, scenes[4].nodeList, 2000 * scale);
+	scenes[5].name = "mixed";
+	buildMixedScene(scenes[5].root, scenes[5].nodeList, 2000 * scale, 50);
+	scenes[6].name = "alternating";
+	buildMixedScene(scenes[6].root, scenes[6].nodeList, 2000 * scale, 1);
+
+	for ( int s = 0; s < 7; ++s ) {
+		cerr << "Running " << scenes[s].name << "...\n";
+		runScene(scenes[s], context, program, frames);
+		for ( size_t i = 0; i < scenes[s].nodeList.size(); ++i )
+			delete scenes[s].nodeList[i];
+		globalMeshCache().clear();
+	}
+	glDeleteProgram(program);
+	return 0;
+}
@@ -0,0 +1,67 @@
+/********************
+ *
+ * Standalone micro-benchmark for the 4x4 matrix kernels in MatrixKernels.hpp.
+ * No OpenGL context is needed.
+ *
+ * Build (from CS177/CS177):
+ *   g++ -O2 -msse2 -ffp-contract=off bench/MatrixBenchmark.cpp -o matrix_bench
+ *   g++ -O2 -mavx -ffp-contract=off bench/MatrixBenchmark.cpp -o matrix_bench_avx
+ *
+ * For every batch size it composes N parent*local pairs with the scalar
+ * reference and with mat4MultiplyBatch, checks the results are identical and
+ * prints ns/multiply and matrices/sec for both.
+ *
+ ********************/
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "../MatrixKernels.hpp"
+
+using namespace std;
+
+typedef void (*BatchFn)(const float*, const float*, float*, size_t);
+
+static double timeBatch(BatchFn fn, const vector<float> &parents, const vector<float> &locals, vector<float> &out, size_t n) {
+	//repeat small batches so every measurement covers roughly the same amount of work
+	const size_t reps = max<size_t>(1, (1 << 22) / n);
+	const chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+	for ( size_t r = 0; r < reps; ++r )
+		fn(&parents[0], &locals[0], &out[0], n);
+	const chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
+	return chrono::duration<double, nano>(end - start).count() / (double)(reps * n);
+}
+
+int main() {
+	const size_t sizes[] = { 1, 8, 64, 512, 4096, 32768, 262144 };
+	const char *kernel =
+#if defined(CS177_USE_AVX)
+		"AVX";
+#elif defined(CS177_USE_SSE)
+		"SSE";
+#else
+		"scalar";
+#endif
+
+	printf("kernel: %s\n", kernel);
+	printf("%10s %14s %14s %16s %16s %8s\n", "batch", "scalar ns/mul", "simd ns/mul", "scalar mat/s", "simd mat/s", "exact");
+	srand(177);
+	bool allExact = true;
+	for ( size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); ++s ) {
+		const size_t n = sizes[s];
+		vector<float> parents(16 * n), locals(16 * n), ref(16 * n), out(16 * n);
+		for ( size_t i = 0; i < 16 * n; ++i ) {
+			parents[i] = rand() / (float)RAND_MAX - 0.5f;
+			locals[i] = rand() / (float)RAND_MAX - 0.5f;
+		}
+		const double scalarNs = timeBatch(mat4MultiplyBatchScalar, parents, locals, ref, n);
+		const double simdNs = timeBatch(mat4MultiplyBatch, parents, locals, out, n);
+		const bool exact = memcmp(&ref[0], &out[0], sizeof(float) * 16 * n) == 0;
+		allExact = allExact && exact;
+		printf("%10lu %14.2f %14.2f %16.0f %16.0f %8s\n", (unsigned long) n,
+		       scalarNs, simdNs, 1e9 / scalarNs, 1e9 / simdNs, exact ? "yes" : "NO");
+	}
+	return allExact ? 0 : 1;
+}
@@ -0,0 +1,133 @@
+/********************
+ *
+ * Thread scaling benchmark for the parallel scene update and command
+ * recording (JobSystem.hpp, FlatScene::updateParallel,
+ * DrawQueue::recordSceneParallel).
+ *
+ * Build (from CS177/CS177, GLEW built with GLEW_OSMESA):
+ *   g++ -O2 -std=c++11 -I. bench/ParallelBenchmark.cpp -o parallel_bench -lGLEW -lOSMesa -lpthread
+ * Run:
+ *   ./parallel_bench [--threads N] [frames] [nodes...]     (default 30 frames, 100000 and 1000000 nodes)
+ *
+ * The scenes are wide trees from buildWideScene. A headless context is only
+ * needed to upload the shared mesh once; nothing is drawn while timing. The
+ * root transform changes every frame, so every world matrix is recomputed.
+ * For 1, 2, 4, ... threads up to the hardware concurrency (or N, which may
+ * go past it to check the results and steals on a small machine) it prints the
+ * average ms per frame of the update (sync + world matrices + bounds) and of
+ * recording the command lists, the speedup over one thread and the jobs
+ * stolen per frame. The world matrices and the command count are checked
+ * against the serial calls.
+ *
+ ********************/
+#include "../HeadlessContext.hpp"
+#include "../FlatScene.hpp"
+#include "../DrawQueue.hpp"
+#include "../SyntheticScenes.hpp"
+#include <chrono>
+
+using namespace std;
+
+typedef chrono::high_resolution_clock Clock;
+
+static double msSince(const Clock::time_point &start) {
+	return chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+int main(int argc, char **argv) {
+	unsigned maxThreads = max(1u, thread::hardware_concurrency());
+	int arg = 1;
+	if ( argc > arg + 1 && strcmp(argv[arg], "--threads") == 0 ) {
+		maxThreads = (unsigned) max(1, atoi(argv[arg + 1]));
+		arg += 2;
+	}
+	const int frames = argc > arg ? max(1, atoi(argv[arg])) : 30;
+	vector<size_t> sizes;
+	for ( int i = arg + 1; i < argc; ++i )
+		sizes.push_back((size_t) atol(argv[i]));
+	if ( sizes.empty() ) {
+		sizes.push_back(100000);
+		sizes.push_back(1000000);
+	}
+
+	HeadlessContext context;
+	if ( !context.create(64, 64) )
+		return -1;
+
+	vector<unsigned> threadCounts;
+	for ( unsigned t = 1; t < maxThreads; t *= 2 )
+		threadCounts.push_back(t);
+	threadCounts.push_back(maxThreads);
+
+	printf("%9s %7s %11s %9s %11s %9s %12s %6s\n", "nodes", "threads", "update ms", "speedup", "record ms", "speedup", "steals/frame", "match");
+	for ( size_t s = 0; s < sizes.size(); ++s ) {
+		SceneNode root;
+		vector<SceneNode*> nodeList;
+		buildWideScene(root, nodeList, sizes[s]);
+		for ( size_t i = 0; i < nodeList.size(); ++i )
+			if ( MeshNode *node = dynamic_cast<MeshNode*>(nodeList[i]) )
+				node->getMesh();
+
+		GLMatrix4 ident;
+		ident.setIdentity();
+		//serial reference, gone before the timed scenes are built so they watch the transforms themselves
+		vector<GLfloat> referenceWorlds;
+		size_t referenceCommands;
+		{
+			FlatScene reference;
+			reference.build(root);
+			GLMatrix4 rootTransform;
+			rootTransform.setRotationZ(0, 0, 0, 0.5f);
+			reference.syncLocals();
+			reference.updateWorld(rootTransform);
+			referenceWorlds = reference.worlds;
+			DrawQueue referenceQueue;
+			referenceQueue.recordScene(0, 0, 0, reference, ident);
+			referenceCommands = referenceQueue.size();
+			referenceQueue.clear();
+		}
+
+		double updateBase = 0, recordBase = 0;
+		for ( size_t c = 0; c < threadCounts.size(); ++c ) {
+			JobSystem jobs(threadCounts[c]);
+			FlatScene scene;
+			scene.build(root);
+			DrawQueue queue;
+			const size_t stealsBefore = jobs.stealCount();
+			double updateMs = 0, recordMs = 0;
+			for ( int frame = 0; frame <= frames; ++frame ) {
+				GLMatrix4 spin;
+				spin.setRotationZ(0, 0, 0, frame == frames ? 0.5f : frame * 0.01f);
+				Clock::time_point start = Clock::now();
+				scene.updateParallel(jobs, spin);
+				const double u = msSince(start);
+				start = Clock::now();
+				queue.recordSceneParallel(jobs, 0, 0, 0, scene, ident);
+				const double r = msSince(start);
+				//the last frame is only there to compare against the reference
+				if ( frame < frames ) {
+					updateMs += u;
+					recordMs += r;
+					queue.clear();
+				}
+			}
+			updateMs /= frames;
+			recordMs /= frames;
+
+			bool match = scene.worlds == referenceWorlds;
+			match = match && queue.size() == referenceCommands;
+			if ( c == 0 ) {
+				updateBase = updateMs;
+				recordBase = recordMs;
+			}
+			printf("%9lu %7u %11.3f %8.2fx %11.3f %8.2fx %12.1f %6s\n", (unsigned long) scene.size(), threadCounts[c],
+			       updateMs, updateBase / updateMs, recordMs, recordBase / recordMs,
+			       (jobs.stealCount() - stealsBefore) / (double) (frames + 1), match ? "yes" : "NO");
+			queue.clear();
+		}
+		for ( size_t i = 0; i < nodeList.size(); ++i )
+			delete nodeList[i];
+		globalMeshCache().clear();
+	}
+	return 0;
+}
@@ -0,0 +1,60 @@
+/********************
+ *
+ * CPU particle simulation benchmark (ParticleSim.hpp). Needs no GL at all;
+ * the fountain layout is written into plain memory.
+ *
+ * Build (from CS177/CS177):
+ *   g++ -O2 -msse2 -pthread -I. bench/ParticleSimBenchmark.cpp -o particle_bench
+ * Run:
+ *   ./particle_bench [particles] [steps]
+ *
+ * For 1, 2, 4, ... up to the hardware thread count it reports how many
+ * particles per second are integrated, and how many per second are integrated
+ * and streamed into the fountain vertex layout.
+ *
+ ********************/
+#include "../ParticleSim.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace std;
+
+int main(int argc, char **argv) {
+	const size_t count = argc > 1 ? (size_t) atol(argv[1]) : (1 << 20);
+	const int steps = argc > 2 ? atoi(argv[2]) : 100;
+	const unsigned hardware = max(1u, thread::hardware_concurrency());
+	const float dt = 1 / 60.0f;
+
+	vector<FountainParticle> out(count);
+	const float accel[3] = { 0, -1.5f, 0 };
+
+	printf("%lu particles, %d steps, %u hardware threads\n", (unsigned long) count, steps, hardware);
+	printf("%8s %16s %20s %10s\n", "threads", "step Mpart/s", "step+write Mpart/s", "speedup");
+	double baseline = 0;
+	for ( unsigned threads = 1; ; threads = min(threads * 2, hardware) ) {
+		ThreadPool pool(threads);
+		ParticleSim sim;
+		sim.init(count, 0);
+
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		for ( int s = 0; s < steps; ++s )
+			sim.step(pool, s * dt, dt);
+		const double stepSec = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+
+		start = chrono::high_resolution_clock::now();
+		for ( int s = 0; s < steps; ++s ) {
+			sim.step(pool, (steps + s) * dt, dt);
+			sim.writeFountainLayout(pool, &out[0], (steps + s) * dt, accel);
+		}
+		const double bothSec = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+
+		const double stepRate = count * (double) steps / stepSec / 1e6;
+		if ( threads == 1 )
+			baseline = stepRate;
+		printf("%8u %16.1f %20.1f %9.2fx\n", pool.size(), stepRate, count * (double) steps / bothSec / 1e6, stepRate / baseline);
+		if ( threads == hardware )
+			break;
+	}
+	return 0;
+}
@@ -0,0 +1,144 @@
+/********************
+ *
+ * Micro-benchmark for the rotation code in Quaternion.hpp. No OpenGL
+ * context is needed.
+ *
+ * Build (from CS177/CS177):
+ *   g++ -O2 -std=c++11 -msse2 bench/QuaternionBenchmark.cpp -o quaternion_bench
+ *
+ * For a range of batch sizes (the number of animated joints updated per
+ * frame) it times, best of 5 trials:
+ *   sincos    sincosBatch() against one libm sin() and cos() per angle, with
+ *             the largest absolute error against libm
+ *   axisangle axisAngleBatch() against one libm sin() and cos() per rotation,
+ *             the path it takes below AXIS_ANGLE_BATCH_MIN
+ *   rotation  axis-angle to 4x4 through axisAngleBatch() + toMatrix() against
+ *             the existing per-call path (cos/sin in create_rotation_matrix_4x4Z,
+ *             copied here so no GL headers are needed); that one only
+ *             rotates about z, so it skips the axis arithmetic
+ *   slerp     slerp() between random orientations
+ *
+ ********************/
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "../Quaternion.hpp"
+
+using namespace std;
+
+typedef chrono::high_resolution_clock Clock;
+
+static float frand() {
+	return rand() / (float) RAND_MAX * 2 - 1;
+}
+
+static volatile float sink;
+
+//the rotation code GLMatrix4 used before, one cos() and sin() per call
+static void libmRotationZ(float theta, float *mat) {
+	const float c = cos(theta), s = sin(theta);
+	mat[0] = c, mat[4] = -s, mat[8] = 0, mat[12] = 0;
+	mat[1] = s, mat[5] = c, mat[9] = 0, mat[13] = 0;
+	mat[2] = 0, mat[6] = 0, mat[10] = 1, mat[14] = 0;
+	mat[3] = 0, mat[7] = 0, mat[11] = 0, mat[15] = 1;
+}
+
+//ns per item of the fastest of a few trials, each repeated up to ~1M items
+template<class F>
+static double timeIt(size_t n, F f) {
+	const size_t reps = max<size_t>(1, (1 << 20) / n);
+	double best = 1e30;
+	for ( int trial = 0; trial < 5; ++trial ) {
+		const Clock::time_point start = Clock::now();
+		for ( size_t r = 0; r < reps; ++r )
+			f();
+		best = min(best, chrono::duration<double, nano>(Clock::now() - start).count() / (double) (reps * n));
+	}
+	return best;
+}
+
+int main() {
+	const size_t sizes[] = { 4, 16, 256, 4096, 65536 };
+	printf("%8s %-9s %10s %10s %9s %10s\n", "n", "test", "libm ns", "batch ns", "speedup", "max err");
+	for ( size_t si = 0; si < sizeof(sizes) / sizeof(sizes[0]); ++si ) {
+		const size_t n = sizes[si];
+		srand(1);
+		vector<float> angles(n), sines(n), cosines(n), axes(3 * n), matrices(16 * n);
+		for ( size_t i = 0; i < n; ++i ) {
+			angles[i] = frand() * 20;
+			const Quaternion axis = Quaternion(0, frand(), frand(), frand()).normalized();
+			axes[3 * i] = axis.x, axes[3 * i + 1] = axis.y, axes[3 * i + 2] = axis.z;
+		}
+
+		double libmNs = timeIt(n, [&]() {
+			for ( size_t i = 0; i < n; ++i ) {
+				sines[i] = sin(angles[i]);
+				cosines[i] = cos(angles[i]);
+			}
+			sink += sines[n / 2];
+		});
+		double batchNs = timeIt(n, [&]() {
+			sincosBatch(&angles[0], &sines[0], &cosines[0], n);
+			sink += sines[n / 2];
+		});
+		float maxError = 0;
+		for ( size_t i = 0; i < n; ++i )
+			maxError = max(maxError, max(fabs(sines[i] - sin(angles[i])), fabs(cosines[i] - cos(angles[i]))));
+		printf("%8lu %-9s %10.2f %10.2f %8.2fx %10.2g\n", (unsigned long) n, "sincos", libmNs, batchNs, libmNs / batchNs, maxError);
+
+		vector<Quaternion> rotations(n);
+		libmNs = timeIt(n, [&]() {
+			for ( size_t i = 0; i < n; ++i ) {
+				const float half = angles[i] * 0.5f, s = sin(half);
+				const float *axis = &axes[3 * i];
+				rotations[i] = Quaternion(cos(half), axis[0] * s, axis[1] * s, axis[2] * s);
+			}
+			sink += rotations[n / 2].w;
+		});
+		batchNs = timeIt(n, [&]() {
+			axisAngleBatch(&axes[0], &angles[0], &rotations[0], n);
+			sink += rotations[n / 2].w;
+		});
+		printf("%8lu %-9s %10.2f %10.2f %8.2fx %10s\n", (unsigned long) n, "axisangle", libmNs, batchNs, libmNs / batchNs, "-");
+
+		libmNs = timeIt(n, [&]() {
+			for ( size_t i = 0; i < n; ++i )
+				libmRotationZ(angles[i], &matrices[16 * i]);
+			sink += matrices[16 * (n / 2)];
+		});
+		batchNs = timeIt(n, [&]() {
+			axisAngleBatch(&axes[0], &angles[0], &rotations[0], n);
+			for ( size_t i = 0; i < n; ++i )
+				rotations[i].toMatrix(&matrices[16 * i]);
+			sink += matrices[16 * (n / 2)];
+		});
+		//check against the per-call path for rotations about z
+		maxError = 0;
+		vector<float> zAxes(3 * n, 0);
+		for ( size_t i = 0; i < n; ++i )
+			zAxes[3 * i + 2] = 1;
+		axisAngleBatch(&zAxes[0], &angles[0], &rotations[0], n);
+		for ( size_t i = 0; i < n; ++i ) {
+			float expected[16], got[16];
+			libmRotationZ(angles[i], expected);
+			rotations[i].toMatrix(got);
+			for ( int k = 0; k < 16; ++k )
+				maxError = max(maxError, fabs(expected[k] - got[k]));
+		}
+		printf("%8lu %-9s %10.2f %10.2f %8.2fx %10.2g\n", (unsigned long) n, "rotation", libmNs, batchNs, libmNs / batchNs, maxError);
+
+		vector<Quaternion> from(n), to(n);
+		axisAngleBatch(&axes[0], &angles[0], &from[0], n);
+		reverse(angles.begin(), angles.end());
+		axisAngleBatch(&axes[0], &angles[0], &to[0], n);
+		const double slerpNs = timeIt(n, [&]() {
+			for ( size_t i = 0; i < n; ++i )
+				rotations[i] = slerp(from[i], to[i], 0.3f);
+			sink += rotations[n / 2].w;
+		});
+		printf("%8lu %-9s %10s %10.2f %9s %10s\n", (unsigned long) n, "slerp", "-", slerpNs, "-", "-");
+	}
+	return 0;
+}
@@ -0,0 +1,100 @@
+/********************
+ *
+ * Load time and memory of binary scene files (SceneFile.hpp) against
+ * building the same scene through the node classes. No GL context is needed.
+ *
+ * Build (from CS177/CS177):
+ *   g++ -O2 -std=c++11 -I. bench/SceneFileBenchmark.cpp -o scene_file_bench -lGLEW -lGL
+ * Run:
+ *   ./scene_file_bench [nodes] [scratch file]     (default 1000000 scene.cssc)
+ *
+ * For the "wide" scene (one mesh shared by every node) and the "polygons"
+ * scene (a mesh of its own per node) from SyntheticScenes.hpp, "classes"
+ * constructs the nodes and flattens them with FlatScene, and "file" opens the
+ * exported file and computes the world matrices, the point where either one
+ * could be drawn. Each line gives the time, the growth of the resident set
+ * (from /proc/self/statm, 0 elsewhere) and the heap allocations made. The
+ * file is read back warm from the page cache; its pages count towards the
+ * resident set as they are touched, and the vertices aren't touched until
+ * they are uploaded.
+ *
+ ********************/
+#define CS177_COUNT_ALLOCATIONS
+#include "../AllocationCounter.hpp"
+#include "../SceneFile.hpp"
+#include "../SyntheticScenes.hpp"
+#include "../FrameStats.hpp"
+#include <cstdlib>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+using namespace std;
+
+static double residentMB() {
+	double mb = 0;
+#ifdef __linux__
+	FILE *statm = fopen("/proc/self/statm", "r");
+	unsigned long size, resident;
+	if ( statm && fscanf(statm, "%lu %lu", &size, &resident) == 2 )
+		mb = resident * (double) sysconf(_SC_PAGESIZE) / (1024 * 1024);
+	if ( statm )
+		fclose(statm);
+#endif
+	return mb;
+}
+
+static void report(const char *scene, const char *mode, size_t nodes, double ms, double mb, size_t allocations) {
+	printf("%-9s %-8s %9lu %10.1f %10.1f %12lu\n", scene, mode, (unsigned long) nodes, ms, mb, (unsigned long) allocations);
+}
+
+static void run(const char *scene, size_t count, const char *path) {
+	GLMatrix4 identity;
+	identity.setIdentity();
+	{
+		const double mbAtStart = residentMB();
+		const size_t allocsAtStart = heapAllocations();
+		const chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		SceneNode root;
+		vector<SceneNode*> nodeList;
+		if ( strcmp(scene, "wide") == 0 )
+			buildWideScene(root, nodeList, count);
+		else
+			buildPolygonScene(root, nodeList, count, 6);
+		FlatScene flat;
+		flat.build(root);
+		flat.updateWorld(identity);
+		report(scene, "classes", flat.size(), elapsedMs(start), residentMB() - mbAtStart, heapAllocations() - allocsAtStart);
+
+		if ( !exportScene(root, path) ) {
+			printf("cannot write %s\n", path);
+			exit(-1);
+		}
+		for ( size_t i = 0; i < nodeList.size(); ++i )
+			delete nodeList[i];
+	}
+#ifdef __GLIBC__
+	//hand the freed nodes back so the next measurement starts from a clean resident set
+	malloc_trim(0);
+#endif
+
+	const double mbAtStart = residentMB();
+	const size_t allocsAtStart = heapAllocations();
+	const chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+	SceneFile file;
+	if ( !file.open(path) )
+		exit(-1);
+	file.updateWorld(identity);
+	report(scene, "file", file.size(), elapsedMs(start), residentMB() - mbAtStart, heapAllocations() - allocsAtStart);
+	printf("%-9s %lu meshes, %lu vertices, %.1f MB file\n", scene, (unsigned long) file.meshCount(), (unsigned long) file.vertexCount(), file.fileSize() / (1024.0 * 1024.0));
+}
+
+int main(int argc, char **argv) {
+	const size_t count = argc > 1 ? (size_t) atol(argv[1]) : 1000000;
+	const char *path = argc > 2 ? argv[2] : "scene.cssc";
+	printf("%-9s %-8s %9s %10s %10s %12s\n", "scene", "mode", "nodes", "ms", "RSS MB", "allocations");
+	run("wide", count, path);
+	run("polygons", count, path);
+	remove(path);
+	return 0;
+}
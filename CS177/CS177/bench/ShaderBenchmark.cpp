@@ -0,0 +1,111 @@
+/********************
+ *
+ * Cold and warm startup times of the shader programs (ShaderManager.hpp).
+ *
+ * Build (from CS177/CS177, GLEW built with GLEW_OSMESA):
+ *   g++ -O2 -std=c++11 -I. bench/ShaderBenchmark.cpp -o shader_bench -lGLEW -lOSMesa
+ * Run from CS177/CS177 so the shaders are found:
+ *   ./shader_bench [cache directory] [serial|cold|warm]
+ *
+ * Builds the 2d, 2d_instanced, 2d_ubo, 3d and fountain programs three ways:
+ * "serial" links them one at a time without a cache, as linkProgram() used
+ * to; "cold" starts all of them at once (compiled in parallel where the
+ * driver has KHR_parallel_shader_compile) after dropping their cached
+ * binaries; "warm" starts them again with the binaries that run saved.
+ * Each line gives the wall time until every program is linked and the
+ * programs loaded from the cache. Naming one mode runs only that one; "warm"
+ * then needs an earlier "cold" run with the same cache directory.
+ *
+ * The driver's own shader cache would make "cold" look warm, since "serial"
+ * compiles the same sources just before. On Mesa, MESA_SHADER_CACHE_DISABLE
+ * also takes away the program binary formats, so run each mode in its own
+ * process with MESA_SHADER_CACHE_DIR pointing at an empty directory instead.
+ *
+ ********************/
+#include "../HeadlessContext.hpp"
+#include "../UniformBlocks.hpp"
+#include "../FrameStats.hpp"
+
+using namespace std;
+
+static const char *programs[][2] = {
+	{ "2d.vsh", "2d.fsh" },
+	{ "2d_instanced.vsh", "2d.fsh" },
+	{ "2d_ubo.vsh", "2d.fsh" },
+	{ "3d.vsh", "3d.fsh" },
+	{ "fountain.vsh", "fountain.fsh" },
+};
+static const size_t programCount = sizeof(programs) / sizeof(programs[0]);
+
+static bool wanted(size_t i) {
+	return i != 2 || UniformBlockRenderer::supported();
+}
+
+//links every program through the manager, optionally starting them all first; false if one failed
+static bool run(ShaderManager &shaders, bool startAll, const char *mode) {
+	const chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+	if ( startAll ) {
+		shaders.start();
+		shaders.finish();
+	}
+	bool ok = true;
+	vector<GLuint> linked;
+	for ( size_t i = 0; i < programCount; ++i ) {
+		if ( !wanted(i) )
+			continue;
+		const GLuint program = shaders.link(programs[i][0], programs[i][1]);
+		ok = ok && program;
+		linked.push_back(program);
+	}
+	//make sure the driver is really done before stopping the clock
+	glFinish();
+	printf("%-7s %10.2f %10lu %10lu\n", mode, elapsedMs(start), (unsigned long) shaders.cacheHits(), (unsigned long) shaders.cacheMisses());
+	for ( size_t i = 0; i < linked.size(); ++i )
+		glDeleteProgram(linked[i]);
+	return ok;
+}
+
+//whether mode runs when only that one was asked for (0 for all of them)
+static bool runs(const char *only, const char *mode) {
+	return !only || strcmp(only, mode) == 0;
+}
+
+int main(int argc, char **argv) {
+	const char *cacheDir = argc > 1 ? argv[1] : "shader_cache";
+	const char *only = argc > 2 ? argv[2] : 0;
+	HeadlessContext context;
+	if ( !context.create(64, 64) )
+		return -1;
+	printf("parallel compile: %s\n", ShaderManager::parallelCompileSupported() ? "yes" : "no");
+	printf("%-7s %10s %10s %10s\n", "mode", "ms", "cached", "compiled");
+
+	if ( runs(only, "serial") ) {
+		ShaderManager serial(0);
+		if ( !run(serial, false, "serial") )
+			return -1;
+	}
+
+	if ( runs(only, "cold") ) {
+		ShaderManager cold(cacheDir);
+		for ( size_t i = 0; i < programCount; ++i )
+			if ( wanted(i) )
+				cold.request(programs[i][0], programs[i][1]);
+		cold.discardCache();
+		run(cold, true, "cold");
+		if ( !cold.cacheEnabled() ) {
+			printf("no program binary support, nothing to cache\n");
+			return 0;
+		}
+	}
+
+	if ( runs(only, "warm") ) {
+		ShaderManager warm(cacheDir);
+		for ( size_t i = 0; i < programCount; ++i )
+			if ( wanted(i) )
+				warm.request(programs[i][0], programs[i][1]);
+		run(warm, true, "warm");
+		if ( !warm.cacheEnabled() )
+			printf("no program binary support, nothing to cache\n");
+	}
+	return 0;
+}
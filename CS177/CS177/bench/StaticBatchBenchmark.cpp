@@ -0,0 +1,120 @@
+/********************
+ *
+ * Draw calls and CPU cost of static batching (StaticBatches.hpp). No GL
+ * context is needed: the batches are baked but not uploaded.
+ *
+ * Build (from CS177/CS177):
+ *   g++ -O2 -std=c++11 -I. bench/StaticBatchBenchmark.cpp -o static_batch_bench -lGLEW -lGL
+ * Run:
+ *   ./static_batch_bench [scale]     (default 1, the FrameBenchmark.cpp scene sizes)
+ *
+ * Every child of the root of the uniform synthetic scenes is marked static,
+ * the best case; "mixed" and "alternating" keep their own marks, 2000 static
+ * hands with a dynamic polygon after every 50 or after every one. For each
+ * scene prints the draws per frame without batching (one per mesh entry) and
+ * with it (one per batch, plus the entries left out), the stops the batches
+ * are drawn in, the bytes baked, the time to build, a refresh() with nothing
+ * moved and one after a single static subtree moved, with the batches that
+ * had to be baked again. The frame times with and without batching come from
+ * the "static" path of FrameBenchmark.cpp, which runs on the mixed scenes.
+ *
+ ********************/
+#include "../StaticBatches.hpp"
+#include "../SyntheticScenes.hpp"
+#include "../FrameStats.hpp"
+#include <cstdlib>
+
+using namespace std;
+
+static void run(const char *name, SceneNode &root, vector<SceneNode*> &nodeList, bool markAll) {
+	if ( markAll )
+		for ( size_t i = 0; i < root.children.size(); ++i )
+			root.children[i]->staticSubtree = true;
+	GLMatrix4 identity;
+	identity.setIdentity();
+	FlatScene flat;
+	flat.build(root);
+	flat.updateWorld(identity);
+
+	size_t meshEntries = 0;
+	for ( size_t i = 0; i < flat.size(); ++i )
+		if ( dynamic_cast<MeshNode*>(flat.nodes[i]) )
+			++meshEntries;
+
+	StaticBatches statics;
+	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+	statics.build(flat);
+	const double buildMs = elapsedMs(start);
+
+	start = chrono::high_resolution_clock::now();
+	statics.refresh(flat);
+	const double idleMs = elapsedMs(start);
+
+	//move the last static subtree, as an edit or a rare animation would
+	size_t last = root.children.size() - 1;
+	while ( !root.children[last]->staticSubtree )
+		--last;
+	root.children[last]->transform.translate(0.01f, 0, 0);
+	flat.syncLocals();
+	flat.updateWorld(identity);
+	start = chrono::high_resolution_clock::now();
+	statics.refresh(flat);
+	const double movedMs = elapsedMs(start);
+
+	const size_t unbatched = meshEntries - statics.entryCount();
+	printf("%-11s %8lu %8lu %8lu %8lu %9.1f %9.2f %9.3f %9.3f %8lu\n", name, (unsigned long) flat.size(), (unsigned long) meshEntries,
+	       (unsigned long) (statics.batchCount() + unbatched), (unsigned long) statics.stopCount(), statics.bytes() / (1024.0 * 1024.0),
+	       buildMs, idleMs, movedMs,
+	       (unsigned long) statics.lastRebuilt());
+	for ( size_t i = 0; i < nodeList.size(); ++i )
+		delete nodeList[i];
+}
+
+int main(int argc, char **argv) {
+	const size_t scale = argc > 1 ? max(1, atoi(argv[1])) : 1;
+	printf("%-11s %8s %8s %8s %8s %9s %9s %9s %9s %8s\n", "scene", "entries", "draws", "batched", "stops", "baked MB", "build ms", "idle ms",
+	       "moved ms", "rebaked");
+	{
+		SceneNode root;
+		vector<SceneNode*> nodeList;
+		buildDeepScene(root, nodeList, 1000 * scale);
+		run("deep", root, nodeList, true);
+	}
+	{
+		SceneNode root;
+		vector<SceneNode*> nodeList;
+		buildWideScene(root, nodeList, 10000 * scale);
+		run("wide", root, nodeList, true);
+	}
+	{
+		SceneNode root;
+		vector<SceneNode*> nodeList;
+		buildPolygonScene(root, nodeList, 2000 * scale, 32);
+		run("polygons", root, nodeList, true);
+	}
+	{
+		SceneNode root;
+		vector<SceneNode*> nodeList;
+		buildMarkerScene(root, nodeList, 10000 * scale);
+		run("markers", root, nodeList, true);
+	}
+	{
+		SceneNode root;
+		vector<SceneNode*> nodeList;
+		buildHandScene(root, nodeList, 2000 * scale);
+		run("hands", root, nodeList, true);
+	}
+	{
+		SceneNode root;
+		vector<SceneNode*> nodeList;
+		buildMixedScene(root, nodeList, 2000 * scale, 50);
+		run("mixed", root, nodeList, false);
+	}
+	{
+		SceneNode root;
+		vector<SceneNode*> nodeList;
+		buildMixedScene(root, nodeList, 2000 * scale, 1);
+		run("alternating", root, nodeList, false);
+	}
+	return 0;
+}
@@ -0,0 +1,73 @@
+/********************
+ *
+ * Streaming a large scene file around a moving camera (SceneStreamer.hpp).
+ * No GL context is needed: the pages are loaded but not uploaded.
+ *
+ * Build (from CS177/CS177):
+ *   g++ -O2 -std=c++11 -I. bench/StreamingBenchmark.cpp -o streaming_bench -lGLEW -lGL -lpthread
+ * Run:
+ *   ./streaming_bench [nodes] [budget MB] [scratch file]     (default 1000000 32 stream.cssc)
+ *
+ * Exports a scene of distinct polygons on a grid over [-1, 1], in 32 x 32
+ * tiles so every page covers a patch of the view, then flies a camera with
+ * a view 0.2 wide around a circle for 300 frames of 16 ms, calling update()
+ * once per frame with a load radius of twice the view.
+ * Prints the time update() took on the render thread (it should never wait
+ * for the I/O), the resident nodes and bytes against the budget, the bytes
+ * paged in and out and the histogram of page load latencies.
+ *
+ ********************/
+#include "../SceneStreamer.hpp"
+#include "../SyntheticScenes.hpp"
+#include "../FrameStats.hpp"
+#include <cstdlib>
+
+using namespace std;
+
+int main(int argc, char **argv) {
+	const size_t count = argc > 1 ? (size_t) atol(argv[1]) : 1000000;
+	const size_t budget = (argc > 2 ? (size_t) atol(argv[2]) : 32) << 20;
+	const char *path = argc > 3 ? argv[3] : "stream.cssc";
+	{
+		SceneNode root;
+		vector<SceneNode*> nodeList;
+		buildTiledScene(root, nodeList, count, 32);
+		if ( !exportScene(root, path) ) {
+			printf("cannot write %s\n", path);
+			return -1;
+		}
+		for ( size_t i = 0; i < nodeList.size(); ++i )
+			delete nodeList[i];
+	}
+
+	SceneStreamer streamer;
+	if ( !streamer.open(path, budget, false) )
+		return -1;
+	printf("%lu nodes in %lu pages, budget %.0f MB\n", (unsigned long) streamer.size(), (unsigned long) streamer.pageCount(), budget / (1024.0 * 1024.0));
+
+	const int frames = 300;
+	const GLfloat viewSize = 0.1f;
+	vector<double> updateMs;
+	size_t maxResidentNodes = 0, maxResidentBytes = 0;
+	for ( int f = 0; f < frames; ++f ) {
+		const chrono::high_resolution_clock::time_point frameStart = chrono::high_resolution_clock::now();
+		const double angle = 2 * MY_PI * f / frames;
+		streamer.update((GLfloat) (0.7 * cos(angle)), (GLfloat) (0.7 * sin(angle)), 2 * viewSize);
+		updateMs.push_back(elapsedMs(frameStart));
+		maxResidentNodes = max(maxResidentNodes, streamer.stats().residentNodes);
+		maxResidentBytes = max(maxResidentBytes, streamer.stats().residentBytes);
+		this_thread::sleep_until(frameStart + chrono::milliseconds(16));
+	}
+
+	const StreamingStats &stats = streamer.stats();
+	sort(updateMs.begin(), updateMs.end());
+	printf("update:    p50 %.3f ms, p95 %.3f ms, max %.3f ms\n", updateMs[frames / 2], updateMs[frames * 95 / 100], updateMs.back());
+	printf("resident:  %lu nodes, %.1f MB now; at most %lu nodes, %.1f MB\n", (unsigned long) stats.residentNodes, stats.residentBytes / (1024.0 * 1024.0),
+	       (unsigned long) maxResidentNodes, maxResidentBytes / (1024.0 * 1024.0));
+	printf("paged:     %lu pages in (%.1f MB), %lu pages out (%.1f MB), %lu pending\n", (unsigned long) stats.pagesLoaded, stats.bytesPagedIn / (1024.0 * 1024.0),
+	       (unsigned long) stats.pagesEvicted, stats.bytesPagedOut / (1024.0 * 1024.0), (unsigned long) stats.pendingPages);
+	printf("latency:   p50 < %.2f ms, p95 < %.2f ms\n", stats.latency.percentile(0.5), stats.latency.percentile(0.95));
+	stats.latency.print(stdout);
+	remove(path);
+	return 0;
+}
@@ -0,0 +1,122 @@
+/********************
+ *
+ * Micro-benchmark for the specialized transform types in Transforms.hpp.
+ * No OpenGL context is needed.
+ *
+ * Build (from CS177/CS177):
+ *   g++ -O2 -std=c++11 -msse2 bench/TransformBenchmark.cpp -o transform_bench
+ *
+ * For each composition it multiplies N random parent/child pairs (N fits in
+ * L1 and is repeated, best of 7 trials) and prints the multiplies + adds the product needs, the
+ * ns per composition, and both relative to the full 4x4 product through
+ * mat4Multiply that GLMatrix4 uses. Every result is stored back to 4x4 and
+ * compared with the 4x4 product of the stored operands; the largest
+ * difference is printed so a wrong specialization shows up immediately.
+ *
+ ********************/
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "../Transforms.hpp"
+
+using namespace std;
+
+//compile-time composition: nothing of this is left at run time
+static_assert((Translation(1, 2, 3) * Translation(1, 1, 1)).z == 4, "constexpr translation product");
+static_assert((Translation(1, 0, 0) * Affine2D::scaling(2, 2) * Translation(1, 0, 0)).tx == 3, "constexpr mixed product");
+
+static float frand() {
+	return rand() / (float) RAND_MAX * 2 - 1;
+}
+
+static void randomize(Translation &t) {
+	t = Translation(frand(), frand(), frand());
+}
+
+static void randomize(Affine2D &t) {
+	t = Affine2D::rotation(frand() * 3) * Affine2D::scaling(frand(), frand()) * Translation(frand(), frand(), frand());
+}
+
+static void randomize(Affine3D &t) {
+	t = Affine3D(frand(), frand(), frand(), frand(), frand(), frand(), frand(), frand(), frand(), frand(), frand(), frand());
+}
+
+static void randomize(Projective &t) {
+	for ( int i = 0; i < 16; ++i )
+		t.m[i] = frand();
+}
+
+enum { COUNT = 1024, REPS = 1024, TRIALS = 7 };
+static volatile float sink;
+
+struct Result {
+	double ns;
+	float maxError;
+};
+
+template<class A, class B>
+static Result run() {
+	typedef typename TransformProduct<A, B>::type R;
+	vector<A> parents(COUNT);
+	vector<B> children(COUNT);
+	vector<R> out(COUNT);
+	for ( size_t i = 0; i < COUNT; ++i ) {
+		randomize(parents[i]);
+		randomize(children[i]);
+	}
+
+	//best of a few trials, the machine may be busy
+	Result result;
+	result.ns = 1e30;
+	for ( int trial = 0; trial < TRIALS; ++trial ) {
+		const chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		for ( int r = 0; r < REPS; ++r ) {
+			for ( size_t i = 0; i < COUNT; ++i )
+				out[i] = parents[i] * children[i];
+			//keeps the compiler from dropping the repetitions
+			float m[16];
+			out[r % COUNT].store(m);
+			sink += m[12];
+		}
+		result.ns = min(result.ns, chrono::duration<double, nano>(chrono::high_resolution_clock::now() - start).count() / ((double) REPS * COUNT));
+	}
+
+	//check the last pass against the 4x4 product
+	for ( int i = 0; i < COUNT; ++i )
+		out[i] = parents[i] * children[i];
+	result.maxError = 0;
+	for ( size_t i = 0; i < COUNT; ++i ) {
+		float p[16], c[16], expected[16], got[16];
+		parents[i].store(p);
+		children[i].store(c);
+		mat4Multiply(p, c, expected);
+		out[i].store(got);
+		for ( int k = 0; k < 16; ++k )
+			result.maxError = max(result.maxError, fabs(expected[k] - got[k]));
+	}
+	return result;
+}
+
+template<class A, class B>
+static void report(const char *name, int muls, int adds, double baselineNs) {
+	const Result r = run<A, B>();
+	printf("%-26s %5d %5d %8.2f%% %9.2f %8.2fx %10.2g\n", name, muls, adds, 100.0 * (muls + adds) / 112,
+	       r.ns, baselineNs / r.ns, r.maxError);
+}
+
+int main() {
+	srand(1);
+	const double baseline = run<Projective, Projective>().ns;
+	printf("%-26s %5s %5s %9s %9s %9s %10s\n", "composition", "muls", "adds", "flops", "ns", "speedup", "max err");
+	report<Projective, Projective>("Projective * Projective", 64, 48, baseline);
+	report<Affine3D, Affine3D>("Affine3D * Affine3D", 36, 27, baseline);
+	report<Affine3D, Translation>("Affine3D * Translation", 9, 9, baseline);
+	report<Translation, Affine3D>("Translation * Affine3D", 0, 3, baseline);
+	report<Affine2D, Affine2D>("Affine2D * Affine2D", 12, 9, baseline);
+	report<Affine2D, Translation>("Affine2D * Translation", 4, 5, baseline);
+	report<Translation, Affine2D>("Translation * Affine2D", 0, 3, baseline);
+	report<Affine2D, Affine3D>("Affine2D * Affine3D", 36, 27, baseline);
+	report<Translation, Translation>("Translation * Translation", 0, 3, baseline);
+	return 0;
+}